@@ -5,10 +5,24 @@
       'type': 'static_library',
       'sources': [
         'grid.cc',
-        'movement_factor.cc',
+        'conflict_policy.cc',
+        'distance_table.cc',
+        'factor_kernel.cc',
+        'factor_set.cc',
         'organism.cc',
+        'sampler.cc',
+        'species_factors.cc',
         'grid_object.cc',
       ],
+      # OpenMP is used to split up big batches of movement calculations.
+      'cflags': [
+        '-fopenmp',
+      ],
+      'all_dependent_settings': {
+        'ldflags': [
+          '-fopenmp',
+        ],
+      },
     },
     {
       'target_name': 'automata_test',
@@ -21,5 +35,15 @@
         'automata_test.cc',
       ],
     },
+    {
+      'target_name': 'movement_benchmark',
+      'type': 'executable',
+      'dependencies': [
+        'automata',
+      ],
+      'sources': [
+        'movement_benchmark.cc',
+      ],
+    },
   ],
 }
@@ -1,9 +1,19 @@
-#include <list>
+#include <math.h>
 
+#include <memory>
+#include <vector>
+
+#include "automata/conflict_policy.h"
+#include "automata/distance_table.h"
+#include "automata/factor_kernel.h"
+#include "automata/factor_set.h"
 #include "automata/grid.h"
 #include "automata/grid_object.h"
 #include "automata/organism.h"
-#include "automata/movement_factor.h"
+#include "automata/movement_kernel.h"
+#include "automata/object_pool.h"
+#include "automata/random.h"
+#include "automata/sampler.h"
 #include "gtest/gtest.h"
 
 namespace automata {
@@ -72,7 +82,7 @@ TEST_F(AutomataTest, NeighborhoodTest) {
 
 TEST_F(AutomataTest, OutOfBoundsTest) {
   // Does GetNeighborhoodLocations deal properly with out-of-bounds input?
-  ::std::list<int> xs, ys;
+  ::std::vector<int> xs, ys;
   // Giving it a starting point outside the boundaries of the grid should make
   // it fail.
   EXPECT_FALSE(grid_.GetNeighborhoodLocations(-1, -1, &xs, &ys));
@@ -92,20 +102,23 @@ TEST_F(AutomataTest, MotionTest) {
   }
 
   // Use GetNeighborhoodLocations to generate xs and ys vectors.
-  ::std::list<int> xs, ys;
+  ::std::vector<int> xs, ys;
   grid_.GetNeighborhoodLocations(1, 1, &xs, &ys);
 
+  DiscreteSampler sampler;
+  sampler.Reset(probabilities, 8);
   int new_x, new_y;
-  grid_.DoMovement(probabilities, xs, ys, &new_x, &new_y);
-  EXPECT_EQ(*(xs.begin()), new_x);
-  EXPECT_EQ(*(ys.begin()), new_y);
+  grid_.DoMovement(&sampler, xs, ys, 0.5, &new_x, &new_y);
+  EXPECT_EQ(xs[0], new_x);
+  EXPECT_EQ(ys[0], new_y);
+  EXPECT_EQ(1u, grid_.stats().linear_samples);
 }
 
 TEST_F(AutomataTest, MotionFactorsTest) {
   // Do movement factors influence probabilities the way we would expect?
-  ::std::list<MovementFactor> factors;
+  FactorSet factors;
   double probabilities[8];
-  ::std::list<int> xs, ys;
+  ::std::vector<int> xs, ys;
   grid_.GetNeighborhoodLocations(1, 1, &xs, &ys);
 
   // No factors should lead to equal probability for every location.
@@ -115,8 +128,7 @@ TEST_F(AutomataTest, MotionFactorsTest) {
   }
 
   // A factor with a strength of zero should have the same effect.
-  MovementFactor factor(0, 0, 0, -1);
-  factors.push_back(factor);
+  factors.Add(0, 0, 0, -1);
   grid_.CalculateProbabilities(factors, xs, ys, probabilities);
   for (int i = 1; i < 8; ++i) {
     EXPECT_EQ(probabilities[0], probabilities[i]);
@@ -124,7 +136,7 @@ TEST_F(AutomataTest, MotionFactorsTest) {
 
   // An attractive factor in the neighborhood should lead to a high probability
   // for its location.
-  factors.begin()->SetStrength(100);
+  factors.set_strength(0, 100);
   grid_.CalculateProbabilities(factors, xs, ys, probabilities);
   for (int i = 1; i < 8; ++i) {
     EXPECT_GT(probabilities[0], probabilities[i]);
@@ -132,10 +144,7 @@ TEST_F(AutomataTest, MotionFactorsTest) {
 
   // Two attractive factors in opposite corners of the neighborhood should
   // create two "poles" of attraction.
-  factor.SetX(2);
-  factor.SetY(2);
-  factor.SetStrength(100);
-  factors.push_back(factor);
+  factors.Add(2, 2, 100, -1);
   grid_.CalculateProbabilities(factors, xs, ys, probabilities);
   // The two poles.
   EXPECT_EQ(probabilities[5], probabilities[0]);
@@ -146,19 +155,18 @@ TEST_F(AutomataTest, MotionFactorsTest) {
   }
 
   // A repulsive factor in the neighborhood should do the opposite.
-  factors.pop_back();
-  factors.begin()->SetStrength(-100);
-  grid_.CalculateProbabilities(factors, xs, ys, probabilities);
+  FactorSet repulsive;
+  repulsive.Add(0, 0, -100, -1);
+  grid_.CalculateProbabilities(repulsive, xs, ys, probabilities);
   for (int i = 1; i < 8; ++i) {
     EXPECT_LT(probabilities[0], probabilities[i]);
   }
 
   // An attractive factor just outside the neighborhood should work similarly to
   // one inside the neighborhood.
-  factors.begin()->SetX(3);
-  factors.begin()->SetY(1);
-  factors.begin()->SetStrength(100);
-  grid_.CalculateProbabilities(factors, xs, ys, probabilities);
+  FactorSet outside;
+  outside.Add(3, 1, 100, -1);
+  grid_.CalculateProbabilities(outside, xs, ys, probabilities);
   for (int i = 1; i < 7; ++i) {
     EXPECT_GT(probabilities[7], probabilities[i]);
   }
@@ -173,15 +181,188 @@ TEST_F(AutomataTest, MotionFactorsTest) {
 
   // This same attractive factor should stop working if we set its visibility
   // low enough.
-  auto invisible_factors = factors;
-  invisible_factors.begin()->SetVisibility(1);
-  grid_.RemoveInvisible(1, 1, &invisible_factors, -1);
-  EXPECT_TRUE(invisible_factors.empty());
+  ::std::vector<int> visible;
+  outside.FindVisible(1, 1, -1, 0, &visible);
+  EXPECT_EQ(1u, visible.size());
+  FactorSet invisible = outside;
+  invisible.set_visibility(0, 1);
+  invisible.FindVisible(1, 1, -1, 0, &visible);
+  EXPECT_TRUE(visible.empty());
 
   // We should also get this same result if we set the organism's vision low
   // enough.
-  grid_.RemoveInvisible(1, 1, &factors, 1);
-  EXPECT_TRUE(factors.empty());
+  outside.FindVisible(1, 1, 1, 0, &visible);
+  EXPECT_TRUE(visible.empty());
+}
+
+// Does the grid publish baked positions only when it gets updated?
+TEST_F(AutomataTest, BakedPositionsTest) {
+  GridObject object1(&grid_, 0);
+  const BakedPositions &positions = grid_.baked_positions();
+  const int slot1 = object1.slot();
+
+  // Nothing is baked until the grid gets updated.
+  ASSERT_TRUE(object1.Initialize(1, 2));
+  EXPECT_EQ(-1, positions.xs[slot1]);
+  EXPECT_EQ(-1, positions.ys[slot1]);
+  ASSERT_TRUE(grid_.Update());
+  EXPECT_EQ(1, positions.xs[slot1]);
+  EXPECT_EQ(2, positions.ys[slot1]);
+
+  // Moving doesn't change anything until the next update either.
+  ASSERT_TRUE(object1.SetPosition(2, 2));
+  EXPECT_EQ(1, positions.xs[slot1]);
+  ASSERT_TRUE(grid_.Update());
+  EXPECT_EQ(2, positions.xs[slot1]);
+  EXPECT_EQ(2, positions.ys[slot1]);
+
+  // Slots get reused once their objects are gone.
+  int slot2;
+  {
+    GridObject object2(&grid_, 1);
+    slot2 = object2.slot();
+    EXPECT_NE(slot1, slot2);
+  }
+  GridObject object3(&grid_, 2);
+  EXPECT_EQ(slot2, object3.slot());
+
+  // Objects that outlive their grid shouldn't try to give their slots back.
+  ::std::unique_ptr<GridObject> orphan;
+  {
+    Grid grid(4, 4);
+    orphan.reset(new GridObject(&grid, 0));
+    ASSERT_TRUE(orphan->Initialize(0, 0));
+  }
+  orphan.reset();
+}
+
+// Do handles go stale when their objects are destroyed, even if the slot gets
+// reused?
+TEST_F(AutomataTest, ObjectHandleTest) {
+  GridObject source(&grid_, 0);
+  ASSERT_TRUE(source.Initialize(3, 3));
+  ASSERT_TRUE(grid_.Update());
+  EXPECT_EQ(&source, grid_.ResolveHandle(source.handle()));
+  EXPECT_EQ(nullptr, grid_.ResolveHandle(kNoHandle));
+
+  ObjectHandle stale;
+  int stale_slot;
+  FactorSet factors;
+  {
+    GridObject doomed(&grid_, 1);
+    ASSERT_TRUE(doomed.Initialize(4, 4));
+    ASSERT_TRUE(grid_.Update());
+    stale = doomed.handle();
+    stale_slot = doomed.slot();
+    factors.AddFromSource(&doomed, 1, -1);
+    factors.AddFromSource(&source, 1, -1);
+  }
+  EXPECT_EQ(nullptr, grid_.ResolveHandle(stale));
+
+  // Something new in the same slot shouldn't be mistaken for the old object.
+  GridObject replacement(&grid_, 2);
+  ASSERT_TRUE(replacement.Initialize(5, 5));
+  ASSERT_TRUE(grid_.Update());
+  ASSERT_EQ(stale_slot, replacement.slot());
+  EXPECT_NE(stale, replacement.handle());
+  EXPECT_EQ(nullptr, grid_.ResolveHandle(stale));
+  EXPECT_EQ(&replacement, grid_.ResolveHandle(replacement.handle()));
+
+  // Factors that follow the old object shouldn't follow the new one.
+  int x, y;
+  factors.GetPosition(0, &x, &y);
+  EXPECT_EQ(-1, x);
+  EXPECT_EQ(-1, y);
+  ::std::vector<int> visible;
+  factors.FindVisible(0, 0, -1, 0, &visible);
+  ASSERT_EQ(1u, visible.size());
+  EXPECT_EQ(source.handle(), factors.handle(visible[0]));
+}
+
+// Does the pool reuse storage instead of allocating more?
+TEST_F(AutomataTest, ObjectPoolTest) {
+  ObjectPool<Organism> pool(4);
+  ::std::vector<Organism *> organisms;
+  for (int i = 0; i < 6; ++i) {
+    organisms.push_back(pool.Spawn(&grid_, i));
+    EXPECT_EQ(i, organisms.back()->get_index());
+  }
+  EXPECT_EQ(6, pool.live());
+  EXPECT_EQ(8, pool.capacity());
+  // Things that get spawned together should be next to each other.
+  EXPECT_EQ(organisms[0] + 1, organisms[1]);
+
+  // Despawning and spawning again should reuse the same storage.
+  Organism *old = organisms[2];
+  pool.Despawn(old);
+  organisms[2] = pool.Spawn(&grid_, 10);
+  EXPECT_EQ(old, organisms[2]);
+  EXPECT_EQ(10, organisms[2]->get_index());
+  EXPECT_EQ(8, pool.capacity());
+
+  for (Organism *organism : organisms) {
+    pool.Despawn(organism);
+  }
+  EXPECT_EQ(0, pool.live());
+}
+
+// Does removing factors from a set leave the right ones behind?
+TEST_F(AutomataTest, FactorSetTest) {
+  GridObject object1(&grid_, 0);
+  GridObject object2(&grid_, 1);
+  ASSERT_TRUE(object1.Initialize(1, 2));
+  ASSERT_TRUE(object2.Initialize(3, 4));
+  ASSERT_TRUE(grid_.Update());
+
+  FactorSet factors;
+  factors.AddFromSource(&object1, 1, -1);
+  factors.Add(5, 5, 2, -1);
+  factors.AddFromSource(&object2, 3, -1);
+  factors.AddFromSource(&object1, 4, -1);
+  ASSERT_EQ(4, factors.size());
+
+  // Factors from objects should be wherever the objects are baked, and can't be
+  // moved on their own.
+  int x, y;
+  factors.GetPosition(2, &x, &y);
+  EXPECT_EQ(3, x);
+  EXPECT_EQ(4, y);
+  EXPECT_FALSE(factors.SetPosition(2, 0, 0));
+  EXPECT_TRUE(factors.SetPosition(1, 6, 6));
+
+  // Both of object1's factors should go, and the others should still be
+  // intact.
+  EXPECT_EQ(2, factors.RemoveSource(&object1));
+  ASSERT_EQ(2, factors.size());
+  int total_strength = 0;
+  for (int i = 0; i < factors.size(); ++i) {
+    EXPECT_NE(&object1, factors.source(i));
+    total_strength += factors.strength(i);
+  }
+  EXPECT_EQ(5, total_strength);
+
+  // Gathering should lay out the factors we ask for in the order we ask for
+  // them.
+  ::std::vector<int> xs, ys;
+  ::std::vector<double> strengths;
+  const int object2_index = factors.source(0) == &object2 ? 0 : 1;
+  EXPECT_EQ(5, factors.Gather(::std::vector<int>({object2_index,
+                                                   1 - object2_index}),
+                              &xs, &ys, &strengths));
+  ASSERT_EQ(2u, xs.size());
+  EXPECT_EQ(3, xs[0]);
+  EXPECT_EQ(4, ys[0]);
+  EXPECT_EQ(3, strengths[0]);
+  EXPECT_EQ(6, xs[1]);
+  EXPECT_EQ(6, ys[1]);
+  EXPECT_EQ(2, strengths[1]);
+
+  // Selecting should copy just those factors.
+  FactorSet selected;
+  selected.Select(factors, ::std::vector<int>({1 - object2_index}));
+  ASSERT_EQ(1, selected.size());
+  EXPECT_EQ(nullptr, selected.source(0));
+  EXPECT_EQ(2, selected.strength(0));
 }
 
 TEST_F(AutomataTest, UpdateAndConflictTest) {
@@ -313,6 +494,28 @@ TEST_F(AutomataTest, ConflictResolutionTest) {
   EXPECT_TRUE(conflicts2.empty());
 }
 
+// Can objects tell what kind of thing they are without RTTI?
+TEST_F(AutomataTest, KindTest) {
+  GridObject object(&grid_, 0);
+  Organism organism(&grid_, 1);
+  EXPECT_EQ(GridObject::kObject, object.kind());
+  EXPECT_EQ(GridObject::kOrganism, organism.kind());
+
+  EXPECT_EQ(nullptr, Organism::FromObject(&object));
+  EXPECT_EQ(nullptr, Organism::FromObject(nullptr));
+  GridObject *upcast = &organism;
+  EXPECT_EQ(&organism, Organism::FromObject(upcast));
+
+  // The default handler only knows how to deal with other organisms.
+  ASSERT_TRUE(object.Initialize(0, 0));
+  ASSERT_TRUE(organism.Initialize(1, 1));
+  ASSERT_TRUE(grid_.Update());
+  EXPECT_TRUE(object.SetPosition(2, 2));
+  EXPECT_FALSE(organism.SetPosition(2, 2));
+  EXPECT_EQ(&organism, grid_.GetConflict(2, 2));
+  EXPECT_FALSE(organism.DefaultConflictHandler());
+}
+
 // The mechanism for requesting that a cell stays the same to the next cycle is
 // kind of intricate. Does it work as planned?
 TEST_F(AutomataTest, StasisRequestTest) {
@@ -434,18 +637,55 @@ TEST_F(AutomataTest, CleanupOrganismTest) {
   organism1.AddFactorFromOrganism(&organism2, 1);
 
   // We should now have a movement factor referencing organism2.
-  const ::std::list<MovementFactor> &factors = organism1.factors();
-  ASSERT_EQ(1u, factors.size());
-  ASSERT_EQ(&organism2, factors.begin()->GetOrganism());
+  const FactorSet &factors = organism1.factors();
+  ASSERT_EQ(1, factors.size());
+  ASSERT_EQ(&organism2, factors.source(0));
 
   // Try cleaning up after organism2.
   organism1.CleanupOrganism(organism2);
 
   // We should now have no movement factors at all.
-  const ::std::list<MovementFactor> &new_factors = organism1.factors();
+  const FactorSet &new_factors = organism1.factors();
   EXPECT_TRUE(new_factors.empty());
 }
 
+// Does dying clean up every reference to an organism, in both directions?
+TEST_F(AutomataTest, ReleaseReferencesTest) {
+  Organism organism1(&grid_, 0);
+  Organism organism3(&grid_, 2);
+  ASSERT_TRUE(organism1.Initialize(0, 0));
+  ASSERT_TRUE(organism3.Initialize(2, 2));
+  {
+    Organism organism2(&grid_, 1);
+    ASSERT_TRUE(organism2.Initialize(1, 1));
+    ASSERT_TRUE(grid_.Update());
+
+    organism1.AddFactorFromOrganism(&organism2, 1);
+    organism1.AddFactorFromOrganism(&organism3, 1);
+    organism3.AddFactorFromOrganism(&organism2, 1);
+    organism2.AddFactorFromOrganism(&organism1, 1);
+
+    organism2.Die();
+    EXPECT_FALSE(organism2.IsAlive());
+    EXPECT_TRUE(organism2.factors().empty());
+    ASSERT_EQ(1, organism1.factors().size());
+    EXPECT_EQ(&organism3, organism1.factors().source(0));
+    EXPECT_TRUE(organism3.factors().empty());
+
+    // Following it again and then destroying it should also be fine.
+    organism3.AddFactorFromOrganism(&organism2, 1);
+  }
+  EXPECT_TRUE(organism3.factors().empty());
+
+  // Factors that follow something that has been removed from the grid
+  // shouldn't be visible, even if nobody cleaned them up.
+  EXPECT_EQ(1, organism1.GetVisibleFactors(0, 0).size());
+  ASSERT_TRUE(organism3.RemoveFromGrid());
+  ::std::vector<int> visible;
+  organism1.factors().FindVisible(0, 0, -1, 0, &visible);
+  EXPECT_TRUE(visible.empty());
+}
+
 // Does the organisms class handle some of the stasis request edge cases
 // correctly? (This was an issue in the past.)
 TEST_F(AutomataTest, OrganismStasisTest) {
@@ -472,5 +712,1055 @@ TEST_F(AutomataTest, OrganismStasisTest) {
   EXPECT_EQ(nullptr, grid_.GetPending(0, 0));
 }
 
+// Does the cache of visible factors get rebuilt when it needs to be?
+TEST_F(AutomataTest, VisibleFactorCacheTest) {
+  Organism organism1(&grid_, 0);
+  Organism organism2(&grid_, 1);
+  ASSERT_TRUE(organism1.Initialize(0, 0));
+  ASSERT_TRUE(organism2.Initialize(4, 0));
+  ASSERT_TRUE(grid_.Update());
+
+  organism1.set_vision(2);
+  organism1.set_skin(1);
+  organism1.AddFactorFromOrganism(&organism2, 1);
+
+  // organism2 is outside our vision plus our skin.
+  EXPECT_TRUE(organism1.GetVisibleFactors(0, 0).empty());
+
+  // Moving it one cell closer leaves it outside our vision, so the old cache is
+  // still good.
+  ASSERT_TRUE(organism2.SetPosition(3, 0));
+  ASSERT_TRUE(grid_.Update());
+  EXPECT_TRUE(organism1.GetVisibleFactors(0, 0).empty());
+
+  // Moving it once more puts it inside our vision, so the cache has to notice.
+  ASSERT_TRUE(organism2.SetPosition(2, 0));
+  ASSERT_TRUE(grid_.Update());
+  const FactorSet &visible = organism1.GetVisibleFactors(0, 0);
+  ASSERT_EQ(1, visible.size());
+  EXPECT_EQ(&organism2, visible.source(0));
+
+  // Cleaning up after organism2 should clear it from the cache as well.
+  organism1.CleanupOrganism(organism2);
+  EXPECT_TRUE(organism1.GetVisibleFactors(0, 0).empty());
+}
+
+// Do organisms feel factors from members of other species without needing a
+// factor for every pair of them?
+TEST_F(AutomataTest, SpeciesFactorsTest) {
+  Organism observer(&grid_, 0);
+  Organism near(&grid_, 1);
+  Organism far(&grid_, 2);
+  ASSERT_TRUE(observer.Initialize(0, 0));
+  ASSERT_TRUE(near.Initialize(2, 0));
+  ASSERT_TRUE(far.Initialize(8, 8));
+  observer.set_species(0);
+  near.set_species(1);
+  far.set_species(1);
+  ASSERT_TRUE(grid_.Update());
+
+  // Members of species 1 are only visible from 3 cells away.
+  grid_.species_factors()->Set(0, 1, 10, 3);
+  observer.set_skin(0);
+  const FactorSet &visible = observer.GetVisibleFactors(0, 0);
+  ASSERT_EQ(1, visible.size());
+  EXPECT_EQ(&near, visible.source(0));
+  EXPECT_EQ(10, visible.strength(0));
+
+  // Species 1 doesn't feel anything, and we shouldn't feel ourselves.
+  EXPECT_TRUE(near.GetVisibleFactors(2, 0).empty());
+  grid_.species_factors()->Set(0, 0, 10, -1);
+  EXPECT_EQ(1, observer.GetVisibleFactors(0, 0).size());
+  grid_.species_factors()->Remove(0, 0);
+
+  // New members should show up once they've been baked.
+  observer.set_skin(5);
+  EXPECT_EQ(1, observer.GetVisibleFactors(0, 0).size());
+  Organism newcomer(&grid_, 3);
+  ASSERT_TRUE(newcomer.Initialize(0, 2));
+  newcomer.set_species(1);
+  EXPECT_EQ(1, observer.GetVisibleFactors(0, 0).size());
+  ASSERT_TRUE(grid_.Update());
+  EXPECT_EQ(2, observer.GetVisibleFactors(0, 0).size());
+
+  // Members that get removed shouldn't get found anymore.
+  ::std::vector<int> slots;
+  grid_.FindSpecies(1, 0, 0, -1, &slots);
+  EXPECT_EQ(3u, slots.size());
+  ASSERT_TRUE(near.RemoveFromGrid());
+  grid_.FindSpecies(1, 0, 0, -1, &slots);
+  ASSERT_EQ(2u, slots.size());
+  for (int slot : slots) {
+    EXPECT_NE(&near, grid_.GetSlotObject(slot));
+  }
+  grid_.FindSpecies(1, 0, 0, 3, &slots);
+  ASSERT_EQ(1u, slots.size());
+  EXPECT_EQ(&newcomer, grid_.GetSlotObject(slots[0]));
+}
+
+// Does the cache of visible factors only get rebuilt for motion in species
+// that we actually feel factors from?
+TEST_F(AutomataTest, SpeciesMotionTest) {
+  Organism observer(&grid_, 0);
+  Organism member(&grid_, 1);
+  Organism far_member(&grid_, 2);
+  Organism stranger(&grid_, 3);
+  ASSERT_TRUE(observer.Initialize(0, 0));
+  ASSERT_TRUE(member.Initialize(3, 0));
+  ASSERT_TRUE(far_member.Initialize(8, 8));
+  ASSERT_TRUE(stranger.Initialize(0, 5));
+  observer.set_species(0);
+  member.set_species(1);
+  far_member.set_species(1);
+  stranger.set_species(2);
+  ASSERT_TRUE(grid_.Update());
+
+  grid_.species_factors()->Set(0, 1, 10, -1);
+  observer.set_vision(2);
+  observer.set_skin(1);
+  // member is outside our vision, but inside our skin.
+  EXPECT_EQ(1, observer.GetVisibleFactors(0, 0).size());
+  // Taking it off the grid doesn't mean that anything new could be visible, so
+  // the cache keeps it around.
+  ASSERT_TRUE(member.RemoveFromGrid());
+  EXPECT_EQ(1, observer.GetVisibleFactors(0, 0).size());
+
+  // We don't feel anything from species 2, so it can move as far as it likes.
+  ASSERT_TRUE(stranger.SetPosition(3, 8));
+  ASSERT_TRUE(grid_.Update());
+  EXPECT_DOUBLE_EQ(0, grid_.motion_bound(1));
+  EXPECT_GT(grid_.motion_bound(2), 1);
+  EXPECT_EQ(1, observer.GetVisibleFactors(0, 0).size());
+
+  // Moving anything in species 1 farther than our skin makes it rebuild.
+  ASSERT_TRUE(far_member.SetPosition(6, 6));
+  ASSERT_TRUE(grid_.Update());
+  EXPECT_GT(grid_.motion_bound(1), 1);
+  EXPECT_TRUE(observer.GetVisibleFactors(0, 0).empty());
+}
+
+// Do all the implementations of the factor kernel that we can run here agree
+// with the scalar one?
+TEST_F(AutomataTest, FactorKernelEquivalenceTest) {
+  // Lay out some factors and locations, making sure that some of them coincide
+  // and that the number of locations isn't a multiple of the vector width.
+  ::std::vector<int> factor_xs, factor_ys;
+  ::std::vector<double> strengths;
+  for (int i = 0; i < 13; ++i) {
+    factor_xs.push_back((i * 7) % 11);
+    factor_ys.push_back((i * 5) % 9);
+    strengths.push_back(i % 2 ? 100 - i : -i);
+  }
+  // Put one factor off the grid, where it is farther away than anything in the
+  // table.
+  factor_xs.push_back(-20);
+  factor_ys.push_back(30);
+  strengths.push_back(5);
+  ::std::vector<int> xs, ys;
+  for (int i = 0; i < 37; ++i) {
+    xs.push_back(i % 9);
+    ys.push_back((i * 3) % 9);
+  }
+  const DistanceTable table(9, 9, DistanceTable::InverseFifthPower);
+
+  ::std::vector<double> expected(xs.size(), 0);
+  factor_kernel::AccumulateScalar(factor_xs.data(), factor_ys.data(),
+                                  strengths.data(), factor_xs.size(), xs.data(),
+                                  ys.data(), xs.size(), table.data(),
+                                  table.size(), expected.data());
+
+  // The scalar version should match the table directly.
+  for (uint32_t i = 0; i < xs.size(); ++i) {
+    double total = 0;
+    for (uint32_t f = 0; f < factor_xs.size(); ++f) {
+      const int dx = xs[i] - factor_xs[f];
+      const int dy = ys[i] - factor_ys[f];
+      total += strengths[f] * table.Lookup(dx * dx + dy * dy);
+    }
+    EXPECT_DOUBLE_EQ(total, expected[i]);
+  }
+
+  ::std::vector<FactorKernel> kernels = {GetFactorKernel()};
+  if (factor_kernel::HasAvx2()) {
+    kernels.push_back(factor_kernel::AccumulateAvx2);
+  }
+  if (factor_kernel::HasAvx512()) {
+    kernels.push_back(factor_kernel::AccumulateAvx512);
+  }
+
+  for (FactorKernel kernel : kernels) {
+    ::std::vector<double> weights(xs.size(), 0);
+    kernel(factor_xs.data(), factor_ys.data(), strengths.data(),
+           factor_xs.size(), xs.data(), ys.data(), xs.size(), table.data(),
+           table.size(), weights.data());
+    for (uint32_t i = 0; i < xs.size(); ++i) {
+      EXPECT_NEAR(expected[i], weights[i], fabs(expected[i]) * 1e-9);
+    }
+  }
+}
+
+// Do distance tables only get as big as they have to, and still give the right
+// weights for distances that they don't cover?
+TEST_F(AutomataTest, DistanceTableTest) {
+  DistanceTable table(DistanceTable::Exponential(2.0));
+  EXPECT_EQ(1, table.size());
+  table.Cover(100);
+  EXPECT_EQ(101, table.size());
+  table.Cover(10);
+  EXPECT_EQ(101, table.size());
+  // Huge grids don't get huge tables.
+  table.Cover(static_cast<int64_t>(100000) * 100000);
+  EXPECT_EQ(DistanceTable::kMaxSize, table.size());
+  const DistanceTable grid_table(10000, 10000,
+                                DistanceTable::InverseFifthPower);
+  EXPECT_EQ(DistanceTable::kMaxSize, grid_table.size());
+
+  // Anything past the end gets calculated.
+  const DistanceTable small_table(DistanceTable::Exponential(2.0));
+  EXPECT_DOUBLE_EQ(exp(-5.0 / 2.0), small_table.Evaluate(25));
+  EXPECT_DOUBLE_EQ(DistanceTable::InverseFifthPower(DistanceTable::kMaxSize),
+                   grid_table.Evaluate(DistanceTable::kMaxSize));
+
+  // That includes when a whole batch of them gets added up.
+  const movement_kernel::TableKernel kernel(&small_table);
+  const int factor_xs[] = {0, 30};
+  const int factor_ys[] = {0, -40};
+  const double strengths[] = {2.0, 1.0};
+  const int xs[] = {0, 1, 2, 3, 4};
+  const int ys[] = {4, 3, 2, 1, 0};
+  double weights[5] = {0};
+  movement_kernel::Accumulate(kernel, factor_xs, factor_ys, strengths, 2, xs,
+                              ys, 5, weights);
+  for (int i = 0; i < 5; ++i) {
+    double expected = 0;
+    for (int f = 0; f < 2; ++f) {
+      const int dx = xs[i] - factor_xs[f];
+      const int dy = ys[i] - factor_ys[f];
+      expected += strengths[f] * exp(-sqrt(dx * dx + dy * dy) / 2.0);
+    }
+    EXPECT_NEAR(expected, weights[i], 1.0e-12);
+  }
+
+  // Moving on a big grid only needs a table for as far as we can see.
+  Grid grid(2000, 2000);
+  FactorSet factors;
+  factors.Add(1010, 1010, 100, -1);
+  Random random(5, 0, 0, Random::kMovement);
+  int new_x, new_y;
+  EXPECT_TRUE(grid.MoveObject(1000, 1000, factors, &random, &new_x, &new_y, 2,
+                              20));
+  EXPECT_LE(998, new_x);
+  EXPECT_GE(1002, new_x);
+}
+
+// Does our Philox implementation match the published known-answer vectors?
+TEST_F(AutomataTest, PhiloxKnownAnswerTest) {
+  uint32_t output[4];
+
+  const uint32_t zero_counter[4] = {0, 0, 0, 0};
+  const uint32_t zero_key[2] = {0, 0};
+  Random::Philox(zero_counter, zero_key, output);
+  EXPECT_EQ(0x6627e8d5u, output[0]);
+  EXPECT_EQ(0xe169c58du, output[1]);
+  EXPECT_EQ(0xbc57ac4cu, output[2]);
+  EXPECT_EQ(0x9b00dbd8u, output[3]);
+
+  const uint32_t pi_counter[4] = {0x243f6a88, 0x85a308d3, 0x13198a2e,
+                                  0x03707344};
+  const uint32_t pi_key[2] = {0xa4093822, 0x299f31d0};
+  Random::Philox(pi_counter, pi_key, output);
+  EXPECT_EQ(0xd16cfe09u, output[0]);
+  EXPECT_EQ(0x94fdccebu, output[1]);
+  EXPECT_EQ(0x5001e420u, output[2]);
+  EXPECT_EQ(0x24126ea1u, output[3]);
+}
+
+// Do random streams depend only on what identifies them?
+TEST_F(AutomataTest, RandomStreamTest) {
+  Random stream1(42, 3, 7, Random::kMovement);
+  Random stream2(42, 3, 7, Random::kMovement);
+  Random other_tick(42, 4, 7, Random::kMovement);
+  Random other_purpose(42, 3, 7, Random::kConflict);
+
+  bool tick_differs = false;
+  bool purpose_differs = false;
+  for (int i = 0; i < 10; ++i) {
+    const uint32_t value = stream1.Next();
+    EXPECT_EQ(value, stream2.Next());
+    tick_differs |= value != other_tick.Next();
+    purpose_differs |= value != other_purpose.Next();
+
+    const double uniform = stream1.Uniform();
+    stream2.Uniform();
+    EXPECT_LE(0.0, uniform);
+    EXPECT_GT(1.0, uniform);
+  }
+  EXPECT_TRUE(tick_differs);
+  EXPECT_TRUE(purpose_differs);
+}
+
+// Do organisms on grids with the same seed move the same way?
+TEST_F(AutomataTest, ReproducibleMovementTest) {
+  ::std::vector<int> paths[2];
+  for (int run = 0; run < 2; ++run) {
+    Grid grid(9, 9);
+    grid.set_seed(1234);
+    Organism organism(&grid, 0);
+    ASSERT_TRUE(organism.Initialize(4, 4));
+    ASSERT_TRUE(grid.Update());
+
+    for (int i = 0; i < 10; ++i) {
+      ASSERT_TRUE(organism.UpdatePosition());
+      ASSERT_TRUE(grid.Update());
+      int x, y;
+      organism.get_position(&x, &y);
+      paths[run].push_back(x);
+      paths[run].push_back(y);
+    }
+  }
+
+  EXPECT_EQ(paths[0], paths[1]);
+}
+
+// Do all the sampling methods draw from the right distribution?
+TEST_F(AutomataTest, SamplerTest) {
+  // Make a distribution that's too big to scan, with some impossible entries.
+  ::std::vector<double> weights;
+  for (int i = 0; i < 100; ++i) {
+    weights.push_back(i % 3 ? i : 0);
+  }
+  DiscreteSampler sampler;
+  sampler.Reset(weights.data(), weights.size());
+
+  // The first draw should use binary search, and after that we should switch
+  // to the alias table.
+  DiscreteSampler::Method method;
+  sampler.Sample(0.5, &method);
+  EXPECT_EQ(DiscreteSampler::kBinarySearch, method);
+  sampler.Sample(0.5, &method);
+  EXPECT_EQ(DiscreteSampler::kAlias, method);
+
+  // Both methods should give us roughly the right frequencies.
+  const int kDraws = 200000;
+  double total = 0;
+  for (double weight : weights) {
+    total += weight;
+  }
+  for (int pass = 0; pass < 2; ++pass) {
+    Random random(7, 0, pass, Random::kMovement);
+    ::std::vector<int> counts(weights.size(), 0);
+    DiscreteSampler reused;
+    reused.Reset(weights.data(), weights.size());
+    for (int i = 0; i < kDraws; ++i) {
+      if (pass == 0) {
+        // Reset every time so we always binary search.
+        reused.Reset(weights.data(), weights.size());
+      }
+      ++counts[reused.Sample(random.Uniform())];
+    }
+    for (uint32_t i = 0; i < weights.size(); ++i) {
+      const double expected = weights[i] / total;
+      EXPECT_NEAR(expected, static_cast<double>(counts[i]) / kDraws, 0.005);
+    }
+  }
+
+  // Small distributions should always get scanned.
+  sampler.Reset(weights.data(), DiscreteSampler::kMaxLinearSize);
+  sampler.Sample(0.5, &method);
+  sampler.Sample(0.5, &method);
+  EXPECT_EQ(DiscreteSampler::kLinear, method);
+}
+
+// Does sampled movement end up where the factors want it to?
+TEST_F(AutomataTest, SampledMovementTest) {
+  FactorSet factors;
+  factors.Add(7, 7, 100, -1);
+  Random random(99, 0, 0, Random::kMovement);
+
+  // Almost all the weight is on the factor's location, so we should end up
+  // there most of the time.
+  const int kMoves = 1000;
+  int at_factor = 0;
+  for (int i = 0; i < kMoves; ++i) {
+    int new_x, new_y;
+    ASSERT_TRUE(grid_.MoveObjectSampled(4, 4, factors, &random, &new_x, &new_y,
+                                        3, -1, 32));
+    EXPECT_LE(1, new_x);
+    EXPECT_GE(7, new_x);
+    EXPECT_LE(1, new_y);
+    EXPECT_GE(7, new_y);
+    if (new_x == 7 && new_y == 7) {
+      ++at_factor;
+    }
+  }
+  EXPECT_GT(at_factor, kMoves / 2);
+  EXPECT_EQ(kMoves * 32u, grid_.stats().proposals);
+
+  // We should never go somewhere blacklisted.
+  grid_.SetBlacklisted(7, 7, true);
+  for (int i = 0; i < kMoves; ++i) {
+    int new_x, new_y;
+    ASSERT_TRUE(grid_.MoveObjectSampled(4, 4, factors, &random, &new_x, &new_y,
+                                        3, -1, 32));
+    EXPECT_FALSE(new_x == 7 && new_y == 7);
+  }
+  ASSERT_TRUE(grid_.Update());
+
+  // Organisms should be able to use it.
+  Organism organism(&grid_, 0);
+  ASSERT_TRUE(organism.Initialize(4, 4));
+  ASSERT_TRUE(grid_.Update());
+  organism.set_speed(3);
+  organism.set_movement_mode(Organism::kSampled, 8);
+  organism.AddFactor(7, 7, 100);
+  EXPECT_TRUE(organism.UpdatePosition());
+}
+
+// Does sampled movement pick from the same distribution as exhaustive movement?
+TEST_F(AutomataTest, SampledDistributionTest) {
+  // Spread out attractive factors, so that every location has a real chance.
+  FactorSet factors;
+  factors.Add(6, 6, 10, -1);
+  factors.Add(2, 3, 5, -1);
+  const KernelSpec kernel(KernelSpec::kExponential, 2);
+  Random sampled_random(7, 0, 0, Random::kMovement);
+  Random exhaustive_random(7, 0, 1, Random::kMovement);
+
+  const int kMoves = 20000;
+  ::std::vector<int> sampled_visits(81, 0), exhaustive_visits(81, 0);
+  for (int i = 0; i < kMoves; ++i) {
+    int new_x, new_y;
+    ASSERT_TRUE(grid_.MoveObjectSampled(4, 4, factors, &sampled_random,
+                                        &new_x, &new_y, 2, -1, 64, kernel));
+    ++sampled_visits[new_x * 9 + new_y];
+    ASSERT_TRUE(grid_.MoveObject(4, 4, factors, &exhaustive_random, &new_x,
+                                 &new_y, 2, -1, kernel));
+    ++exhaustive_visits[new_x * 9 + new_y];
+  }
+
+  for (int i = 0; i < 81; ++i) {
+    EXPECT_NEAR(static_cast<double>(exhaustive_visits[i]) / kMoves,
+                static_cast<double>(sampled_visits[i]) / kMoves, 0.015);
+  }
+}
+
+// Do the different movement kernels weight things the way they should?
+TEST_F(AutomataTest, MovementKernelTest) {
+  // The table specialization should agree with just looking everything up.
+  const DistanceTable table(9, 9, DistanceTable::Exponential(2.0));
+  const movement_kernel::TableKernel table_kernel(&table);
+  EXPECT_DOUBLE_EQ(1.0, table_kernel.Weight(0));
+  EXPECT_DOUBLE_EQ(exp(-2.5), table_kernel.Weight(25));
+
+  const int factor_xs[] = {0, 8, 3};
+  const int factor_ys[] = {0, 8, 5};
+  const double strengths[] = {2.0, -1.0, 0.5};
+  ::std::vector<int> xs, ys;
+  for (int i = 0; i < 9; ++i) {
+    for (int j = 0; j < 9; ++j) {
+      xs.push_back(i);
+      ys.push_back(j);
+    }
+  }
+  ::std::vector<double> weights(xs.size(), 0);
+  movement_kernel::Accumulate(table_kernel, factor_xs, factor_ys, strengths, 3,
+                              xs.data(), ys.data(), xs.size(), weights.data());
+  for (uint32_t i = 0; i < xs.size(); ++i) {
+    double expected = 0;
+    for (int f = 0; f < 3; ++f) {
+      const int dx = xs[i] - factor_xs[f];
+      const int dy = ys[i] - factor_ys[f];
+      expected += strengths[f] * exp(-sqrt(dx * dx + dy * dy) / 2.0);
+    }
+    EXPECT_NEAR(expected, weights[i], 1.0e-12);
+  }
+
+  // Cutoff and linear kernels.
+  const movement_kernel::CutoffKernel cutoff(3);
+  EXPECT_EQ(1.0, cutoff.Weight(9));
+  EXPECT_EQ(0.0, cutoff.Weight(10));
+  const movement_kernel::LinearKernel linear(4);
+  EXPECT_DOUBLE_EQ(1.0, linear.Weight(0));
+  EXPECT_DOUBLE_EQ(0.5, linear.Weight(4));
+  EXPECT_EQ(0.0, linear.Weight(25));
+
+  // A factor outside a cutoff kernel's radius shouldn't make any difference,
+  // so every location should be equally likely.
+  FactorSet factors;
+  factors.Add(8, 8, 100, -1);
+  const KernelSpec short_cutoff(KernelSpec::kCutoff, 2);
+  Random random(7, 0, 0, Random::kMovement);
+  const int kMoves = 9000;
+  int stayed = 0;
+  for (int i = 0; i < kMoves; ++i) {
+    int new_x, new_y;
+    ASSERT_TRUE(grid_.MoveObject(1, 1, factors, &random, &new_x, &new_y, 1, -1,
+                                 short_cutoff));
+    if (new_x == 1 && new_y == 1) {
+      ++stayed;
+    }
+  }
+  EXPECT_NEAR(1.0 / 9, static_cast<double>(stayed) / kMoves, 0.02);
+
+  // Within the radius, it should pull us towards it.
+  const KernelSpec long_linear(KernelSpec::kLinear, 20);
+  int toward = 0;
+  for (int i = 0; i < kMoves; ++i) {
+    int new_x, new_y;
+    ASSERT_TRUE(grid_.MoveObject(4, 4, factors, &random, &new_x, &new_y, 1, -1,
+                                 long_linear));
+    if (new_x == 5 && new_y == 5) {
+      ++toward;
+    }
+  }
+  EXPECT_GT(toward, kMoves / 9);
+
+  // Organisms should be able to use any of them.
+  Organism organism(&grid_, 0);
+  ASSERT_TRUE(organism.Initialize(4, 4));
+  ASSERT_TRUE(grid_.Update());
+  organism.AddFactor(7, 7, 100);
+  organism.set_kernel(KernelSpec::kExponential, 3);
+  EXPECT_TRUE(organism.UpdatePosition());
+  organism.set_movement_mode(Organism::kSampled, 8);
+  EXPECT_TRUE(organism.UpdatePosition());
+}
+
+// Do batched moves come out the same as doing them one at a time?
+TEST_F(AutomataTest, BatchedMovementTest) {
+  Grid grid(64, 64);
+
+  // Two sets of factors, so that blocks have some factors that everyone sees,
+  // and some that only some of them see. One of them can only be seen from
+  // nearby, and another is in both sets twice.
+  FactorSet factors1, factors2;
+  factors1.Add(10, 50, 100, -1);
+  factors1.Add(40, 12, -5, -1);
+  factors1.Add(60, 60, 30, -1);
+  factors1.Add(30, 30, 20, 10);
+  factors2.Add(60, 60, 30, -1);
+  factors2.Add(60, 60, 30, -1);
+
+  // Enough requests that the locations get split into multiple blocks.
+  const int kRequests = 300;
+  ::std::vector<MoveRequest> requests(kRequests);
+  ::std::vector<MoveRequest *> request_pointers;
+  for (int i = 0; i < kRequests; ++i) {
+    requests[i].x = 1 + i % 62;
+    requests[i].y = 1 + (i * 7) % 62;
+    requests[i].factors = i % 3 ? &factors1 : &factors2;
+    request_pointers.push_back(&requests[i]);
+  }
+  ASSERT_TRUE(grid.EvaluateMoves(request_pointers));
+
+  ::std::vector<int> visible;
+  for (int i = 0; i < kRequests; ++i) {
+    const MoveRequest &request = requests[i];
+    ASSERT_EQ(9u, request.xs.size());
+    ASSERT_EQ(request.xs.size(), request.weights.size());
+    const FactorSet &factors = *request.factors;
+    factors.FindVisible(request.x, request.y, -1, 0, &visible);
+    EXPECT_EQ(static_cast<int>(visible.size()), request.num_factors);
+
+    for (uint32_t j = 0; j < request.xs.size(); ++j) {
+      double expected = 0;
+      for (int f : visible) {
+        int factor_x, factor_y;
+        factors.GetPosition(f, &factor_x, &factor_y);
+        const int dx = factor_x - request.xs[j];
+        const int dy = factor_y - request.ys[j];
+        expected += factors.strength(f) *
+                    DistanceTable::InverseFifthPower(dx * dx + dy * dy);
+      }
+      EXPECT_NEAR(expected, request.weights[j], 1.0e-12);
+    }
+  }
+
+  // Finishing them should pick the same places that MoveObject() would.
+  for (int i = 0; i < kRequests; ++i) {
+    Random batch_random(3, 0, i, Random::kMovement);
+    Random single_random(3, 0, i, Random::kMovement);
+    int batch_x, batch_y, single_x, single_y;
+    grid.FinishMove(&requests[i], &batch_random, &batch_x, &batch_y);
+    ASSERT_TRUE(grid.MoveObject(requests[i].x, requests[i].y,
+                                *requests[i].factors, &single_random,
+                                &single_x, &single_y));
+    EXPECT_EQ(single_x, batch_x);
+    EXPECT_EQ(single_y, batch_y);
+  }
+
+  // Locations that become unusable after the batch shouldn't get picked.
+  MoveRequest request;
+  request.x = 20;
+  request.y = 20;
+  request.factors = &factors1;
+  ASSERT_TRUE(grid.EvaluateMoves({&request}));
+  for (int x = 19; x <= 21; ++x) {
+    for (int y = 19; y <= 21; ++y) {
+      if (x != 19 || y != 21) {
+        grid.SetBlacklisted(x, y, true);
+      }
+    }
+  }
+  Random random(3, 0, 0, Random::kMovement);
+  int new_x, new_y;
+  grid.FinishMove(&request, &random, &new_x, &new_y);
+  EXPECT_EQ(19, new_x);
+  EXPECT_EQ(21, new_y);
+  ASSERT_TRUE(grid.Update());
+
+  // Organisms should use moves that were prepared for them.
+  Organism organism1(&grid, 0);
+  Organism organism2(&grid, 1);
+  ASSERT_TRUE(organism1.Initialize(5, 5));
+  ASSERT_TRUE(organism2.Initialize(30, 30));
+  ASSERT_TRUE(grid.Update());
+  organism1.AddFactor(10, 50, 100);
+  organism2.AddFactor(10, 50, 100);
+  ASSERT_TRUE(Organism::PrepareMoves({&organism1, &organism2}));
+  grid.ResetStats();
+  EXPECT_TRUE(organism1.UpdatePosition());
+  EXPECT_TRUE(organism2.UpdatePosition());
+  EXPECT_EQ(2u, grid.stats().linear_samples);
+}
+
+// Do cached distributions get reused only when nothing has changed?
+TEST_F(AutomataTest, MovementCacheTest) {
+  FactorSet factors;
+  factors.Add(8, 8, 100, -1);
+  Random random(5, 0, 0, Random::kMovement);
+  MovementCache cache;
+  int new_x, new_y;
+
+  // The first time, there's nothing to reuse.
+  ASSERT_TRUE(grid_.MoveObject(4, 4, factors, &random, &new_x, &new_y, 3, -1,
+                               KernelSpec(), &cache));
+  EXPECT_EQ(0u, grid_.stats().cache_hits);
+  EXPECT_EQ(1u, grid_.stats().cache_misses);
+
+  // Nothing changed, so it should get reused. This is also the second draw
+  // from a big distribution, so it should use the alias method.
+  ASSERT_TRUE(grid_.MoveObject(4, 4, factors, &random, &new_x, &new_y, 3, -1,
+                               KernelSpec(), &cache));
+  EXPECT_EQ(1u, grid_.stats().cache_hits);
+  EXPECT_EQ(1u, grid_.stats().alias_samples);
+  EXPECT_TRUE(grid_.IsCacheCurrent(cache, 4, 4, factors, 3, -1, KernelSpec()));
+
+  // Changing the factors, the location, or the kernel should all make it
+  // recalculate.
+  factors.Add(0, 8, -10, -1);
+  EXPECT_FALSE(
+      grid_.IsCacheCurrent(cache, 4, 4, factors, 3, -1, KernelSpec()));
+  ASSERT_TRUE(grid_.MoveObject(4, 4, factors, &random, &new_x, &new_y, 3, -1,
+                               KernelSpec(), &cache));
+  ASSERT_TRUE(grid_.MoveObject(4, 5, factors, &random, &new_x, &new_y, 3, -1,
+                               KernelSpec(), &cache));
+  ASSERT_TRUE(grid_.MoveObject(4, 5, factors, &random, &new_x, &new_y, 3, -1,
+                               KernelSpec(KernelSpec::kLinear, 10), &cache));
+  EXPECT_EQ(1u, grid_.stats().cache_hits);
+  EXPECT_EQ(4u, grid_.stats().cache_misses);
+
+  // Changing the usable cells, like when we retry after a conflict, should only
+  // renormalize the weights we already have.
+  grid_.SetBlacklisted(5, 5, true);
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_TRUE(grid_.MoveObject(4, 5, factors, &random, &new_x, &new_y, 3, -1,
+                                 KernelSpec(KernelSpec::kLinear, 10), &cache));
+    EXPECT_FALSE(new_x == 5 && new_y == 5);
+  }
+  EXPECT_EQ(101u, grid_.stats().cache_hits);
+  EXPECT_EQ(1u, grid_.stats().cache_renormalizations);
+  EXPECT_EQ(4u, grid_.stats().cache_misses);
+  ASSERT_TRUE(grid_.Update());
+
+  // The same goes for when it becomes usable again.
+  ASSERT_TRUE(grid_.MoveObject(4, 5, factors, &random, &new_x, &new_y, 3, -1,
+                               KernelSpec(KernelSpec::kLinear, 10), &cache));
+  EXPECT_EQ(2u, grid_.stats().cache_renormalizations);
+  EXPECT_EQ(4u, grid_.stats().cache_misses);
+
+  // Organisms retrying a move from the same place shouldn't have to look at
+  // their factors again.
+  Organism organism(&grid_, 0);
+  ASSERT_TRUE(organism.Initialize(4, 4));
+  ASSERT_TRUE(grid_.Update());
+  organism.AddFactor(8, 8, 100);
+  grid_.ResetStats();
+  EXPECT_TRUE(organism.UpdatePosition());
+  EXPECT_TRUE(organism.UpdatePosition(4, 4));
+  EXPECT_EQ(1u, grid_.stats().cache_hits);
+  EXPECT_EQ(1u, grid_.stats().cache_misses);
+
+  // Factors that aren't visible shouldn't matter.
+  factors.Add(0, 0, 50, 1);
+  EXPECT_TRUE(grid_.IsCacheCurrent(cache, 4, 5, factors, 3, -1,
+                                   KernelSpec(KernelSpec::kLinear, 10)));
+
+  // Organisms can keep using it on later ticks too, as long as nothing that
+  // they feel factors from has moved.
+  Organism stayer(&grid_, 1);
+  Organism source(&grid_, 2);
+  Organism stranger(&grid_, 3);
+  ASSERT_TRUE(stayer.Initialize(1, 1));
+  ASSERT_TRUE(source.Initialize(7, 1));
+  ASSERT_TRUE(stranger.Initialize(1, 7));
+  stayer.set_species(0);
+  source.set_species(1);
+  stranger.set_species(2);
+  ASSERT_TRUE(grid_.Update());
+  grid_.species_factors()->Set(0, 1, 100, -1);
+  // It can't go anywhere, so it always moves from the same place.
+  stayer.set_speed(0);
+  grid_.ResetStats();
+  EXPECT_TRUE(stayer.UpdatePosition());
+  ASSERT_TRUE(stranger.SetPosition(2, 7));
+  ASSERT_TRUE(grid_.Update());
+  EXPECT_TRUE(stayer.UpdatePosition());
+  EXPECT_EQ(1u, grid_.stats().cache_hits);
+  EXPECT_EQ(1u, grid_.stats().cache_misses);
+
+  // Once something that it feels moves or goes away, it has to start over.
+  ASSERT_TRUE(source.SetPosition(7, 2));
+  ASSERT_TRUE(grid_.Update());
+  EXPECT_TRUE(stayer.UpdatePosition());
+  EXPECT_EQ(2u, grid_.stats().cache_misses);
+  ASSERT_TRUE(source.RemoveFromGrid());
+  EXPECT_TRUE(stayer.UpdatePosition());
+  EXPECT_EQ(1u, grid_.stats().cache_hits);
+  EXPECT_EQ(3u, grid_.stats().cache_misses);
+
+  // Members of that species that are too far away to see don't matter, even
+  // when they move.
+  Organism near(&grid_, 4);
+  Organism far(&grid_, 5);
+  ASSERT_TRUE(near.Initialize(3, 1));
+  ASSERT_TRUE(far.Initialize(7, 7));
+  near.set_species(1);
+  far.set_species(1);
+  stayer.set_vision(3);
+  ASSERT_TRUE(grid_.Update());
+  grid_.ResetStats();
+  EXPECT_TRUE(stayer.UpdatePosition());
+  ASSERT_TRUE(far.SetPosition(7, 6));
+  ASSERT_TRUE(grid_.Update());
+  EXPECT_TRUE(stayer.UpdatePosition());
+  EXPECT_EQ(1u, grid_.stats().cache_hits);
+  EXPECT_EQ(1u, grid_.stats().cache_misses);
+
+  // The ones that it can see still do.
+  ASSERT_TRUE(near.SetPosition(3, 2));
+  ASSERT_TRUE(grid_.Update());
+  EXPECT_TRUE(stayer.UpdatePosition());
+  EXPECT_EQ(1u, grid_.stats().cache_hits);
+  EXPECT_EQ(2u, grid_.stats().cache_misses);
+}
+
+// Do organisms stay away from cells that other things are moving to, unless
+// they're chasing prey?
+TEST_F(AutomataTest, PendingAwareMovementTest) {
+  Organism mover(&grid_, 0);
+  Organism other(&grid_, 1);
+  ASSERT_TRUE(mover.Initialize(4, 4));
+  ASSERT_TRUE(other.Initialize(6, 6));
+  ASSERT_TRUE(grid_.Update());
+  mover.set_species(0);
+  other.set_species(1);
+  // Now the other one is pending insertion right where we want to go.
+  ASSERT_TRUE(other.SetPosition(5, 5));
+
+  FactorSet factors;
+  factors.Add(5, 5, 100, -1);
+  Random random(11, 0, 0, Random::kMovement);
+  const int kMoves = 200;
+
+  // By default, we don't care.
+  int conflicting = 0;
+  for (int i = 0; i < kMoves; ++i) {
+    int new_x, new_y;
+    ASSERT_TRUE(grid_.MoveObject(4, 4, factors, &random, &new_x, &new_y, 1,
+                                 -1, KernelSpec(), nullptr, &mover));
+    if (new_x == 5 && new_y == 5) {
+      ++conflicting;
+    }
+  }
+  EXPECT_GT(conflicting, kMoves / 2);
+
+  // When we're avoiding pending cells, we should never go there.
+  mover.set_pending_weight(0);
+  for (int i = 0; i < kMoves; ++i) {
+    int new_x, new_y;
+    ASSERT_TRUE(grid_.MoveObject(4, 4, factors, &random, &new_x, &new_y, 1,
+                                 -1, KernelSpec(), nullptr, &mover));
+    EXPECT_FALSE(new_x == 5 && new_y == 5);
+    ASSERT_TRUE(grid_.MoveObjectSampled(4, 4, factors, &random, &new_x,
+                                        &new_y, 1, -1, 8, KernelSpec(),
+                                        &mover));
+    EXPECT_FALSE(new_x == 5 && new_y == 5);
+  }
+
+  // Unless it's our prey that's moving there.
+  mover.AddPrey(1);
+  conflicting = 0;
+  for (int i = 0; i < kMoves; ++i) {
+    int new_x, new_y;
+    ASSERT_TRUE(grid_.MoveObject(4, 4, factors, &random, &new_x, &new_y, 1,
+                                 -1, KernelSpec(), nullptr, &mover));
+    if (new_x == 5 && new_y == 5) {
+      ++conflicting;
+    }
+  }
+  EXPECT_GT(conflicting, kMoves / 2);
+}
+
+TEST_F(AutomataTest, ConflictPolicyTest) {
+  ConflictPolicy policy;
+  // Anything we don't know about gets the default.
+  EXPECT_EQ(ConflictPolicy::kRandomLoser, policy.Get(0, 1));
+  EXPECT_EQ(ConflictPolicy::kRandomLoser, policy.Get(-1, 1));
+
+  // Eating only goes one way, but everything else goes both ways.
+  policy.Set(0, 1, ConflictPolicy::kEat);
+  policy.Set(2, 1, ConflictPolicy::kSwap);
+  EXPECT_EQ(ConflictPolicy::kEat, policy.Get(0, 1));
+  EXPECT_EQ(ConflictPolicy::kRandomLoser, policy.Get(1, 0));
+  EXPECT_EQ(ConflictPolicy::kSwap, policy.Get(2, 1));
+  EXPECT_EQ(ConflictPolicy::kSwap, policy.Get(1, 2));
+  // Growing the table shouldn't have lost anything.
+  policy.Set(5, 5, ConflictPolicy::kCustom);
+  EXPECT_EQ(ConflictPolicy::kEat, policy.Get(0, 1));
+  EXPECT_EQ(ConflictPolicy::kSwap, policy.Get(1, 2));
+  EXPECT_EQ(ConflictPolicy::kCustom, policy.Get(5, 5));
+
+  policy.set_default_action(ConflictPolicy::kRetreat);
+  EXPECT_EQ(ConflictPolicy::kRetreat, policy.Get(1, 0));
+  EXPECT_EQ(ConflictPolicy::kRetreat, policy.Get(3, 4));
+}
+
+TEST_F(AutomataTest, ResolveConflictsTest) {
+  ConflictPolicy policy;
+  policy.Set(0, 1, ConflictPolicy::kEat);
+  policy.Set(3, 4, ConflictPolicy::kSwap);
+  policy.Set(5, 6, ConflictPolicy::kRetreat);
+  policy.Set(7, 8, ConflictPolicy::kCustom);
+
+  Organism predator(&grid_, 0);
+  Organism prey(&grid_, 1);
+  Organism wanderer1(&grid_, 2);
+  Organism wanderer2(&grid_, 3);
+  Organism stayer(&grid_, 4);
+  Organism swapper(&grid_, 5);
+  Organism retreater1(&grid_, 6);
+  Organism retreater2(&grid_, 7);
+  Organism custom1(&grid_, 8);
+  Organism custom2(&grid_, 9);
+  ASSERT_TRUE(predator.Initialize(2, 2));
+  ASSERT_TRUE(prey.Initialize(3, 3));
+  ASSERT_TRUE(wanderer1.Initialize(6, 6));
+  ASSERT_TRUE(wanderer2.Initialize(8, 6));
+  ASSERT_TRUE(stayer.Initialize(0, 5));
+  ASSERT_TRUE(swapper.Initialize(1, 5));
+  ASSERT_TRUE(retreater1.Initialize(6, 0));
+  ASSERT_TRUE(retreater2.Initialize(8, 0));
+  ASSERT_TRUE(custom1.Initialize(4, 8));
+  ASSERT_TRUE(custom2.Initialize(5, 8));
+  ASSERT_TRUE(grid_.Update());
+  predator.set_species(0);
+  prey.set_species(1);
+  wanderer1.set_species(2);
+  wanderer2.set_species(2);
+  stayer.set_species(3);
+  swapper.set_species(4);
+  retreater1.set_species(5);
+  retreater2.set_species(6);
+  custom1.set_species(7);
+  custom2.set_species(8);
+
+  // Make everything conflict.
+  ASSERT_TRUE(prey.SetPosition(3, 3));
+  EXPECT_FALSE(predator.SetPosition(3, 3));
+  ASSERT_TRUE(wanderer1.SetPosition(7, 6));
+  EXPECT_FALSE(wanderer2.SetPosition(7, 6));
+  ASSERT_TRUE(stayer.SetPosition(0, 5));
+  EXPECT_FALSE(swapper.SetPosition(0, 5));
+  ASSERT_TRUE(retreater1.SetPosition(7, 0));
+  EXPECT_FALSE(retreater2.SetPosition(7, 0));
+  ASSERT_TRUE(custom1.SetPosition(4, 8));
+  EXPECT_FALSE(custom2.SetPosition(4, 8));
+
+  ConflictResults results;
+  EXPECT_TRUE(grid_.ResolveConflicts(policy, &results));
+  ASSERT_EQ(1u, results.rounds.size());
+  const ConflictRound &round = results.rounds[0];
+  EXPECT_EQ(5, round.conflicts);
+  EXPECT_EQ(1, round.eaten);
+  EXPECT_EQ(1, round.swapped);
+  EXPECT_EQ(1, round.retreated);
+  EXPECT_EQ(1, round.relocated);
+  EXPECT_EQ(1, round.custom);
+  EXPECT_EQ(0, round.failed);
+
+  // The predator ate the prey.
+  ASSERT_EQ(1u, results.eaters.size());
+  EXPECT_EQ(&predator, results.eaters[0]);
+  EXPECT_EQ(&prey, results.eaten[0]);
+  // The custom conflict is still there for us to deal with.
+  ASSERT_EQ(1u, results.custom1.size());
+  EXPECT_EQ(&custom1, results.custom1[0]);
+  EXPECT_EQ(&custom2, results.custom2[0]);
+  EXPECT_FALSE(grid_.Update());
+  ASSERT_TRUE(custom2.SetPosition(5, 8));
+  ASSERT_TRUE(grid_.Update());
+
+  EXPECT_EQ(&predator, grid_.GetOccupant(3, 3));
+  // Exactly one of the wanderers got the cell.
+  int x1, y1, x2, y2;
+  wanderer1.get_position(&x1, &y1);
+  wanderer2.get_position(&x2, &y2);
+  EXPECT_TRUE((x1 == 7 && y1 == 6) != (x2 == 7 && y2 == 6));
+  // The stayer and the swapper traded places.
+  EXPECT_EQ(&swapper, grid_.GetOccupant(0, 5));
+  EXPECT_EQ(&stayer, grid_.GetOccupant(1, 5));
+  // One of the retreaters went back where it came from.
+  EXPECT_TRUE((grid_.GetOccupant(7, 0) == &retreater1 &&
+               grid_.GetOccupant(8, 0) == &retreater2) ||
+              (grid_.GetOccupant(7, 0) == &retreater2 &&
+               grid_.GetOccupant(6, 0) == &retreater1));
+}
+
+TEST_F(AutomataTest, ContenderTest) {
+  GridObject object0(&grid_, 0);
+  GridObject object1(&grid_, 1);
+  GridObject object2(&grid_, 2);
+  GridObject object3(&grid_, 3);
+  ASSERT_TRUE(object0.Initialize(3, 3));
+  ASSERT_TRUE(object1.Initialize(3, 5));
+  ASSERT_TRUE(object2.Initialize(5, 3));
+  ASSERT_TRUE(object3.Initialize(5, 5));
+  ASSERT_TRUE(grid_.Update());
+
+  // They all want the same cell, and none of them should get lost.
+  ASSERT_TRUE(object0.SetPosition(4, 4));
+  EXPECT_FALSE(object1.SetPosition(4, 4));
+  EXPECT_FALSE(object2.SetPosition(4, 4));
+  EXPECT_FALSE(object3.SetPosition(4, 4));
+  ::std::vector<GridObject *> contenders;
+  grid_.GetContenders(4, 4, &contenders);
+  EXPECT_EQ((::std::vector<GridObject *>{&object0, &object1, &object2,
+                                         &object3}),
+            contenders);
+  ::std::vector<GridObject *> objects1, objects2;
+  grid_.GetConflicted(&objects1, &objects2);
+  EXPECT_EQ(3u, objects1.size());
+  EXPECT_EQ(&object0, object3.GetConflict());
+  EXPECT_EQ(&object1, object0.GetConflict());
+
+  // Taking one out of the middle leaves the rest alone.
+  EXPECT_TRUE(object2.SetPosition(5, 3));
+  grid_.GetContenders(4, 4, &contenders);
+  EXPECT_EQ((::std::vector<GridObject *>{&object0, &object1, &object3}),
+            contenders);
+
+  // Taking out the pending one moves everything else up.
+  EXPECT_TRUE(object0.SetPosition(3, 3));
+  EXPECT_EQ(&object1, grid_.GetPending(4, 4));
+  EXPECT_EQ(&object3, grid_.GetConflict(4, 4));
+  EXPECT_FALSE(grid_.Update());
+
+  EXPECT_TRUE(object3.SetPosition(5, 5));
+  grid_.GetContenders(4, 4, &contenders);
+  EXPECT_TRUE(contenders.empty());
+  ASSERT_TRUE(grid_.Update());
+  EXPECT_EQ(&object1, grid_.GetOccupant(4, 4));
+}
+
+TEST_F(AutomataTest, ResolveManyContendersTest) {
+  ConflictPolicy policy;
+  policy.Set(0, 0, ConflictPolicy::kRetreat);
+
+  const int kXs[] = {3, 3, 5, 5, 4};
+  const int kYs[] = {3, 5, 3, 5, 3};
+  ::std::vector< ::std::unique_ptr<Organism> > organisms;
+  for (int i = 0; i < 5; ++i) {
+    organisms.emplace_back(new Organism(&grid_, i));
+    ASSERT_TRUE(organisms.back()->Initialize(kXs[i], kYs[i]));
+    organisms.back()->set_species(0);
+  }
+  ASSERT_TRUE(grid_.Update());
+  for (auto &organism : organisms) {
+    organism->SetPosition(4, 4);
+  }
+
+  // Everything should get sorted out in a single round.
+  ConflictResults results;
+  EXPECT_TRUE(grid_.ResolveConflicts(policy, &results));
+  ASSERT_EQ(1u, results.rounds.size());
+  EXPECT_EQ(4, results.rounds[0].conflicts);
+  EXPECT_EQ(4, results.rounds[0].retreated);
+  ASSERT_TRUE(grid_.Update());
+
+  // One of them got the cell, and the rest went back where they came from.
+  int winners = 0;
+  for (int i = 0; i < 5; ++i) {
+    int x, y;
+    organisms[i]->get_position(&x, &y);
+    if (x == 4 && y == 4) {
+      ++winners;
+    } else {
+      EXPECT_EQ(kXs[i], x);
+      EXPECT_EQ(kYs[i], y);
+    }
+  }
+  EXPECT_EQ(1, winners);
+}
+
+TEST_F(AutomataTest, ExclusionMaskTest) {
+  ExclusionMask mask(4, 4, 1);
+  mask.Exclude(3, 3);
+  // This is outside the neighborhood, so it should get ignored.
+  mask.Exclude(7, 7);
+  EXPECT_TRUE(mask.IsExcluded(3, 3));
+  EXPECT_FALSE(mask.IsExcluded(4, 4));
+  EXPECT_FALSE(mask.IsExcluded(7, 7));
+
+  // Big neighborhoods don't fit inline, but should work the same way.
+  ExclusionMask big_mask(4, 4, 20);
+  big_mask.Exclude(24, 24);
+  big_mask.Exclude(-16, 4);
+  EXPECT_TRUE(big_mask.IsExcluded(24, 24));
+  EXPECT_TRUE(big_mask.IsExcluded(-16, 4));
+  EXPECT_FALSE(big_mask.IsExcluded(23, 24));
+
+  // Pending cells get excluded.
+  GridObject object1(&grid_, 0);
+  GridObject object2(&grid_, 1);
+  ASSERT_TRUE(object1.Initialize(3, 4));
+  ASSERT_TRUE(object2.Initialize(0, 0));
+  ASSERT_TRUE(grid_.Update());
+  ASSERT_TRUE(object1.SetPosition(5, 5));
+  ExclusionMask pending(4, 4, 1);
+  grid_.ExcludePending(&pending);
+  EXPECT_TRUE(pending.IsExcluded(5, 5));
+  EXPECT_FALSE(pending.IsExcluded(3, 4));
+  EXPECT_FALSE(pending.IsExcluded(0, 0));
+
+  // Moves never go anywhere that's excluded.
+  FactorSet factors;
+  factors.Add(5, 5, 100, -1);
+  Random random(3, 0, 0, Random::kMovement);
+  MovementCache cache;
+  for (int i = 0; i < 100; ++i) {
+    int new_x, new_y;
+    ASSERT_TRUE(grid_.MoveObject(4, 4, factors, &random, &new_x, &new_y, 1,
+                                 -1, KernelSpec(), &cache, nullptr,
+                                 &pending));
+    EXPECT_FALSE(new_x == 5 && new_y == 5);
+    ASSERT_TRUE(grid_.MoveObjectSampled(4, 4, factors, &random, &new_x,
+                                        &new_y, 1, -1, 8, KernelSpec(),
+                                        nullptr, &pending));
+    EXPECT_FALSE(new_x == 5 && new_y == 5);
+  }
+  ASSERT_TRUE(grid_.Update());
+}
+
 }  //  testing
 }  //  automata
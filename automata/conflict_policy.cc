@@ -0,0 +1,46 @@
+#include <assert.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "automata/conflict_policy.h"
+
+namespace automata {
+
+void ConflictPolicy::Set(int species1, int species2, Action action) {
+  assert(species1 >= 0 && species2 >= 0 && "Invalid species.");
+
+  const int needed = ::std::max(species1, species2) + 1;
+  if (needed > num_species_) {
+    // Make the table bigger, keeping everything where it was.
+    ::std::vector<int> actions(needed * needed, -1);
+    for (int i = 0; i < num_species_; ++i) {
+      ::std::copy(actions_.begin() + i * num_species_,
+                  actions_.begin() + (i + 1) * num_species_,
+                  actions.begin() + i * needed);
+    }
+    actions_.swap(actions);
+    num_species_ = needed;
+  }
+
+  actions_[species1 * num_species_ + species2] = action;
+  if (action != kEat) {
+    actions_[species2 * num_species_ + species1] = action;
+  }
+}
+
+ConflictPolicy::Action ConflictPolicy::Get(int species1, int species2) const {
+  if (species1 < 0 || species2 < 0 || species1 >= num_species_ ||
+      species2 >= num_species_) {
+    // We don't know anything about at least one of them.
+    return default_action_;
+  }
+
+  const int action = actions_[species1 * num_species_ + species2];
+  if (action < 0) {
+    return default_action_;
+  }
+  return static_cast<Action>(action);
+}
+
+}  //  automata
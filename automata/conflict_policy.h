@@ -0,0 +1,62 @@
+#ifndef ECOSYSTEM_AUTOMATA_CONFLICT_POLICY_H_
+#define ECOSYSTEM_AUTOMATA_CONFLICT_POLICY_H_
+
+#include <vector>
+
+namespace automata {
+
+// A table that decides how Grid::ResolveConflicts() settles a conflict,
+// based on the species of the two objects involved.
+class ConflictPolicy {
+ public:
+  // The ways that a conflict can be settled.
+  enum Action {
+    // Flip a coin, and make the loser pick somewhere else to move. This is the
+    // same thing that Organism::DefaultConflictHandler() does.
+    kRandomLoser = 0,
+    // One of them eats the other one, and gets the cell.
+    kEat = 1,
+    // One of them moves to where the other one came from. If one of them was
+    // trying to stay put, that's the one that moves, so they trade places.
+    kSwap = 2,
+    // One of them goes back to where it came from. If one of them was trying
+    // to stay put, the other one is the one that goes back.
+    kRetreat = 3,
+    // Leave the conflict alone, so that whoever called ResolveConflicts() can
+    // deal with it.
+    kCustom = 4,
+  };
+
+  ConflictPolicy() = default;
+
+  // Sets what happens when members of two species conflict. Every action
+  // except kEat applies both ways round.
+  // species1: The first species. For kEat, this is the one that does the
+  // eating.
+  // species2: The second species.
+  // action: What happens.
+  void Set(int species1, int species2, Action action);
+  // Looks up what happens when members of two species conflict.
+  // species1: The first species.
+  // species2: The second species.
+  // Returns: What happens. For kEat, species1 eats species2.
+  Action Get(int species1, int species2) const;
+  // Sets what happens for pairs of species that were never passed to Set().
+  // action: What happens. kEat doesn't make sense here.
+  void set_default_action(Action action) { default_action_ = action; }
+  // Returns: What happens for pairs of species that were never Set().
+  Action get_default_action() const { return default_action_; }
+
+ private:
+  // A flat table of the actions for each pair of species, indexed by
+  // species1 * num_species_ + species2. Pairs that were never set are -1.
+  ::std::vector<int> actions_;
+  // How many species the table has room for.
+  int num_species_ = 0;
+  // What happens for pairs that were never set.
+  Action default_action_ = kRandomLoser;
+};
+
+}  //  automata
+
+#endif
@@ -0,0 +1,46 @@
+#include <math.h>
+
+#include "automata/distance_table.h"
+
+namespace automata {
+
+DistanceTable::DistanceTable(const Function &function) : function_(function) {
+  Cover(0);
+}
+
+DistanceTable::DistanceTable(int x_size, int y_size, const Function &function)
+    : function_(function) {
+  // The farthest apart two cells can be is opposite corners.
+  Cover(static_cast<int64_t>(x_size - 1) * (x_size - 1) +
+        static_cast<int64_t>(y_size - 1) * (y_size - 1));
+}
+
+void DistanceTable::Cover(int64_t distance_squared) {
+  if (distance_squared >= kMaxSize) {
+    distance_squared = kMaxSize - 1;
+  }
+  if (distance_squared < size()) {
+    return;
+  }
+
+  values_.reserve(distance_squared + 1);
+  for (int i = size(); i <= distance_squared; ++i) {
+    values_.push_back(function_(i));
+  }
+}
+
+double DistanceTable::InverseFifthPower(int distance_squared) {
+  if (!distance_squared) {
+    // If our factor is in the same location that we are.
+    return 10;
+  }
+  return 1.0 / pow(distance_squared, 2.5);
+}
+
+DistanceTable::Function DistanceTable::Exponential(double scale) {
+  return [scale](int distance_squared) {
+    return exp(-sqrt(distance_squared) / scale);
+  };
+}
+
+}  // namespace automata
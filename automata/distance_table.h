@@ -0,0 +1,93 @@
+#ifndef ECOSYSTEM_AUTOMATA_DISTANCE_TABLE_H_
+#define ECOSYSTEM_AUTOMATA_DISTANCE_TABLE_H_
+
+#include <stdint.h>
+
+#include <functional>
+#include <vector>
+
+namespace automata {
+
+// Everything on the grid sits at integer coordinates, so the squared distance
+// between any two things is an integer too. This class takes advantage of that
+// by precomputing some function of the distance for every squared distance
+// up to some limit, so that looking it up later doesn't need any square roots
+// or powers. The limit only grows as far as it has to, and never past kMaxSize
+// entries, so big grids don't need huge tables.
+class DistanceTable {
+ public:
+  // Signature for functions that can be used to fill the table.
+  // distance_squared: The squared distance to compute the value for.
+  // Returns: The value for that distance.
+  typedef ::std::function<double(int distance_squared)> Function;
+
+  // The most entries that a table can have. This is enough for anything that
+  // can see about 700 cells away.
+  static constexpr int kMaxSize = 1 << 19;
+
+  // Builds a table that only covers a distance of zero. (See Cover().)
+  // function: The function to tabulate.
+  explicit DistanceTable(const Function &function);
+  // Builds a table that covers every distance on a grid, or as much of it as
+  // fits.
+  // x_size: Size of the grid in the x dimension.
+  // y_size: Size of the grid in the y dimension.
+  // function: The function to tabulate.
+  DistanceTable(int x_size, int y_size, const Function &function);
+
+  // Makes sure that the table covers every squared distance up to a limit, or
+  // as many of them as fit.
+  // distance_squared: The limit.
+  void Cover(int64_t distance_squared);
+  // distance_squared: The squared distance to check.
+  // Returns: Whether that distance has an entry in the table.
+  bool Covers(int64_t distance_squared) const {
+    return distance_squared < size();
+  }
+
+  // Looks up a value in the table. Distances that are too big for the table
+  // get the value for the biggest distance in it.
+  // distance_squared: The squared distance to look up.
+  // Returns: The tabulated value.
+  double Lookup(int distance_squared) const {
+    if (distance_squared >= size()) {
+      distance_squared = size() - 1;
+    }
+    return values_[distance_squared];
+  }
+  // Gets the value for a distance, from the table if it covers it, and by
+  // calculating it directly if it doesn't.
+  // distance_squared: The squared distance.
+  // Returns: The value.
+  double Evaluate(int distance_squared) const {
+    if (distance_squared < size()) {
+      return values_[distance_squared];
+    }
+    return function_(distance_squared);
+  }
+  // Returns: A pointer to the raw table, which is indexed by squared distance.
+  const double *data() const { return values_.data(); }
+  // Returns: The number of entries in the table.
+  int size() const { return values_.size(); }
+
+  // The default weighting function for movement factors. A factor at a
+  // distance of r counts for 1 / r^5, and one right on top of us counts for 10.
+  // distance_squared: The squared distance to the factor.
+  // Returns: The weight of a factor with a strength of one.
+  static double InverseFifthPower(int distance_squared);
+  // Builds a function that decays exponentially with distance, for
+  // KernelSpec::kExponential.
+  // scale: The distance in cells over which the value falls by a factor of e.
+  // Returns: A function that can be used to fill a table.
+  static Function Exponential(double scale);
+
+ private:
+  // The function that the table holds values of.
+  Function function_;
+  // The tabulated values, indexed by squared distance.
+  ::std::vector<double> values_;
+};
+
+}  // namespace automata
+
+#endif
@@ -0,0 +1,172 @@
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ECOSYSTEM_X86_KERNELS
+#endif
+
+#include "automata/factor_kernel.h"
+
+namespace automata {
+namespace factor_kernel {
+namespace {
+
+// Gets the weight for a particular squared distance from the table.
+inline double Lookup(const double *table, int table_size,
+                     int distance_squared) {
+  if (distance_squared >= table_size) {
+    distance_squared = table_size - 1;
+  }
+  return table[distance_squared];
+}
+
+// Handles whatever locations are left over after the vectorized loop.
+inline void AccumulateTail(const int *factor_xs, const int *factor_ys,
+                           const double *strengths, int num_factors,
+                           const int *xs, const int *ys, int start,
+                           int num_locations, const double *table,
+                           int table_size, double *weights) {
+  for (int f = 0; f < num_factors; ++f) {
+    for (int i = start; i < num_locations; ++i) {
+      const int dx = xs[i] - factor_xs[f];
+      const int dy = ys[i] - factor_ys[f];
+      weights[i] +=
+          strengths[f] * Lookup(table, table_size, dx * dx + dy * dy);
+    }
+  }
+}
+
+}  // namespace
+
+void AccumulateScalar(const int *factor_xs, const int *factor_ys,
+                      const double *strengths, int num_factors, const int *xs,
+                      const int *ys, int num_locations, const double *table,
+                      int table_size, double *weights) {
+  AccumulateTail(factor_xs, factor_ys, strengths, num_factors, xs, ys, 0,
+                 num_locations, table, table_size, weights);
+}
+
+#ifdef ECOSYSTEM_X86_KERNELS
+
+__attribute__((target("avx2,fma")))
+void AccumulateAvx2(const int *factor_xs, const int *factor_ys,
+                    const double *strengths, int num_factors, const int *xs,
+                    const int *ys, int num_locations, const double *table,
+                    int table_size, double *weights) {
+  const __m128i last_entry = _mm_set1_epi32(table_size - 1);
+
+  const int vector_end = num_locations - num_locations % 4;
+  for (int i = 0; i < vector_end; i += 4) {
+    const __m128i x =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(xs + i));
+    const __m128i y =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(ys + i));
+    __m256d total = _mm256_loadu_pd(weights + i);
+
+    for (int f = 0; f < num_factors; ++f) {
+      const __m128i dx = _mm_sub_epi32(x, _mm_set1_epi32(factor_xs[f]));
+      const __m128i dy = _mm_sub_epi32(y, _mm_set1_epi32(factor_ys[f]));
+      __m128i d2 = _mm_add_epi32(_mm_mullo_epi32(dx, dx),
+                                 _mm_mullo_epi32(dy, dy));
+      d2 = _mm_min_epi32(d2, last_entry);
+
+      // The masked gathers start from a defined value, which keeps GCC from
+      // warning about the undefined one that the plain gathers use.
+      const __m256d weight = _mm256_mask_i32gather_pd(
+          _mm256_setzero_pd(), table, d2,
+          _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8);
+      total = _mm256_fmadd_pd(_mm256_set1_pd(strengths[f]), weight, total);
+    }
+
+    _mm256_storeu_pd(weights + i, total);
+  }
+
+  AccumulateTail(factor_xs, factor_ys, strengths, num_factors, xs, ys,
+                 vector_end, num_locations, table, table_size, weights);
+}
+
+__attribute__((target("avx512f")))
+void AccumulateAvx512(const int *factor_xs, const int *factor_ys,
+                      const double *strengths, int num_factors, const int *xs,
+                      const int *ys, int num_locations, const double *table,
+                      int table_size, double *weights) {
+  const __m256i last_entry = _mm256_set1_epi32(table_size - 1);
+
+  const int vector_end = num_locations - num_locations % 8;
+  for (int i = 0; i < vector_end; i += 8) {
+    const __m256i x =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(xs + i));
+    const __m256i y =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ys + i));
+    __m512d total = _mm512_loadu_pd(weights + i);
+
+    for (int f = 0; f < num_factors; ++f) {
+      const __m256i dx = _mm256_sub_epi32(x, _mm256_set1_epi32(factor_xs[f]));
+      const __m256i dy = _mm256_sub_epi32(y, _mm256_set1_epi32(factor_ys[f]));
+      __m256i d2 = _mm256_add_epi32(_mm256_mullo_epi32(dx, dx),
+                                    _mm256_mullo_epi32(dy, dy));
+      d2 = _mm256_min_epi32(d2, last_entry);
+
+      const __m512d weight =
+          _mm512_mask_i32gather_pd(_mm512_setzero_pd(), 0xFF, d2, table, 8);
+      total = _mm512_fmadd_pd(_mm512_set1_pd(strengths[f]), weight, total);
+    }
+
+    _mm512_storeu_pd(weights + i, total);
+  }
+
+  AccumulateTail(factor_xs, factor_ys, strengths, num_factors, xs, ys,
+                 vector_end, num_locations, table, table_size, weights);
+}
+
+bool HasAvx2() {
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+bool HasAvx512() {
+  return __builtin_cpu_supports("avx512f");
+}
+
+#else
+
+// We're not on x86, so the vectorized versions just fall back on the scalar
+// one. Nobody should be calling them anyway.
+void AccumulateAvx2(const int *factor_xs, const int *factor_ys,
+                    const double *strengths, int num_factors, const int *xs,
+                    const int *ys, int num_locations, const double *table,
+                    int table_size, double *weights) {
+  AccumulateScalar(factor_xs, factor_ys, strengths, num_factors, xs, ys,
+                   num_locations, table, table_size, weights);
+}
+
+void AccumulateAvx512(const int *factor_xs, const int *factor_ys,
+                      const double *strengths, int num_factors, const int *xs,
+                      const int *ys, int num_locations, const double *table,
+                      int table_size, double *weights) {
+  AccumulateScalar(factor_xs, factor_ys, strengths, num_factors, xs, ys,
+                   num_locations, table, table_size, weights);
+}
+
+bool HasAvx2() { return false; }
+
+bool HasAvx512() { return false; }
+
+#endif
+
+}  // namespace factor_kernel
+
+FactorKernel GetFactorKernel() {
+  // Function-local statics are initialized exactly once, even if there are
+  // multiple threads.
+  static const FactorKernel kernel = []() -> FactorKernel {
+    if (factor_kernel::HasAvx512()) {
+      return factor_kernel::AccumulateAvx512;
+    }
+    if (factor_kernel::HasAvx2()) {
+      return factor_kernel::AccumulateAvx2;
+    }
+    return factor_kernel::AccumulateScalar;
+  }();
+
+  return kernel;
+}
+
+}  // namespace automata
@@ -0,0 +1,68 @@
+#ifndef ECOSYSTEM_AUTOMATA_FACTOR_KERNEL_H_
+#define ECOSYSTEM_AUTOMATA_FACTOR_KERNEL_H_
+
+// Defines the inner loop for calculating how much a set of movement factors
+// influences each location in a neighborhood. Everything here works on flat
+// arrays so that it can be vectorized. There are several implementations, and
+// the fastest one that the CPU we are running on supports gets picked at
+// runtime.
+
+namespace automata {
+
+// Signature shared by every implementation of the factor kernel. For each
+// location, it adds the weighted contribution of every factor. A factor
+// contributes its strength times the entry in the weight table for its squared
+// distance from the location. (See DistanceTable.)
+// factor_xs: The x coordinates of the factors.
+// factor_ys: The y coordinates of the factors.
+// strengths: The strengths of the factors.
+// num_factors: The number of factors in the above arrays.
+// xs: The x coordinates of the locations.
+// ys: The y coordinates of the locations.
+// num_locations: The number of locations in the above arrays.
+// table: Weights indexed by squared distance. Distances past the end of the
+// table use the last entry.
+// table_size: The number of entries in table.
+// weights: Array of size num_locations that the contributions get added to.
+typedef void (*FactorKernel)(const int *factor_xs, const int *factor_ys,
+                             const double *strengths, int num_factors,
+                             const int *xs, const int *ys, int num_locations,
+                             const double *table, int table_size,
+                             double *weights);
+
+namespace factor_kernel {
+
+// Plain C++ implementation that runs anywhere.
+void AccumulateScalar(const int *factor_xs, const int *factor_ys,
+                      const double *strengths, int num_factors, const int *xs,
+                      const int *ys, int num_locations, const double *table,
+                      int table_size, double *weights);
+// Implementation that does four locations at a time with AVX2. Only call this
+// if HasAvx2() returns true.
+void AccumulateAvx2(const int *factor_xs, const int *factor_ys,
+                    const double *strengths, int num_factors, const int *xs,
+                    const int *ys, int num_locations, const double *table,
+                    int table_size, double *weights);
+// Implementation that does eight locations at a time with AVX-512. Only call
+// this if HasAvx512() returns true.
+void AccumulateAvx512(const int *factor_xs, const int *factor_ys,
+                      const double *strengths, int num_factors, const int *xs,
+                      const int *ys, int num_locations, const double *table,
+                      int table_size, double *weights);
+
+// Returns: Whether this build and the CPU we are running on support the AVX2
+// implementation.
+bool HasAvx2();
+// Returns: Whether this build and the CPU we are running on support the
+// AVX-512 implementation.
+bool HasAvx512();
+
+}  // namespace factor_kernel
+
+// Returns: The fastest factor kernel implementation that can run on this CPU.
+// It gets picked the first time this is called.
+FactorKernel GetFactorKernel();
+
+}  // namespace automata
+
+#endif
@@ -0,0 +1,178 @@
+#include <assert.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "automata/factor_set.h"
+#include "automata/grid.h"
+#include "automata/grid_object.h"
+
+namespace automata {
+
+void FactorSet::Add(int x, int y, int strength, int visibility) {
+  xs_.push_back(x);
+  ys_.push_back(y);
+  strengths_.push_back(strength);
+  visibilities_.push_back(visibility);
+  sources_.push_back(nullptr);
+  handles_.push_back(kNoHandle);
+}
+
+void FactorSet::AddFromSource(GridObject *source, int strength,
+                              int visibility) {
+  xs_.push_back(0);
+  ys_.push_back(0);
+  strengths_.push_back(strength);
+  visibilities_.push_back(visibility);
+  sources_.push_back(source);
+  handles_.push_back(source->handle());
+  assert((!positions_ ||
+          positions_ == &source->get_grid()->baked_positions()) &&
+         "Factors have to follow objects on the same grid.");
+  positions_ = &source->get_grid()->baked_positions();
+}
+
+int FactorSet::RemoveSource(const GridObject *source) {
+  int removed = 0;
+  int i = 0;
+  while (i < size()) {
+    if (sources_[i] != source) {
+      ++i;
+      continue;
+    }
+
+    // Move the last one into this slot, and look at this slot again.
+    const int last = size() - 1;
+    xs_[i] = xs_[last];
+    ys_[i] = ys_[last];
+    strengths_[i] = strengths_[last];
+    visibilities_[i] = visibilities_[last];
+    sources_[i] = sources_[last];
+    handles_[i] = handles_[last];
+    xs_.pop_back();
+    ys_.pop_back();
+    strengths_.pop_back();
+    visibilities_.pop_back();
+    sources_.pop_back();
+    handles_.pop_back();
+    ++removed;
+  }
+
+  return removed;
+}
+
+void FactorSet::Clear() {
+  xs_.clear();
+  ys_.clear();
+  strengths_.clear();
+  visibilities_.clear();
+  sources_.clear();
+  handles_.clear();
+}
+
+void FactorSet::Select(const FactorSet &other,
+                       const ::std::vector<int> &indices) {
+  assert(&other != this && "Can't select from ourselves.");
+
+  // Clearing keeps the capacity, so this doesn't allocate once the set has
+  // been used a few times.
+  Clear();
+  positions_ = other.positions_;
+  for (int index : indices) {
+    xs_.push_back(other.xs_[index]);
+    ys_.push_back(other.ys_[index]);
+    strengths_.push_back(other.strengths_[index]);
+    visibilities_.push_back(other.visibilities_[index]);
+    sources_.push_back(other.sources_[index]);
+    handles_.push_back(other.handles_[index]);
+  }
+}
+
+void FactorSet::GetPosition(int index, int *x, int *y) const {
+  if (handles_[index] != kNoHandle) {
+    positions_->Get(handles_[index], x, y);
+    return;
+  }
+
+  *x = xs_[index];
+  *y = ys_[index];
+}
+
+bool FactorSet::SetPosition(int index, int x, int y) {
+  if (handles_[index] != kNoHandle) {
+    return false;
+  }
+  xs_[index] = x;
+  ys_[index] = y;
+  return true;
+}
+
+void FactorSet::FindVisible(int x, int y, int vision, int skin,
+                            ::std::vector<int> *indices) const {
+  indices->clear();
+
+  const int num_factors = size();
+  for (int i = 0; i < num_factors; ++i) {
+    // Everything here is done with squared distances, so it's all integer
+    // math.
+    int factor_x, factor_y;
+    GetPosition(i, &factor_x, &factor_y);
+    if (handles_[i] != kNoHandle && factor_x < 0) {
+      // The object it follows isn't on the grid anymore, or doesn't even
+      // exist, so there's nothing to see.
+      continue;
+    }
+    const int dx = factor_x - x;
+    const int dy = factor_y - y;
+    const int distance_squared = dx * dx + dy * dy;
+
+    const int visibility = visibilities_[i];
+    if (visibility > 0 &&
+        distance_squared > (visibility + skin) * (visibility + skin)) {
+      continue;
+    }
+    if (vision > 0 && distance_squared > (vision + skin) * (vision + skin)) {
+      continue;
+    }
+    indices->push_back(i);
+  }
+}
+
+int FactorSet::Gather(const ::std::vector<int> &indices,
+                      ::std::vector<int> *xs, ::std::vector<int> *ys,
+                      ::std::vector<double> *strengths) const {
+  xs->resize(indices.size());
+  ys->resize(indices.size());
+  strengths->resize(indices.size());
+
+  int total_strength = 0;
+  for (uint32_t i = 0; i < indices.size(); ++i) {
+    const int index = indices[i];
+    GetPosition(index, &(*xs)[i], &(*ys)[i]);
+    (*strengths)[i] = strengths_[index];
+    // There is an edge case where all our factors could have a strength of
+    // zero.
+    total_strength += strengths_[index];
+  }
+
+  return total_strength;
+}
+
+int FactorSet::Gather(::std::vector<int> *xs, ::std::vector<int> *ys,
+                      ::std::vector<double> *strengths) const {
+  const int num_factors = size();
+  xs->resize(num_factors);
+  ys->resize(num_factors);
+  strengths->resize(num_factors);
+
+  int total_strength = 0;
+  for (int i = 0; i < num_factors; ++i) {
+    GetPosition(i, &(*xs)[i], &(*ys)[i]);
+    (*strengths)[i] = strengths_[i];
+    total_strength += strengths_[i];
+  }
+
+  return total_strength;
+}
+
+}  //  automata
@@ -0,0 +1,132 @@
+#ifndef ECOSYSTEM_AUTOMATA_FACTOR_SET_H_
+#define ECOSYSTEM_AUTOMATA_FACTOR_SET_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+namespace automata {
+
+// Forward declarations to break cyclic dependency.
+class GridObject;
+struct BakedPositions;
+
+// A set of movement factors, which are things that change the likelihood that
+// an organism will move to a specific location in its neighborhood. Each
+// attribute of the factors is stored in its own contiguous array, so that
+// whatever is processing them can stream through just the parts it needs.
+// Factors are referred to by their index in the set. Removing factors can
+// change the indices of the ones that are left.
+class FactorSet {
+ public:
+  FactorSet() = default;
+  FactorSet(const FactorSet &other) = default;
+  FactorSet &operator=(const FactorSet &other) = default;
+
+  // Adds a factor at a fixed location.
+  // x: The x coordinate of the factor.
+  // y: The y coordinate of the factor.
+  // strength: The factor's strength. Positive means attractive, negative means
+  // repulsive.
+  // visibility: How far away the factor can be perceived from, in cells. A
+  // negative value means there is no limit.
+  void Add(int x, int y, int strength, int visibility);
+  // Adds a factor that follows an object around the grid.
+  // source: The object. The factor is wherever it is baked, which gets read
+  // from the grid's baked positions, so every object that factors in a set
+  // follow has to be on the same grid.
+  // strength: The factor's strength.
+  // visibility: How far away the factor can be perceived from.
+  void AddFromSource(GridObject *source, int strength, int visibility);
+  // Removes every factor that follows a particular object. Removed factors get
+  // replaced by the last one in the set, so the order of the others changes.
+  // source: The object.
+  // Returns: How many factors were removed.
+  int RemoveSource(const GridObject *source);
+  // Removes every factor.
+  void Clear();
+  // Replaces the contents of this set with some of the factors from another
+  // one.
+  // other: The set to copy from. It can't be this one.
+  // indices: The indices in other of the factors to copy, in the order we want
+  // them.
+  void Select(const FactorSet &other, const ::std::vector<int> &indices);
+
+  // Returns: How many factors there are.
+  int size() const { return strengths_.size(); }
+  // Returns: true if there are no factors.
+  bool empty() const { return strengths_.empty(); }
+
+  // Gets the position of a factor. If it follows an object, this is where the
+  // object was baked at the last grid update, so that new changes to the grid
+  // don't influence the moves that follow them. If the object has since been
+  // removed from the grid or destroyed, this is (-1, -1).
+  // index: The index of the factor.
+  // x: Set to the x coordinate.
+  // y: Set to the y coordinate.
+  void GetPosition(int index, int *x, int *y) const;
+  // Moves a factor.
+  // index: The index of the factor.
+  // x: The new x coordinate.
+  // y: The new y coordinate.
+  // Returns: false if the factor follows an object, in which case it can't be
+  // moved.
+  bool SetPosition(int index, int x, int y);
+  int strength(int index) const { return strengths_[index]; }
+  void set_strength(int index, int strength) { strengths_[index] = strength; }
+  int visibility(int index) const { return visibilities_[index]; }
+  void set_visibility(int index, int visibility) {
+    visibilities_[index] = visibility;
+  }
+  // Returns: The object that a factor follows, or nullptr if it doesn't follow
+  // one. This is only safe to use if the object is known to still exist.
+  GridObject *source(int index) const { return sources_[index]; }
+  // Returns: A handle to the object that a factor follows, or kNoHandle if it
+  // doesn't follow one. Unlike source(), this can be checked for staleness.
+  uint32_t handle(int index) const { return handles_[index]; }
+
+  // Finds every factor that is visible from a location. Factors that follow
+  // objects that aren't baked anywhere are never visible.
+  // x: The x coordinate of the location.
+  // y: The y coordinate of the location.
+  // vision: Maximum distance in cells that the location can be from a factor,
+  // and still perceive it. A negative value means that there is no limit.
+  // skin: Extra distance in cells that gets added to both the vision and the
+  // factor visibilities. This is useful for finding factors that might become
+  // visible soon.
+  // indices: Gets filled with the indices of the visible factors, in order.
+  void FindVisible(int x, int y, int vision, int skin,
+                   ::std::vector<int> *indices) const;
+  // Lays some of the factors out in flat arrays for the movement kernels.
+  // indices: The indices of the factors.
+  // xs: Gets filled with the x coordinates of the factors.
+  // ys: Gets filled with the y coordinates of the factors.
+  // strengths: Gets filled with the strengths of the factors.
+  // Returns: The total strength of the factors.
+  int Gather(const ::std::vector<int> &indices, ::std::vector<int> *xs,
+             ::std::vector<int> *ys, ::std::vector<double> *strengths) const;
+  // Lays all of the factors out in flat arrays.
+  // See the other version for the arguments.
+  int Gather(::std::vector<int> *xs, ::std::vector<int> *ys,
+             ::std::vector<double> *strengths) const;
+
+ private:
+  // The positions of the factors. These are only meaningful for factors that
+  // don't follow an object.
+  ::std::vector<int> xs_;
+  ::std::vector<int> ys_;
+  // The strengths of the factors.
+  ::std::vector<int> strengths_;
+  // How far away each factor can be perceived from.
+  ::std::vector<int> visibilities_;
+  // The objects that the factors follow, or nullptr for ones that stay put.
+  ::std::vector<GridObject *> sources_;
+  // Handles to those objects, or kNoHandle for factors that stay put.
+  ::std::vector<uint32_t> handles_;
+  // The baked positions of the grid that the objects are on.
+  const BakedPositions *positions_ = nullptr;
+};
+
+}  //  automata
+
+#endif
@@ -1,24 +1,264 @@
 #include <assert.h>
 #include <math.h>
 #include <stdint.h>
-#include <stdio.h>  // TEMP
 #include <stdlib.h>
-#include <time.h>
 
 #include <algorithm>
+#include <iterator>
+#include <utility>
+#include <vector>
 
 #include "automata/grid.h"
+#include "automata/sampler.h"
 // We need the complete version of GridObject in this file, but we must use the
 // forward-declared incomplete version in the header because including it there
 // would cause a circular dependency issue.
 #include "automata/grid_object.h"
 
 namespace automata {
+namespace {
 
-Grid::Grid(int x_size, int y_size)
-    : x_size_(x_size), y_size_(y_size), grid_(new Cell[x_size * y_size]) {
-  srand(time(NULL));
+// How many factors get processed together in EvaluateMoves(). A tile this size
+// fits comfortably in L1 cache.
+constexpr int kFactorBlock = 256;
+// The most locations that each thread processes at a time in EvaluateMoves().
+constexpr int kLocationBlock = 1024;
+// The size of one side of the square tiles that the species index buckets
+// things by.
+constexpr int kIndexTile = 8;
+
+typedef MoveRequest::SortableFactor SortableFactor;
+
+// Space that AccumulateBlock() can reuse from one block to the next, so that
+// a thread doesn't have to allocate anything once it has warmed up.
+struct BlockScratch {
+  // The factors that everyone in the block sees, and somewhere to build the
+  // next version of that list.
+  ::std::vector<SortableFactor> shared;
+  ::std::vector<SortableFactor> kept;
+  // The locations in the block laid out end to end, and their weights.
+  ::std::vector<int> xs;
+  ::std::vector<int> ys;
+  ::std::vector<double> weights;
+  // Factors laid out the way AccumulateTiled() wants them.
+  ::std::vector<int> factor_xs;
+  ::std::vector<int> factor_ys;
+  ::std::vector<double> strengths;
+};
+
+// Sorts the factors that a request sees, if that hasn't happened already.
+// request: The request. Its factors must already be gathered.
+// Returns: The sorted factors.
+const ::std::vector<SortableFactor> &SortFactors(MoveRequest *request) {
+  ::std::vector<SortableFactor> &factors = request->sorted_factors;
+  if (factors.size() != request->factor_xs.size()) {
+    factors.clear();
+    for (uint32_t f = 0; f < request->factor_xs.size(); ++f) {
+      factors.push_back({request->factor_xs[f], request->factor_ys[f],
+                         request->strengths[f]});
+    }
+    ::std::sort(factors.begin(), factors.end());
+  }
+  return factors;
+}
+
+// Adds the contribution of some factors to a run of locations, a tile of
+// factors at a time, so that each tile stays in cache while all of the
+// locations stream past it.
+// kernel: The kernel to use.
+// factor_xs: The x coordinates of the factors.
+// factor_ys: The y coordinates of the factors.
+// strengths: The strengths of the factors.
+// num_factors: How many factors there are.
+// xs: The x coordinates of the locations.
+// ys: The y coordinates of the locations.
+// num_locations: How many locations there are.
+// weights: The weights to add to.
+template <class Kernel>
+void AccumulateTiled(const Kernel &kernel, const int *factor_xs,
+                     const int *factor_ys, const double *strengths,
+                     int num_factors, const int *xs, const int *ys,
+                     int num_locations, double *weights) {
+  for (int f = 0; f < num_factors; f += kFactorBlock) {
+    movement_kernel::Accumulate(kernel, factor_xs + f, factor_ys + f,
+                                strengths + f,
+                                ::std::min(kFactorBlock, num_factors - f), xs,
+                                ys, num_locations, weights);
+  }
+}
+
+// The same as the other version, but for sortable factors.
+// factors: The factors.
+// scratch: Where to lay the factors out.
+// See the other version for the rest of the arguments.
+template <class Kernel>
+void AccumulateTiled(const Kernel &kernel,
+                     const ::std::vector<SortableFactor> &factors,
+                     BlockScratch *scratch, const int *xs, const int *ys,
+                     int num_locations, double *weights) {
+  scratch->factor_xs.clear();
+  scratch->factor_ys.clear();
+  scratch->strengths.clear();
+  for (const SortableFactor &factor : factors) {
+    scratch->factor_xs.push_back(factor.x);
+    scratch->factor_ys.push_back(factor.y);
+    scratch->strengths.push_back(factor.strength);
+  }
+  AccumulateTiled(kernel, scratch->factor_xs.data(),
+                  scratch->factor_ys.data(), scratch->strengths.data(),
+                  factors.size(), xs, ys, num_locations, weights);
+}
+
+// Accumulates the weights for a block of requests that are close together on
+// the grid, and in the same group, so that they mostly see the same factors.
+// Factors that every request in the block can see get laid out once, and
+// evaluated against every location in the block together. Only the rest get
+// evaluated separately for each request.
+// kernel: The kernel to use.
+// requests: The requests in the block. Their factors must already be
+// gathered, and their weights zeroed.
+// num_requests: How many requests there are.
+// scratch: Space to work in.
+template <class Kernel>
+void AccumulateBlock(const Kernel &kernel, MoveRequest *const *requests,
+                     int num_requests, BlockScratch *scratch) {
+  // Find the factors that everyone sees. Copies of the same factor count
+  // separately, so if everyone sees two of them, both get shared.
+  ::std::vector<SortableFactor> &shared = scratch->shared;
+  ::std::vector<SortableFactor> &kept = scratch->kept;
+  shared.clear();
+  if (num_requests > 1) {
+    const ::std::vector<SortableFactor> &first = SortFactors(requests[0]);
+    shared.assign(first.begin(), first.end());
+  }
+  for (int r = 1; r < num_requests && !shared.empty(); ++r) {
+    const ::std::vector<SortableFactor> &sorted = SortFactors(requests[r]);
+    kept.clear();
+    ::std::set_intersection(shared.begin(), shared.end(), sorted.begin(),
+                            sorted.end(), ::std::back_inserter(kept));
+    shared.swap(kept);
+  }
+
+  if (shared.empty()) {
+    // There's nothing to share, so everyone might as well use what they
+    // already have.
+    for (int r = 0; r < num_requests; ++r) {
+      MoveRequest *request = requests[r];
+      AccumulateTiled(kernel, request->factor_xs.data(),
+                      request->factor_ys.data(), request->strengths.data(),
+                      request->factor_xs.size(), request->xs.data(),
+                      request->ys.data(), request->xs.size(),
+                      request->weights.data());
+    }
+    return;
+  }
+
+  // Lay all the locations in the block out end to end, and do the shared
+  // factors for all of them at once.
+  ::std::vector<int> &xs = scratch->xs;
+  ::std::vector<int> &ys = scratch->ys;
+  xs.clear();
+  ys.clear();
+  for (int r = 0; r < num_requests; ++r) {
+    xs.insert(xs.end(), requests[r]->xs.begin(), requests[r]->xs.end());
+    ys.insert(ys.end(), requests[r]->ys.begin(), requests[r]->ys.end());
+  }
+  ::std::vector<double> &weights = scratch->weights;
+  weights.assign(xs.size(), 0);
+  AccumulateTiled(kernel, shared, scratch, xs.data(), ys.data(), xs.size(),
+                  weights.data());
+
+  // Add everything else, and hand the weights back out. Everyone got sorted
+  // while we were finding the shared factors, since none of them ran out.
+  int offset = 0;
+  for (int r = 0; r < num_requests; ++r) {
+    MoveRequest *request = requests[r];
+    const int size = request->xs.size();
+    const ::std::vector<SortableFactor> &sorted = request->sorted_factors;
+    kept.clear();
+    ::std::set_difference(sorted.begin(), sorted.end(), shared.begin(),
+                          shared.end(), ::std::back_inserter(kept));
+    AccumulateTiled(kernel, kept, scratch, xs.data() + offset,
+                    ys.data() + offset, size, weights.data() + offset);
+    ::std::copy(weights.begin() + offset, weights.begin() + offset + size,
+                request->weights.begin());
+    offset += size;
+  }
+}
+
+// Accumulates the weights for a batch of requests that all use the same
+// kernel. Blocks get split between threads.
+// kernel: The kernel to use.
+// requests: The requests, sorted so that ones that are close together on the
+// grid are next to each other.
+// block_starts: The index in requests of the first request in each block,
+// followed by the number of requests.
+template <class Kernel>
+void AccumulateBlocks(const Kernel &kernel,
+                      const ::std::vector<MoveRequest *> &requests,
+                      const ::std::vector<int> &block_starts) {
+  const int num_blocks = block_starts.size() - 1;
+
+#pragma omp parallel if (num_blocks > 1)
+  {
+    // Each thread gets its own scratch space, which all of its blocks share.
+    BlockScratch scratch;
+#pragma omp for schedule(dynamic)
+    for (int block = 0; block < num_blocks; ++block) {
+      AccumulateBlock(kernel, requests.data() + block_starts[block],
+                      block_starts[block + 1] - block_starts[block], &scratch);
+    }
+  }
+}
+
+// Checks whether an object is trying to stay where it already is.
+// object: The object to check.
+// Returns: true if it is.
+bool IsStaying(GridObject *object) {
+  int x, y, baked_x, baked_y;
+  object->get_position(&x, &y);
+  return object->GetBakedPosition(&baked_x, &baked_y) && baked_x == x &&
+         baked_y == y;
+}
 
+// Moves an object to a specific cell.
+// object: The object to move.
+// x: The x coordinate of the cell.
+// y: The y coordinate of the cell.
+// Returns: true if the object ended up there, even if it is conflicted there.
+bool MoveTo(GridObject *object, int x, int y) {
+  object->SetPosition(x, y);
+  int new_x, new_y;
+  object->get_position(&new_x, &new_y);
+  return new_x == x && new_y == y;
+}
+
+// Flips the same coin that Organism::DefaultConflictHandler() does to decide
+// which of two conflicted objects has to move.
+// seed: The seed for the simulation.
+// tick: The current tick.
+// object1: The first object.
+// object2: The second object.
+// Returns: The object that loses.
+GridObject *PickLoser(uint64_t seed, uint32_t tick, GridObject *object1,
+                      GridObject *object2) {
+  GridObject *low = object1;
+  GridObject *high = object2;
+  if (high->get_index() < low->get_index()) {
+    ::std::swap(low, high);
+  }
+  Random random(seed, tick, low->get_index(), Random::kConflict,
+                high->get_index());
+  return (random.Next() & 1) ? low : high;
+}
+
+}  // namespace
+
+Grid::Grid(int x_size, int y_size)
+    : x_size_(x_size),
+      y_size_(y_size),
+      grid_(new Cell[x_size * y_size]),
+      weight_table_(DistanceTable::InverseFifthPower) {
   assert(grid_ && "Failed to allocate grid array!\n");
 
   // Set everything to a default initialization.
@@ -28,6 +268,7 @@ Grid::Grid(int x_size, int y_size)
     grid_[i].ConflictedObject = nullptr;
     grid_[i].Blacklisted = false;
     grid_[i].RequestStasis = false;
+    grid_[i].Contenders = -1;
   }
 }
 
@@ -37,7 +278,15 @@ Grid::~Grid() {
   // on that grid, leading to odd segfaults when it goes to destroy the
   // dependents, and those dependents try to remove themselves from the
   // destroyed grid in their destructors.
+  ::std::vector<GridObject *> contenders;
   for (int i = 0; i < x_size_ * y_size_; ++i) {
+    if (grid_[i].Contenders >= 0) {
+      // Get rid of the extra contenders while the cell still knows about them.
+      GetContenders(grid_[i], &contenders);
+      for (GridObject *contender : contenders) {
+        contender->RemoveFromGrid();
+      }
+    }
     if (grid_[i].Object) {
       // Technically, RemoveFromGrid() can return false, but there's not much we
       // can do about it if it does.
@@ -50,6 +299,12 @@ Grid::~Grid() {
       grid_[i].ConflictedObject->RemoveFromGrid();
     }
   }
+  // Make sure that nothing tries to give its slot back once we're gone.
+  for (GridObject *object : slot_objects_) {
+    if (object) {
+      object->grid_ = nullptr;
+    }
+  }
 
   delete[] grid_;
 }
@@ -86,7 +341,18 @@ bool Grid::SetOccupant(int x, int y, GridObject *occupant) {
       return true;
     }
 
-    cell->ConflictedObject = occupant;
+    if (!cell->ConflictedObject) {
+      cell->ConflictedObject = occupant;
+    } else if (!IsContending(*cell, occupant)) {
+      // There's already a conflict here, so this one goes at the end of the
+      // list.
+      int *link = &cell->Contenders;
+      while (*link >= 0) {
+        link = &contenders_[*link].Next;
+      }
+      *link = contenders_.size();
+      contenders_.push_back({occupant, -1});
+    }
     return false;
   }
 
@@ -105,7 +371,7 @@ bool Grid::PurgeNew(int x, int y, const GridObject *object) {
       }
 
       cell->NewObject = cell->ConflictedObject;
-      cell->ConflictedObject = nullptr;
+      cell->ConflictedObject = PopContender(cell);
     } else {
       cell->NewObject = cell->Object;
     }
@@ -116,10 +382,18 @@ bool Grid::PurgeNew(int x, int y, const GridObject *object) {
     }
   } else if (object == cell->ConflictedObject) {
     // Remove conflicted object.
-    cell->ConflictedObject = nullptr;
+    cell->ConflictedObject = PopContender(cell);
   } else {
-    // Could not find object.
-    return false;
+    // It might be one of the extra contenders.
+    int *link = &cell->Contenders;
+    while (*link >= 0 && contenders_[*link].Object != object) {
+      link = &contenders_[*link].Next;
+    }
+    if (*link < 0) {
+      // Could not find object.
+      return false;
+    }
+    *link = contenders_[*link].Next;
   }
 
   return true;
@@ -135,8 +409,8 @@ GridObject *Grid::GetPending(int x, int y) {
   return cell->NewObject;
 }
 
-bool Grid::GetNeighborhoodLocations(int x, int y, ::std::list<int> *xs,
-                                    ::std::list<int> *ys,
+bool Grid::GetNeighborhoodLocations(int x, int y, ::std::vector<int> *xs,
+                                    ::std::vector<int> *ys,
                                     int levels /* = 1*/) {
   if (x < 0 || y < 0 || x >= x_size_ || y >= y_size_) {
     // The starting point isn't within the bounds of the grid.
@@ -195,7 +469,7 @@ bool Grid::GetNeighborhood(
     int levels /*= 1*/, bool get_new /*= false*/) {
   objects->clear();
 
-  ::std::list<int> xs, ys;
+  ::std::vector<int> xs, ys;
   if (!GetNeighborhoodLocations(x, y, &xs, &ys, levels)) {
     return false;
   }
@@ -204,17 +478,14 @@ bool Grid::GetNeighborhood(
   // by level.
   uint32_t in_level = 8;
   uint32_t current_i = 0;
-  auto x_itr = xs.begin();
-  auto y_itr = ys.begin();
-  while (x_itr != xs.end()) {
+  while (current_i < xs.size()) {
     ::std::vector<GridObject *> level_objects;
-    for (; current_i < in_level && x_itr != xs.end();
-         ++x_itr, ++y_itr, ++current_i) {
+    for (; current_i < in_level && current_i < xs.size(); ++current_i) {
       GridObject *occupant;
       if (get_new) {
-        occupant = GetPending(*x_itr, *y_itr);
+        occupant = GetPending(xs[current_i], ys[current_i]);
       } else {
-        occupant = GetOccupant(*x_itr, *y_itr);
+        occupant = GetOccupant(xs[current_i], ys[current_i]);
       }
       if (occupant) {
         level_objects.push_back(occupant);
@@ -231,43 +502,576 @@ bool Grid::GetNeighborhood(
 }
 
 bool Grid::MoveObject(int x, int y,
-                      const ::std::list<MovementFactor> &factors, int *new_x,
-                      int *new_y, int levels /* = 1*/, int vision /* = -1*/) {
-  ::std::list<MovementFactor> visible_factors = factors;
-  RemoveInvisible(x, y, &visible_factors, vision);
+                      const FactorSet &factors,
+                      Random *random, int *new_x, int *new_y,
+                      int levels /* = 1*/, int vision /* = -1*/,
+                      const KernelSpec &kernel /* = KernelSpec()*/,
+                      MovementCache *cache /* = nullptr*/,
+                      const GridObject *mover /* = nullptr*/,
+                      const ExclusionMask *exclude /* = nullptr*/) {
+  switch (kernel.type) {
+    case KernelSpec::kInversePower:
+    case KernelSpec::kExponential:
+      return MoveObjectWith(
+          GetTableKernel(kernel, GetReachSquared(levels, vision)), x, y,
+          factors, random, new_x, new_y, levels, vision, kernel, cache, mover,
+          exclude);
+    case KernelSpec::kCutoff:
+      return MoveObjectWith(movement_kernel::CutoffKernel(kernel.scale), x, y,
+                            factors, random, new_x, new_y, levels, vision,
+                            kernel, cache, mover, exclude);
+    case KernelSpec::kLinear:
+      return MoveObjectWith(movement_kernel::LinearKernel(kernel.scale), x, y,
+                            factors, random, new_x, new_y, levels, vision,
+                            kernel, cache, mover, exclude);
+  }
 
-  ::std::list<int> xs, ys;
-  if (!GetNeighborhoodLocations(x, y, &xs, &ys, levels)) {
+  assert(false && "Unknown kernel type.");
+  return false;
+}
+
+bool Grid::MoveObjectSampled(int x, int y,
+                             const FactorSet &factors,
+                             Random *random, int *new_x, int *new_y,
+                             int levels, int vision, int samples,
+                             const KernelSpec &kernel /* = KernelSpec()*/,
+                             const GridObject *mover /* = nullptr*/,
+                             const ExclusionMask *exclude /* = nullptr*/) {
+  switch (kernel.type) {
+    case KernelSpec::kInversePower:
+    case KernelSpec::kExponential:
+      return MoveObjectSampledWith(
+          GetTableKernel(kernel, GetReachSquared(levels, vision)), x, y,
+          factors, random, new_x, new_y, levels, vision, samples, mover,
+          exclude);
+    case KernelSpec::kCutoff:
+      return MoveObjectSampledWith(
+          movement_kernel::CutoffKernel(kernel.scale), x, y, factors, random,
+          new_x, new_y, levels, vision, samples, mover, exclude);
+    case KernelSpec::kLinear:
+      return MoveObjectSampledWith(
+          movement_kernel::LinearKernel(kernel.scale), x, y, factors, random,
+          new_x, new_y, levels, vision, samples, mover, exclude);
+  }
+
+  assert(false && "Unknown kernel type.");
+  return false;
+}
+
+DistanceTable *Grid::GetExponentialTable(double scale) {
+  ++exponential_table_uses_;
+  auto found = exponential_tables_.find(scale);
+  if (found != exponential_tables_.end()) {
+    found->second.last_use = exponential_table_uses_;
+    return found->second.table.get();
+  }
+
+  if (exponential_tables_.size() >= kMaxExponentialTables) {
+    // Make room by getting rid of the one that hasn't been used for longest.
+    auto oldest = exponential_tables_.begin();
+    for (auto i = exponential_tables_.begin(); i != exponential_tables_.end();
+         ++i) {
+      if (i->second.last_use < oldest->second.last_use) {
+        oldest = i;
+      }
+    }
+    exponential_tables_.erase(oldest);
+  }
+  ExponentialTable &table = exponential_tables_[scale];
+  table.table.reset(new DistanceTable(DistanceTable::Exponential(scale)));
+  table.last_use = exponential_table_uses_;
+  return table.table.get();
+}
+
+movement_kernel::TableKernel Grid::GetTableKernel(const KernelSpec &kernel,
+                                                  int64_t distance_squared) {
+  DistanceTable *table = kernel.type == KernelSpec::kExponential
+                             ? GetExponentialTable(kernel.scale)
+                             : &weight_table_;
+  table->Cover(distance_squared);
+  return movement_kernel::TableKernel(table);
+}
+
+int64_t Grid::GetReachSquared(int levels, int vision) const {
+  // The farthest apart two cells can be is opposite corners.
+  const int64_t diagonal_squared =
+      static_cast<int64_t>(x_size_ - 1) * (x_size_ - 1) +
+      static_cast<int64_t>(y_size_ - 1) * (y_size_ - 1);
+  if (vision < 0) {
+    return diagonal_squared;
+  }
+  // Factors are within our vision of where we are now, and the corners of the
+  // neighborhood are the farthest that we can get from there.
+  const double reach = vision + levels * M_SQRT2;
+  return ::std::min(diagonal_squared,
+                    static_cast<int64_t>(ceil(reach * reach)));
+}
+
+bool Grid::IsCacheCurrent(const MovementCache &cache, int x, int y,
+                          const FactorSet &factors,
+                          int levels, int vision, const KernelSpec &kernel) {
+  if (cache.x != x || cache.y != y || cache.levels != levels ||
+      cache.kernel.type != kernel.type || cache.kernel.scale != kernel.scale) {
+    return false;
+  }
+
+  // Go through the visible factors in order, and make sure each one matches
+  // the next one in the cache.
+  factors.FindVisible(x, y, vision, 0, &visible_);
+  if (visible_.size() != cache.factor_xs.size()) {
+    return false;
+  }
+  for (uint32_t i = 0; i < visible_.size(); ++i) {
+    int factor_x, factor_y;
+    factors.GetPosition(visible_[i], &factor_x, &factor_y);
+    if (cache.factor_xs[i] != factor_x || cache.factor_ys[i] != factor_y ||
+        cache.strengths[i] != factors.strength(visible_[i])) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+template <class Kernel>
+bool Grid::MoveObjectWith(const Kernel &kernel, int x, int y,
+                          const FactorSet &factors,
+                          Random *random, int *new_x, int *new_y, int levels,
+                          int vision, const KernelSpec &spec,
+                          MovementCache *cache, const GridObject *mover,
+                          const ExclusionMask *exclude) {
+  if (x < 0 || y < 0 || x >= x_size_ || y >= y_size_) {
     return false;
   }
+
+  MovementCache local_cache;
+  if (!cache) {
+    cache = &local_cache;
+  } else if (IsCacheCurrent(*cache, x, y, factors, levels, vision, spec)) {
+    // None of the factors have changed, so we already have all the weights.
+    MoveFromCache(cache, random, new_x, new_y, mover, exclude);
+    return true;
+  } else {
+    ++stats_.cache_misses;
+  }
+
+  cache->x = x;
+  cache->y = y;
+  cache->levels = levels;
+  cache->kernel = spec;
+  factors.FindVisible(x, y, vision, 0, &visible_);
+  cache->total_strength = factors.Gather(visible_, &cache->factor_xs,
+                                         &cache->factor_ys, &cache->strengths);
+
+  // We already checked the bounds, so this can't fail.
+  cache->xs.clear();
+  cache->ys.clear();
+  GetNeighborhoodLocations(x, y, &cache->xs, &cache->ys, levels);
   // We want it to have the possibility of staying in the same place also.
-  xs.push_back(x);
-  ys.push_back(y);
-  // Remove blacklisted and conflicted locations from consideration.
-  RemoveUnusable(&xs, &ys);
+  cache->xs.push_back(x);
+  cache->ys.push_back(y);
+
+  // Weigh every location, even the ones we can't use right now, so that we
+  // don't have to start over if some of them become usable again.
+  cache->weights.assign(cache->xs.size(), 0);
+  movement_kernel::Accumulate(
+      kernel, cache->factor_xs.data(), cache->factor_ys.data(),
+      cache->strengths.data(), cache->factor_xs.size(), cache->xs.data(),
+      cache->ys.data(), cache->xs.size(), cache->weights.data());
+  cache->availability.clear();
+
+  PickLocation(cache, random, new_x, new_y, mover, exclude);
+  return true;
+}
+
+void Grid::MoveFromCache(MovementCache *cache, Random *random, int *new_x,
+                         int *new_y, const GridObject *mover /* = nullptr*/,
+                         const ExclusionMask *exclude /* = nullptr*/) {
+  ++stats_.cache_hits;
+  if (PickLocation(cache, random, new_x, new_y, mover, exclude)) {
+    ++stats_.cache_renormalizations;
+  }
+}
 
-  double probabilities[8];
-  CalculateProbabilities(visible_factors, xs, ys, probabilities);
+bool Grid::PickLocation(MovementCache *cache, Random *random, int *new_x,
+                        int *new_y, const GridObject *mover,
+                        const ExclusionMask *exclude) {
+  // Figure out what's available now, and whether that's changed since we last
+  // built the sampler.
+  const uint32_t num_locations = cache->xs.size();
+  bool changed = cache->availability.size() != num_locations;
+  cache->availability.resize(num_locations);
+  for (uint32_t i = 0; i < num_locations; ++i) {
+    const double availability =
+        GetAvailability(cache->xs[i], cache->ys[i], mover, exclude);
+    if (availability != cache->availability[i]) {
+      cache->availability[i] = availability;
+      changed = true;
+    }
+  }
+
+  if (changed) {
+    // Renormalize over whatever is left. The buffers keep their capacity, so
+    // this doesn't allocate anything once the cache has been used a few
+    // times.
+    cache->usable_xs.clear();
+    cache->usable_ys.clear();
+    cache->probabilities.clear();
+    for (uint32_t i = 0; i < num_locations; ++i) {
+      if (cache->availability[i] > 0) {
+        cache->usable_xs.push_back(cache->xs[i]);
+        cache->usable_ys.push_back(cache->ys[i]);
+        cache->probabilities.push_back(cache->weights[i]);
+      }
+    }
 
-  DoMovement(probabilities, xs, ys, new_x, new_y);
+    const int kept = cache->usable_xs.size();
+    if (kept) {
+      if (cache->factor_xs.empty() || !cache->total_strength) {
+        // Having no factors is valid. It means that every location should be
+        // equally likely.
+        for (double &probability : cache->probabilities) {
+          probability = 1.0 / kept;
+        }
+      } else {
+        NormalizeProbabilities(cache->factor_xs.size(), kept,
+                               cache->probabilities.data());
+      }
+      // Make anywhere the mover would rather not go less likely.
+      int kept_index = 0;
+      for (uint32_t i = 0; i < num_locations; ++i) {
+        if (cache->availability[i] > 0) {
+          cache->probabilities[kept_index++] *= cache->availability[i];
+        }
+      }
+      cache->sampler.Reset(cache->probabilities.data(), kept);
+    }
+  }
 
-  if (x == *new_x && y == *new_y) {
-    printf("Staying in the same place.\n");
+  if (cache->usable_xs.empty()) {
+    // There's nowhere we can go. Ask to stay put, and let whoever is moving us
+    // figure out what to do if that doesn't work.
+    *new_x = cache->x;
+    *new_y = cache->y;
+    return changed;
   }
 
+  DoMovement(&cache->sampler, cache->usable_xs, cache->usable_ys,
+             random->Uniform(), new_x, new_y);
+  return changed;
+}
+
+template <class Kernel>
+bool Grid::MoveObjectSampledWith(const Kernel &kernel, int x, int y,
+                                 const FactorSet &factors,
+                                 Random *random, int *new_x, int *new_y,
+                                 int levels, int vision, int samples,
+                                 const GridObject *mover,
+                                 const ExclusionMask *exclude) {
+  if (x < 0 || y < 0 || x >= x_size_ || y >= y_size_) {
+    return false;
+  }
+
+  factors.FindVisible(x, y, vision, 0, &visible_);
+  ::std::vector<int> factor_xs, factor_ys;
+  ::std::vector<double> strengths;
+  const int total_strength =
+      factors.Gather(visible_, &factor_xs, &factor_ys, &strengths);
+  // Like in CalculateProbabilities(), factors that cancel out completely are
+  // the same as no factors.
+  const int num_factors = total_strength ? factor_xs.size() : 0;
+
+  // The neighborhood, clipped to the grid.
+  const int start_x = ::std::max(x - levels, 0);
+  const int end_x = ::std::min(x + levels, x_size_ - 1);
+  const int start_y = ::std::max(y - levels, 0);
+  const int end_y = ::std::min(y + levels, y_size_ - 1);
+  const int width = end_x - start_x + 1;
+  const int height = end_y - start_y + 1;
+
+  // Find a lower bound on the total factor weight anywhere in the
+  // neighborhood, which stands in for the minimum that MoveObject() shifts by.
+  // Weights never get bigger with distance, so an attractive factor is weakest
+  // at the farthest corner, and a repulsive one is strongest at the closest
+  // point.
+  double floor = 0;
+  // Also figure out which way the factors are pulling us overall.
+  double pull_x = 0, pull_y = 0;
+  for (int f = 0; f < num_factors; ++f) {
+    const int near_dx =
+        ::std::min(::std::max(factor_xs[f], start_x), end_x) - factor_xs[f];
+    const int near_dy =
+        ::std::min(::std::max(factor_ys[f], start_y), end_y) - factor_ys[f];
+    const int far_dx =
+        ::std::max(abs(factor_xs[f] - start_x), abs(factor_xs[f] - end_x));
+    const int far_dy =
+        ::std::max(abs(factor_ys[f] - start_y), abs(factor_ys[f] - end_y));
+    if (strengths[f] > 0) {
+      floor += strengths[f] * kernel.Weight(far_dx * far_dx + far_dy * far_dy);
+    } else {
+      floor +=
+          strengths[f] * kernel.Weight(near_dx * near_dx + near_dy * near_dy);
+    }
+
+    const int dx = factor_xs[f] - x;
+    const int dy = factor_ys[f] - y;
+    const double pull = strengths[f] * kernel.Weight(dx * dx + dy * dy);
+    pull_x += pull * dx;
+    pull_y += pull * dy;
+  }
+  // Like MoveObject(), only shift the weights when they can be negative.
+  const double shift = ::std::min(floor, 0.0);
+
+  // Calculates the target weight of a location. Unusable locations get zero.
+  auto weight = [&](int location_x, int location_y) {
+    const double availability =
+        GetAvailability(location_x, location_y, mover, exclude);
+    if (!availability) {
+      return 0.0;
+    }
+    if (!num_factors) {
+      // Without factors, everything is equally likely.
+      return availability;
+    }
+    double total = 0;
+    for (int f = 0; f < num_factors; ++f) {
+      const int dx = location_x - factor_xs[f];
+      const int dy = location_y - factor_ys[f];
+      total += strengths[f] * kernel.Weight(dx * dx + dy * dy);
+    }
+    // Make sure nothing usable is completely impossible, so that the chain
+    // can always move.
+    return availability * (total - shift + 1e-12);
+  };
+
+  // The biased part of the proposal is a box around the point that the
+  // factors are pulling us towards.
+  const int box_radius = ::std::max(1, levels / 3);
+  int target_x = x, target_y = y;
+  const double pull = sqrt(pull_x * pull_x + pull_y * pull_y);
+  if (pull > 0) {
+    target_x = x + static_cast<int>(round(levels * pull_x / pull));
+    target_y = y + static_cast<int>(round(levels * pull_y / pull));
+  }
+  const int box_start_x = ::std::max(target_x - box_radius, start_x);
+  const int box_end_x = ::std::min(target_x + box_radius, end_x);
+  const int box_start_y = ::std::max(target_y - box_radius, start_y);
+  const int box_end_y = ::std::min(target_y + box_radius, end_y);
+  const bool have_box = box_start_x <= box_end_x && box_start_y <= box_end_y;
+  const int box_width = box_end_x - box_start_x + 1;
+  const int box_height = box_end_y - box_start_y + 1;
+  // Chance of proposing from the box instead of the whole neighborhood.
+  const double box_chance = have_box ? 0.5 : 0.0;
+
+  // Calculates the probability of proposing a particular location.
+  auto proposal_probability = [&](int location_x, int location_y) {
+    double probability = (1.0 - box_chance) / (width * height);
+    if (have_box && location_x >= box_start_x && location_x <= box_end_x &&
+        location_y >= box_start_y && location_y <= box_end_y) {
+      probability += box_chance / (box_width * box_height);
+    }
+    return probability;
+  };
+
+  // Start where we are, and run the chain.
+  int current_x = x, current_y = y;
+  double current_weight = weight(x, y);
+  double current_proposal = proposal_probability(x, y);
+  for (int i = 0; i < samples; ++i) {
+    int proposed_x, proposed_y;
+    if (random->Uniform() < box_chance) {
+      proposed_x =
+          box_start_x + static_cast<int>(random->Uniform() * box_width);
+      proposed_y =
+          box_start_y + static_cast<int>(random->Uniform() * box_height);
+    } else {
+      proposed_x = start_x + static_cast<int>(random->Uniform() * width);
+      proposed_y = start_y + static_cast<int>(random->Uniform() * height);
+    }
+    ++stats_.proposals;
+
+    const double proposed_weight = weight(proposed_x, proposed_y);
+    const double proposed_proposal =
+        proposal_probability(proposed_x, proposed_y);
+    // Metropolis-Hastings acceptance for an independent proposal.
+    const double numerator = proposed_weight * current_proposal;
+    const double denominator = current_weight * proposed_proposal;
+    if (numerator > 0 &&
+        (numerator >= denominator ||
+         random->Uniform() * denominator < numerator)) {
+      current_x = proposed_x;
+      current_y = proposed_y;
+      current_weight = proposed_weight;
+      current_proposal = proposed_proposal;
+      ++stats_.accepted_proposals;
+    }
+  }
+
+  *new_x = current_x;
+  *new_y = current_y;
   return true;
 }
 
-void Grid::CalculateProbabilities(::std::list<MovementFactor> &factors,
-                                  const ::std::list<int> &xs,
-                                  const ::std::list<int> &ys,
-                                  double *probabilities) {
-  int total_strength = 0;
-  for (auto &factor : factors) {
-    // There is an edge case where all our factors could have a strength of
-    // zero.
-    total_strength += factor.GetStrength();
+bool Grid::EvaluateMoves(const ::std::vector<MoveRequest *> &requests) {
+  bool succeeded = true;
+
+  // Group the requests by kernel and by their own group. There are only ever
+  // a few of each, so this doesn't need anything fancier than a list.
+  struct Group {
+    KernelSpec kernel;
+    int group;
+    ::std::vector<MoveRequest *> members;
+    // The biggest squared distance that any member needs a weight for.
+    int64_t reach_squared;
+  };
+  ::std::vector<Group> groups;
+  for (MoveRequest *request : requests) {
+    request->xs.clear();
+    request->ys.clear();
+    request->weights.clear();
+    request->factor_xs.clear();
+    request->factor_ys.clear();
+    request->strengths.clear();
+    request->sorted_factors.clear();
+    request->num_factors = 0;
+    request->total_strength = 0;
+    if (!GetNeighborhoodLocations(request->x, request->y, &request->xs,
+                                  &request->ys, request->levels)) {
+      succeeded = false;
+      continue;
+    }
+    // We want it to have the possibility of staying in the same place also.
+    request->xs.push_back(request->x);
+    request->ys.push_back(request->y);
+    request->weights.assign(request->xs.size(), 0);
+
+    request->factors->FindVisible(request->x, request->y, request->vision, 0,
+                                  &visible_);
+    request->total_strength =
+        request->factors->Gather(visible_, &request->factor_xs,
+                                 &request->factor_ys, &request->strengths);
+    request->num_factors = visible_.size();
+
+    KernelSpec kernel = request->kernel;
+    // The default kernel doesn't have a scale, so don't let it split groups.
+    if (kernel.type == KernelSpec::kInversePower) {
+      kernel.scale = 0;
+    }
+    auto group = ::std::find_if(groups.begin(), groups.end(),
+                                [&kernel, request](const Group &group) {
+                                  return group.kernel.type == kernel.type &&
+                                         group.kernel.scale == kernel.scale &&
+                                         group.group == request->group;
+                                });
+    if (group == groups.end()) {
+      groups.push_back({kernel, request->group, {}, 0});
+      group = groups.end() - 1;
+    }
+    group->members.push_back(request);
+    group->reach_squared =
+        ::std::max(group->reach_squared,
+                   GetReachSquared(request->levels, request->vision));
+  }
+
+  const int tiles_y = (y_size_ + kIndexTile - 1) / kIndexTile;
+  for (auto &group : groups) {
+    const KernelSpec &kernel = group.kernel;
+    ::std::vector<MoveRequest *> &members = group.members;
+
+    // Put requests that are close together next to each other, since they can
+    // see a lot of the same factors. The sort is stable, so that the blocks
+    // don't depend on anything but the order of the requests.
+    auto tile = [tiles_y](const MoveRequest *request) {
+      return request->x / kIndexTile * tiles_y + request->y / kIndexTile;
+    };
+    ::std::stable_sort(members.begin(), members.end(),
+                       [&tile](const MoveRequest *a, const MoveRequest *b) {
+                         return tile(a) < tile(b);
+                       });
+    // Cut them up into blocks that each stay within one tile, so that
+    // everything in a block is close enough to share factors, and that don't
+    // get much bigger than kLocationBlock locations.
+    ::std::vector<int> block_starts(1, 0);
+    int locations = 0;
+    for (uint32_t i = 0; i < members.size(); ++i) {
+      if (locations && (locations >= kLocationBlock ||
+                        tile(members[i]) != tile(members[i - 1]))) {
+        block_starts.push_back(i);
+        locations = 0;
+      }
+      locations += members[i]->xs.size();
+    }
+    if (block_starts.back() != static_cast<int>(members.size())) {
+      block_starts.push_back(members.size());
+    }
+
+    switch (kernel.type) {
+      case KernelSpec::kInversePower:
+      case KernelSpec::kExponential:
+        // The table has to be ready before the threads start looking things up
+        // in it.
+        AccumulateBlocks(GetTableKernel(kernel, group.reach_squared), members,
+                         block_starts);
+        break;
+      case KernelSpec::kCutoff:
+        AccumulateBlocks(movement_kernel::CutoffKernel(kernel.scale), members,
+                         block_starts);
+        break;
+      case KernelSpec::kLinear:
+        AccumulateBlocks(movement_kernel::LinearKernel(kernel.scale), members,
+                         block_starts);
+        break;
+    }
+  }
+
+  return succeeded;
+}
+
+void Grid::FinishMove(MoveRequest *request, Random *random, int *new_x,
+                      int *new_y, MovementCache *cache /* = nullptr*/,
+                      const GridObject *mover /* = nullptr*/,
+                      const ExclusionMask *exclude /* = nullptr*/) {
+  MovementCache local_cache;
+  if (!cache) {
+    cache = &local_cache;
   }
+
+  // The request is used up anyway, so we can just take what we need.
+  cache->x = request->x;
+  cache->y = request->y;
+  cache->levels = request->levels;
+  cache->kernel = request->kernel;
+  cache->factor_xs.swap(request->factor_xs);
+  cache->factor_ys.swap(request->factor_ys);
+  cache->strengths.swap(request->strengths);
+  cache->total_strength = request->total_strength;
+  cache->xs.swap(request->xs);
+  cache->ys.swap(request->ys);
+  cache->weights.swap(request->weights);
+  cache->availability.clear();
+
+  PickLocation(cache, random, new_x, new_y, mover, exclude);
+}
+
+void Grid::CalculateProbabilities(const FactorSet &factors,
+                                  const ::std::vector<int> &xs,
+                                  const ::std::vector<int> &ys,
+                                  double *probabilities) {
+  CalculateProbabilities(GetTableKernel(KernelSpec(), GetReachSquared(0, -1)),
+                         factors, xs, ys, probabilities);
+}
+
+template <class Kernel>
+void Grid::CalculateProbabilities(const Kernel &kernel,
+                                  const FactorSet &factors,
+                                  const ::std::vector<int> &xs,
+                                  const ::std::vector<int> &ys,
+                                  double *probabilities) {
+  // Lay everything out in flat arrays so that the kernel can vectorize it.
+  ::std::vector<int> factor_xs, factor_ys;
+  ::std::vector<double> strengths;
+  // There is an edge case where all our factors could have a strength of zero.
+  const int total_strength = factors.Gather(&factor_xs, &factor_ys, &strengths);
   // Having the factor list empty is valid. It means that there are no
   // factors, and that therefore, there should be an equal probability for every
   // neighborhood location.
@@ -275,7 +1079,6 @@ void Grid::CalculateProbabilities(::std::list<MovementFactor> &factors,
     for (uint32_t i = 0; i < xs.size(); ++i) {
       probabilities[i] = 1.0 / xs.size();
     }
-    printf("Using equal probabilities.\n");
     return;
   }
 
@@ -285,99 +1088,111 @@ void Grid::CalculateProbabilities(::std::list<MovementFactor> &factors,
 
   // Calculate how far each factor is from each location and use it to change
   // the probabilities.
-  for (auto &factor : factors) {
-  	auto x_itr = xs.begin();
-  	auto y_itr = ys.begin();
-    for (uint32_t i = 0; i < xs.size(); ++i, ++x_itr, ++y_itr) {
-      const double radius = factor.GetDistance(*x_itr, *y_itr);
-
-      if (radius != 0) {
-        probabilities[i] += (1.0 / pow(radius, 5)) * factor.GetStrength();
-      } else {
-        // If our factor is in the same location that we are.
-        probabilities[i] += 10 * factor.GetStrength();
-      }
-    }
-  }
+  movement_kernel::Accumulate(kernel, factor_xs.data(), factor_ys.data(),
+                              strengths.data(), factors.size(), xs.data(),
+                              ys.data(), xs.size(), probabilities);
 
+  NormalizeProbabilities(factors.size(), xs.size(), probabilities);
+}
+
+void Grid::NormalizeProbabilities(int num_factors, int size,
+                                  double *probabilities) {
   // Scale probabilities to between 0 and 1.
   double min = 0;
-  for (uint32_t i = 0; i < xs.size(); ++i) {
+  for (int i = 0; i < size; ++i) {
     // First, divide to find the average.
-    probabilities[i] /= factors.size();
+    probabilities[i] /= num_factors;
     // Find the min.
     min = ::std::min(min, probabilities[i]);
   }
   double total = 0;
-  for (uint32_t i = 0; i < xs.size(); ++i) {
+  for (int i = 0; i < size; ++i) {
     // Shift everything to make it positive and calculate total.
     probabilities[i] = (probabilities[i] - min);
     total += probabilities[i];
   }
-  for (uint32_t i = 0; i < xs.size(); ++i) {
+  if (!total) {
+    // Kernels with a cutoff can leave every location with the same weight, in
+    // which case they're all equally likely.
+    for (int i = 0; i < size; ++i) {
+      probabilities[i] = 1.0 / size;
+    }
+    return;
+  }
+  for (int i = 0; i < size; ++i) {
     // Do the scaling.
     probabilities[i] /= total;
-    printf("Probabilities: %f\n", probabilities[i]);
   }
 }
 
-void Grid::DoMovement(const double *probabilities, const ::std::list<int> &xs,
-                      const ::std::list<int> &ys, int *new_x, int *new_y) {
-  // Get a random float that's somewhere between 0 and 1.
-  const double random =
-      static_cast<double>(rand()) / static_cast<double>(RAND_MAX);
+void Grid::DoMovement(DiscreteSampler *sampler, const ::std::vector<int> &xs,
+                      const ::std::vector<int> &ys, double random, int *new_x,
+                      int *new_y) {
+  DiscreteSampler::Method method;
+  const int index = sampler->Sample(random, &method);
 
-  // Count up until we're above it.
-  double running_total = 0;
-  auto x_itr = xs.begin();
-  auto y_itr = ys.begin();
-  for (uint32_t i = 0; i < xs.size(); ++i, ++x_itr, ++y_itr) {
-    running_total += probabilities[i];
-    if (running_total >= random) {
-      *new_x = *x_itr;
-      *new_y = *y_itr;
-      return;
+  // Keep track of how we're picking locations.
+  switch (method) {
+    case DiscreteSampler::kLinear:
+      ++stats_.linear_samples;
+      break;
+    case DiscreteSampler::kBinarySearch:
+      ++stats_.binary_search_samples;
+      break;
+    case DiscreteSampler::kAlias:
+      ++stats_.alias_samples;
+      break;
+  }
+
+  *new_x = xs[index];
+  *new_y = ys[index];
+}
+
+void Grid::ExcludePending(ExclusionMask *mask) {
+  const int start_x = ::std::max(mask->x() - mask->levels(), 0);
+  const int end_x = ::std::min(mask->x() + mask->levels(), x_size_ - 1);
+  const int start_y = ::std::max(mask->y() - mask->levels(), 0);
+  const int end_y = ::std::min(mask->y() + mask->levels(), y_size_ - 1);
+  for (int x = start_x; x <= end_x; ++x) {
+    for (int y = start_y; y <= end_y; ++y) {
+      if (GetPending(x, y)) {
+        mask->Exclude(x, y);
+      }
     }
   }
-  // Floating point weirdness could get us here...
-  *new_x = *(--x_itr);
-  *new_y = *(--y_itr);
 }
 
-void Grid::RemoveInvisible(int x, int y, ::std::list<MovementFactor> *factors,
-                           int vision) {
-  auto itr = factors->begin();
-  for (; itr != factors->end(); ++itr) {
-    const double radius = itr->GetDistance(x, y);
+double Grid::GetAvailability(int x, int y, const GridObject *mover,
+                             const ExclusionMask *exclude) {
+  if (!IsUsable(x, y) || (exclude && exclude->IsExcluded(x, y))) {
+    return 0;
+  }
+  if (!mover) {
+    return 1;
+  }
 
-    printf("Radius: %f\n", radius);
-    if (((*itr).GetVisibility() > 0 &&
-         radius > (*itr).GetVisibility()) ||
-        (vision > 0 && radius > vision)) {
-      // Decrement here so that it still points to something valid afterwards.
-      auto temp_itr = itr;
-      --itr;
-      factors->erase(temp_itr);
-    }
+  const GridObject *pending = GetPending(x, y);
+  if (!pending || pending == mover) {
+    return 1;
   }
+  return mover->PendingWeight(pending);
 }
 
-void Grid::RemoveUnusable(::std::list<int> *xs, ::std::list<int> *ys) {
-	auto x_itr = xs->begin();
-	auto y_itr = ys->begin();
-  for (; x_itr != xs->end(); ++x_itr, ++y_itr) {
-    const Cell *cell = &grid_[*x_itr * x_size_ + *y_itr];
-    if (cell->Blacklisted || cell->ConflictedObject) {
+void Grid::RemoveUnusable(::std::vector<int> *xs, ::std::vector<int> *ys) {
+  // Shift everything we're keeping down over the things we're removing, so the
+  // order stays the same.
+  uint32_t kept = 0;
+  for (uint32_t i = 0; i < xs->size(); ++i) {
+    if (!IsUsable((*xs)[i], (*ys)[i])) {
       // This cell is blacklisted or unusable. Remove it from consideration.
-      auto temp_x = x_itr;
-      auto temp_y = y_itr;
-      // Decrement here so that it still points to something valid afterwards.
-      --x_itr;
-      --y_itr;
-      xs->erase(temp_x);
-      ys->erase(temp_y);
+      continue;
     }
+    (*xs)[kept] = (*xs)[i];
+    (*ys)[kept] = (*ys)[i];
+    ++kept;
   }
+  xs->resize(kept);
+  ys->resize(kept);
 }
 
 bool Grid::Update() {
@@ -386,17 +1201,330 @@ bool Grid::Update() {
       // We can't update if we still have unresolved conflicts.
       return false;
     }
+  }
 
+  // Anything that isn't on a cell after this isn't baked anywhere.
+  ::std::fill(baked_positions_.xs.begin(), baked_positions_.xs.end(), -1);
+  ::std::fill(baked_positions_.ys.begin(), baked_positions_.ys.end(), -1);
+  for (int i = 0; i < x_size_ * y_size_; ++i) {
     grid_[i].Object = grid_[i].NewObject;
+    if (grid_[i].Object) {
+      const int slot = grid_[i].Object->slot();
+      baked_positions_.xs[slot] = i / x_size_;
+      baked_positions_.ys[slot] = i % x_size_;
+    }
     // Setting them both to be the same by default allows nullptr to be a valid
     // thing to swap in.
     grid_[i].Blacklisted = false;
     grid_[i].RequestStasis = false;
+    grid_[i].Contenders = -1;
+  }
+  // Nothing is contending for anything anymore.
+  contenders_.clear();
+  BuildSpeciesIndex();
+
+  // Everything that moved is now baked in its new position.
+  motion_bounds_.resize(tick_displacements_.size(), 0);
+  for (uint32_t i = 0; i < tick_displacements_.size(); ++i) {
+    motion_bounds_[i] += tick_displacements_[i];
+    tick_displacements_[i] = 0;
   }
+  ++tick_;
 
   return true;
 }
 
+int Grid::AddSlot(GridObject *object) {
+  // This is a new object that FindSpecies() will be able to find once it gets
+  // baked.
+  species_index_dirty_ = true;
+
+  if (free_slots_.empty()) {
+    assert(slot_objects_.size() < (1u << kHandleSlotBits) - 1 &&
+           "Too many objects for a handle to refer to.");
+    slot_objects_.push_back(object);
+    baked_positions_.xs.push_back(-1);
+    baked_positions_.ys.push_back(-1);
+    baked_positions_.generations.push_back(0);
+    return slot_objects_.size() - 1;
+  }
+
+  const int slot = free_slots_.back();
+  free_slots_.pop_back();
+  slot_objects_[slot] = object;
+  baked_positions_.xs[slot] = -1;
+  baked_positions_.ys[slot] = -1;
+  return slot;
+}
+
+void Grid::FreeSlot(int slot) {
+  assert(slot_objects_[slot] && "Freeing a slot that isn't in use.");
+  slot_objects_[slot] = nullptr;
+  baked_positions_.xs[slot] = -1;
+  baked_positions_.ys[slot] = -1;
+  // Make any handles to the old object stale. The generation wraps around, so
+  // a handle that is kept for a very long time could come back to life, but
+  // only after the slot has been reused that many times.
+  baked_positions_.generations[slot] =
+      (baked_positions_.generations[slot] + 1) &
+      ((1u << (32 - kHandleSlotBits)) - 1);
+  free_slots_.push_back(slot);
+}
+
+GridObject *Grid::ResolveHandle(ObjectHandle handle) const {
+  const uint32_t slot = handle & ((1u << kHandleSlotBits) - 1);
+  if (handle == kNoHandle || slot >= slot_objects_.size() ||
+      baked_positions_.generations[slot] != handle >> kHandleSlotBits) {
+    return nullptr;
+  }
+  return slot_objects_[slot];
+}
+
+void Grid::BuildSpeciesIndex() {
+  const int tiles_x = (x_size_ + kIndexTile - 1) / kIndexTile;
+  const int tiles_y = (y_size_ + kIndexTile - 1) / kIndexTile;
+  const int num_slots = slot_objects_.size();
+
+  // Figure out how many buckets we need.
+  indexed_species_ = 0;
+  for (int slot = 0; slot < num_slots; ++slot) {
+    if (slot_objects_[slot] && baked_positions_.xs[slot] >= 0) {
+      indexed_species_ =
+          ::std::max(indexed_species_, slot_objects_[slot]->get_species() + 1);
+    }
+  }
+
+  // Count how many members go in each bucket, and then lay the buckets out
+  // end to end. Slots go in in order, so everything stays deterministic.
+  auto bucket = [&](int slot) {
+    const int tile_x = baked_positions_.xs[slot] / kIndexTile;
+    const int tile_y = baked_positions_.ys[slot] / kIndexTile;
+    return (slot_objects_[slot]->get_species() * tiles_x + tile_x) * tiles_y +
+           tile_y;
+  };
+  auto indexed = [&](int slot) {
+    return slot_objects_[slot] && baked_positions_.xs[slot] >= 0 &&
+           slot_objects_[slot]->get_species() >= 0;
+  };
+  species_offsets_.assign(indexed_species_ * tiles_x * tiles_y + 1, 0);
+  for (int slot = 0; slot < num_slots; ++slot) {
+    if (indexed(slot)) {
+      ++species_offsets_[bucket(slot) + 1];
+    }
+  }
+  for (uint32_t i = 1; i < species_offsets_.size(); ++i) {
+    species_offsets_[i] += species_offsets_[i - 1];
+  }
+  species_slots_.resize(species_offsets_.back());
+  ::std::vector<int> next(species_offsets_.begin(), species_offsets_.end() - 1);
+  for (int slot = 0; slot < num_slots; ++slot) {
+    if (indexed(slot)) {
+      species_slots_[next[bucket(slot)]++] = slot;
+    }
+  }
+
+  if (species_index_dirty_) {
+    ++species_version_;
+    species_index_dirty_ = false;
+  }
+}
+
+void Grid::FindSpecies(int species, int x, int y, int radius,
+                       ::std::vector<int> *slots) const {
+  slots->clear();
+  if (species < 0 || species >= indexed_species_) {
+    return;
+  }
+
+  const int tiles_x = (x_size_ + kIndexTile - 1) / kIndexTile;
+  const int tiles_y = (y_size_ + kIndexTile - 1) / kIndexTile;
+  int start_x = 0, end_x = tiles_x - 1, start_y = 0, end_y = tiles_y - 1;
+  if (radius >= 0) {
+    start_x = ::std::max(x - radius, 0) / kIndexTile;
+    end_x = ::std::min(x + radius, x_size_ - 1) / kIndexTile;
+    start_y = ::std::max(y - radius, 0) / kIndexTile;
+    end_y = ::std::min(y + radius, y_size_ - 1) / kIndexTile;
+  }
+
+  for (int tile_x = start_x; tile_x <= end_x; ++tile_x) {
+    for (int tile_y = start_y; tile_y <= end_y; ++tile_y) {
+      const int bucket = (species * tiles_x + tile_x) * tiles_y + tile_y;
+      for (int i = species_offsets_[bucket]; i < species_offsets_[bucket + 1];
+           ++i) {
+        const int slot = species_slots_[i];
+        if (baked_positions_.xs[slot] < 0) {
+          // It's been removed from the grid since the last update.
+          continue;
+        }
+        const int dx = baked_positions_.xs[slot] - x;
+        const int dy = baked_positions_.ys[slot] - y;
+        if (radius >= 0 && dx * dx + dy * dy > radius * radius) {
+          continue;
+        }
+        slots->push_back(slot);
+      }
+    }
+  }
+}
+
+bool Grid::ResolveConflicts(const ConflictPolicy &policy,
+                            ConflictResults *results, int max_rounds) {
+  results->rounds.clear();
+  results->eaters.clear();
+  results->eaten.clear();
+  results->custom1.clear();
+  results->custom2.clear();
+
+  ::std::vector<int> contested;
+  ::std::vector<GridObject *> contenders;
+  for (int round = 0; round < max_rounds; ++round) {
+    // Settling things moves objects around, so figure out where all the
+    // conflicts are before we start.
+    contested.clear();
+    for (int i = 0; i < x_size_ * y_size_; ++i) {
+      if (grid_[i].ConflictedObject) {
+        contested.push_back(i);
+      }
+    }
+
+    ConflictRound stats;
+    for (int i : contested) {
+      const Cell &cell = grid_[i];
+      GetContenders(cell, &contenders);
+      if (contenders.empty()) {
+        // Something we did earlier in this round already took care of it.
+        continue;
+      }
+
+      // Everything has to beat whatever is currently winning.
+      GridObject *holder = contenders[0];
+      for (uint32_t c = 1; c < contenders.size(); ++c) {
+        if (!IsContending(cell, contenders[c])) {
+          // It already went somewhere else.
+          continue;
+        }
+        ++stats.conflicts;
+        holder = SettleConflict(policy, holder, contenders[c], results,
+                                &stats);
+      }
+    }
+
+    if (stats.conflicts == stats.custom) {
+      // Nothing left that we can do anything about.
+      break;
+    }
+    results->rounds.push_back(stats);
+  }
+
+  // See what's left.
+  ::std::vector<GridObject *> objects1, objects2;
+  GetConflicted(&objects1, &objects2);
+  bool resolved = true;
+  for (uint32_t i = 0; i < objects1.size(); ++i) {
+    if (policy.Get(objects1[i]->get_species(), objects2[i]->get_species()) ==
+        ConflictPolicy::kCustom) {
+      results->custom1.push_back(objects1[i]);
+      results->custom2.push_back(objects2[i]);
+    } else {
+      resolved = false;
+    }
+  }
+
+  return resolved;
+}
+
+GridObject *Grid::SettleConflict(const ConflictPolicy &policy,
+                                 GridObject *holder, GridObject *challenger,
+                                 ConflictResults *results,
+                                 ConflictRound *stats) {
+  GridObject *object1 = holder;
+  GridObject *object2 = challenger;
+  const int species1 = object1->get_species();
+  const int species2 = object2->get_species();
+  ConflictPolicy::Action action = policy.Get(species1, species2);
+  if (action != ConflictPolicy::kEat &&
+      policy.Get(species2, species1) == ConflictPolicy::kEat) {
+    // It's the other one that does the eating.
+    ::std::swap(object1, object2);
+    action = ConflictPolicy::kEat;
+  }
+
+  GridObject *loser = nullptr;
+  bool settled = false;
+  switch (action) {
+    case ConflictPolicy::kEat:
+      loser = object2;
+      settled = object2->RemoveFromGrid();
+      if (settled) {
+        results->eaters.push_back(object1);
+        results->eaten.push_back(object2);
+        ++stats->eaten;
+      }
+      break;
+
+    case ConflictPolicy::kSwap: {
+      if (IsStaying(object1)) {
+        loser = object1;
+      } else if (IsStaying(object2)) {
+        loser = object2;
+      } else {
+        loser = PickLoser(seed_, tick_, object1, object2);
+      }
+      GridObject *winner = loser == object1 ? object2 : object1;
+
+      int baked_x, baked_y;
+      if (winner->GetBakedPosition(&baked_x, &baked_y) &&
+          MoveTo(loser, baked_x, baked_y)) {
+        ++stats->swapped;
+        settled = true;
+      } else {
+        // There's nowhere to swap to, so it has to find somewhere else.
+        settled = loser->Relocate();
+        stats->relocated += settled;
+      }
+      break;
+    }
+
+    case ConflictPolicy::kRetreat: {
+      if (IsStaying(object1)) {
+        loser = object2;
+      } else if (IsStaying(object2)) {
+        loser = object1;
+      } else {
+        loser = PickLoser(seed_, tick_, object1, object2);
+      }
+
+      int baked_x, baked_y;
+      if (loser->GetBakedPosition(&baked_x, &baked_y) &&
+          MoveTo(loser, baked_x, baked_y)) {
+        ++stats->retreated;
+        settled = true;
+      } else {
+        // It hasn't been anywhere before, so it has to find somewhere.
+        settled = loser->Relocate();
+        stats->relocated += settled;
+      }
+      break;
+    }
+
+    case ConflictPolicy::kCustom:
+      ++stats->custom;
+      return holder;
+
+    case ConflictPolicy::kRandomLoser:
+      loser = PickLoser(seed_, tick_, object1, object2);
+      settled = loser->Relocate();
+      stats->relocated += settled;
+      break;
+  }
+
+  if (!settled) {
+    ++stats->failed;
+    return holder;
+  }
+  return loser == holder ? challenger : holder;
+}
+
 void Grid::GetConflicted(::std::vector<GridObject *> *objects1,
                          ::std::vector<GridObject *> *objects2) {
   objects1->clear();
@@ -406,8 +1534,49 @@ void Grid::GetConflicted(::std::vector<GridObject *> *objects1,
     if (grid_[i].ConflictedObject) {
       objects1->push_back(grid_[i].NewObject);
       objects2->push_back(grid_[i].ConflictedObject);
+      for (int c = grid_[i].Contenders; c >= 0; c = contenders_[c].Next) {
+        objects1->push_back(grid_[i].NewObject);
+        objects2->push_back(contenders_[c].Object);
+      }
     }
   }
 }
 
+bool Grid::IsContending(const Cell &cell, const GridObject *object) const {
+  if (cell.ConflictedObject == object) {
+    return true;
+  }
+  for (int c = cell.Contenders; c >= 0; c = contenders_[c].Next) {
+    if (contenders_[c].Object == object) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void Grid::GetContenders(const Cell &cell,
+                         ::std::vector<GridObject *> *contenders) const {
+  contenders->clear();
+  if (!cell.ConflictedObject) {
+    // Nobody is contending for this one.
+    return;
+  }
+
+  contenders->push_back(cell.NewObject);
+  contenders->push_back(cell.ConflictedObject);
+  for (int c = cell.Contenders; c >= 0; c = contenders_[c].Next) {
+    contenders->push_back(contenders_[c].Object);
+  }
+}
+
+GridObject *Grid::PopContender(Cell *cell) {
+  if (cell->Contenders < 0) {
+    return nullptr;
+  }
+
+  const Contender &contender = contenders_[cell->Contenders];
+  cell->Contenders = contender.Next;
+  return contender.Object;
+}
+
 }  //  automata
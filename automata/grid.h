@@ -1,11 +1,22 @@
 #ifndef ECOSYSTEM_AUTOMATA_GRID_H_
 #define ECOSYSTEM_AUTOMATA_GRID_H_
 
-#include <list>
+#include <stdint.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <tuple>
 #include <vector>
 
+#include "automata/conflict_policy.h"
+#include "automata/distance_table.h"
+#include "automata/factor_set.h"
 #include "automata/macros.h"
-#include "automata/movement_factor.h"
+#include "automata/movement_kernel.h"
+#include "automata/random.h"
+#include "automata/sampler.h"
+#include "automata/species_factors.h"
 
 // Defines functions for dealing with the grid at a low level.
 
@@ -27,6 +38,251 @@ class AutomataTest_OutOfBoundsTest_Test;
 // Forward declaration of GridObject to break circular dependency.
 class GridObject;
 
+// Counters for things that happen on the grid, which are useful for figuring
+// out where time is going.
+struct GridStats {
+  // How many movement targets were picked by scanning the probabilities.
+  uint64_t linear_samples = 0;
+  // How many were picked by binary searching cumulative probabilities.
+  uint64_t binary_search_samples = 0;
+  // How many were picked with an alias table.
+  uint64_t alias_samples = 0;
+  // How many locations were proposed by MoveObjectSampled().
+  uint64_t proposals = 0;
+  // How many of those proposals were accepted.
+  uint64_t accepted_proposals = 0;
+  // How many times MoveObject() could reuse a cached distribution.
+  uint64_t cache_hits = 0;
+  // How many of those hits had to renormalize because the usable locations had
+  // changed, like when retrying after a conflict.
+  uint64_t cache_renormalizations = 0;
+  // How many times it was given a cache, but had to recalculate anyway.
+  uint64_t cache_misses = 0;
+};
+
+// Cells that one particular move isn't allowed to go to, on top of anything
+// that the grid itself rules out. It only covers the neighborhood of a single
+// location, so for reasonable speeds it fits on the stack, and a move can be
+// restricted without touching anything that other moves can see.
+class ExclusionMask {
+ public:
+  // x: The x coordinate of the center of the neighborhood.
+  // y: The y coordinate of the center of the neighborhood.
+  // levels: How many levels the neighborhood has. (See
+  // Grid::GetNeighborhood().)
+  ExclusionMask(int x, int y, int levels)
+      : x_(x), y_(y), levels_(levels), width_(2 * levels + 1) {
+    const int words = (width_ * width_ + 63) / 64;
+    if (levels <= kInlineLevels) {
+      bits_ = inline_bits_;
+      ::std::fill(bits_, bits_ + words, 0);
+    } else {
+      heap_bits_.assign(words, 0);
+      bits_ = heap_bits_.data();
+    }
+  }
+
+  // Excludes a cell. Cells outside the neighborhood are ignored, since nothing
+  // could move to them anyway.
+  // x: The x coordinate of the cell.
+  // y: The y coordinate of the cell.
+  void Exclude(int x, int y) {
+    const int bit = GetBit(x, y);
+    if (bit >= 0) {
+      bits_[bit / 64] |= 1ull << (bit % 64);
+    }
+  }
+  // x: The x coordinate of the cell.
+  // y: The y coordinate of the cell.
+  // Returns: true if the cell is excluded.
+  bool IsExcluded(int x, int y) const {
+    const int bit = GetBit(x, y);
+    return bit >= 0 && (bits_[bit / 64] >> (bit % 64)) & 1;
+  }
+  int x() const { return x_; }
+  int y() const { return y_; }
+  int levels() const { return levels_; }
+
+ private:
+  DISSALOW_COPY_AND_ASSIGN(ExclusionMask);
+
+  // The biggest neighborhood that fits in inline_bits_.
+  static constexpr int kInlineLevels = 7;
+
+  // x: The x coordinate of a cell.
+  // y: The y coordinate of a cell.
+  // Returns: Which bit the cell uses, or -1 if it's outside the neighborhood.
+  int GetBit(int x, int y) const {
+    const int dx = x - x_ + levels_;
+    const int dy = y - y_ + levels_;
+    if (dx < 0 || dy < 0 || dx >= width_ || dy >= width_) {
+      return -1;
+    }
+    return dx * width_ + dy;
+  }
+
+  // The center and size of the neighborhood.
+  int x_, y_, levels_, width_;
+  // One bit for every cell in the neighborhood.
+  uint64_t *bits_;
+  uint64_t inline_bits_[((2 * kInlineLevels + 1) * (2 * kInlineLevels + 1) +
+                         63) / 64];
+  // Where the bits go if they don't fit in inline_bits_.
+  ::std::vector<uint64_t> heap_bits_;
+};
+
+// What happened during one round of Grid::ResolveConflicts().
+struct ConflictRound {
+  // How many conflicts there were at the start of the round.
+  int conflicts = 0;
+  // How many were settled each way. (See ConflictPolicy::Action.)
+  int eaten = 0;
+  int swapped = 0;
+  int retreated = 0;
+  int relocated = 0;
+  // How many were left alone because they are marked kCustom.
+  int custom = 0;
+  // How many we tried to settle, but couldn't.
+  int failed = 0;
+};
+
+// Everything that Grid::ResolveConflicts() did.
+struct ConflictResults {
+  // What happened in each round.
+  ::std::vector<ConflictRound> rounds;
+  // Each object in eaters ate the object at the same index in eaten. The eaten
+  // objects have been taken off the grid, but it's up to the caller to do
+  // anything else that needs to happen to them.
+  ::std::vector<GridObject *> eaters;
+  ::std::vector<GridObject *> eaten;
+  // Conflicts marked kCustom, which are still there for the caller to deal
+  // with. Each object in custom1 is conflicted with the object at the same
+  // index in custom2.
+  ::std::vector<GridObject *> custom1;
+  ::std::vector<GridObject *> custom2;
+};
+
+// The inputs and results of a MoveObject() call. Passing the same one into
+// the next call lets it skip evaluating the factors if none of them have
+// changed, which is common for things that aren't going anywhere, and for
+// retries after a conflict. If only the usable locations have changed, the
+// existing weights just get renormalized.
+struct MovementCache {
+  // Where we were moving from.
+  int x = -1;
+  int y = -1;
+  // The size of the neighborhood.
+  int levels = 0;
+  // The kernel that was used.
+  KernelSpec kernel;
+  // The positions and strengths of the factors that were visible.
+  ::std::vector<int> factor_xs;
+  ::std::vector<int> factor_ys;
+  ::std::vector<double> strengths;
+  // The total strength of those factors.
+  int total_strength = 0;
+  // Every location we could move to, whether or not it's usable right now, and
+  // the total factor weight at each of them.
+  ::std::vector<int> xs;
+  ::std::vector<int> ys;
+  ::std::vector<double> weights;
+  // How available each location was when the sampler was last built. (See
+  // Grid::GetAvailability().)
+  ::std::vector<double> availability;
+  // The locations that were usable, and the distribution over them.
+  ::std::vector<int> usable_xs;
+  ::std::vector<int> usable_ys;
+  ::std::vector<double> probabilities;
+  DiscreteSampler sampler;
+};
+
+// A request for an object to move, which can get evaluated along with a lot of
+// others in a batch. See Grid::EvaluateMoves().
+struct MoveRequest {
+  // A factor, in a form that can be sorted, so that finding the factors that
+  // two requests have in common is just a merge.
+  struct SortableFactor {
+    int x;
+    int y;
+    double strength;
+
+    bool operator<(const SortableFactor &other) const {
+      return ::std::tie(x, y, strength) <
+             ::std::tie(other.x, other.y, other.strength);
+    }
+  };
+
+  // Where the object is now.
+  int x = 0;
+  int y = 0;
+  // The factors to consider. This only needs to stay valid until
+  // EvaluateMoves() returns.
+  const FactorSet *factors = nullptr;
+  // The size of the neighborhood, like in Grid::MoveObject().
+  int levels = 1;
+  // The maximum number of cells we can be from any factor and still perceive
+  // it.
+  int vision = -1;
+  // How the weights of the factors fall off with distance.
+  KernelSpec kernel;
+  // Requests in the same group should mostly see the same factors, like
+  // members of the same species do. Only requests in the same group get
+  // evaluated together, so this only affects speed, never the results.
+  int group = -1;
+
+  // Everything below here gets filled in by EvaluateMoves().
+  // The locations that we could move to.
+  ::std::vector<int> xs;
+  ::std::vector<int> ys;
+  // The total factor weight at each of those locations.
+  ::std::vector<double> weights;
+  // The positions and strengths of the factors that went into the weights.
+  ::std::vector<int> factor_xs;
+  ::std::vector<int> factor_ys;
+  ::std::vector<double> strengths;
+  // How many factors went into the weights.
+  int num_factors = 0;
+  // The total strength of those factors.
+  int total_strength = 0;
+  // The same factors in sorted order. This only gets filled in when the
+  // request gets evaluated together with others.
+  ::std::vector<SortableFactor> sorted_factors;
+};
+
+// Refers to an object on a grid in a way that can tell when the object is
+// gone. The low kHandleSlotBits bits are the object's slot, and the rest are
+// the generation of the slot, which changes every time the slot is freed.
+typedef uint32_t ObjectHandle;
+// How many bits of a handle hold the slot.
+constexpr int kHandleSlotBits = 22;
+// A handle that never refers to anything.
+constexpr ObjectHandle kNoHandle = 0xFFFFFFFF;
+
+// Where every object on a grid was baked the last time the grid was updated,
+// indexed by the objects' slots. (See GridObject::slot().) Objects that weren't
+// baked anywhere are at (-1, -1).
+struct BakedPositions {
+  ::std::vector<int> xs;
+  ::std::vector<int> ys;
+  // The current generation of each slot.
+  ::std::vector<uint32_t> generations;
+
+  // Looks up where the object that a handle refers to was baked.
+  // handle: The handle.
+  // x: Set to the x coordinate, or -1 if the handle is stale.
+  // y: Set to the y coordinate, or -1 if the handle is stale.
+  void Get(ObjectHandle handle, int *x, int *y) const {
+    const uint32_t slot = handle & ((1u << kHandleSlotBits) - 1);
+    if (generations[slot] != handle >> kHandleSlotBits) {
+      *x = -1;
+      *y = -1;
+      return;
+    }
+    *x = xs[slot];
+    *y = ys[slot];
+  }
+};
+
 class Grid {
  public:
   // x_size: Size in the x dimension.
@@ -72,17 +328,38 @@ class Grid {
   // Returns: The occupant pending insertion at this cell, or nullptr if none
   // is.
   GridObject *GetPending(int x, int y);
-  // Gets any occupant currently in the conflicted slot at this cell.
+  // Gets any occupant currently in the conflicted slot at this cell. If more
+  // than two objects are trying to move here, this is the first one that
+  // conflicted.
   // x: The x coordinate of the cell's location.
   // y: The y coordinate of the cell's location.
   // Returns: The contents of the cell's conflicted slot.
   GridObject *GetConflict(int x, int y) const {
     return grid_[x * x_size_ + y].ConflictedObject;
   }
+  // Checks whether an object is conflicted at a cell, meaning that it is trying
+  // to move there, but something else is already pending insertion.
+  // x: The x coordinate of the cell.
+  // y: The y coordinate of the cell.
+  // object: The object to check for.
+  // Returns: true if it is conflicted there.
+  bool IsContending(int x, int y, const GridObject *object) const {
+    return IsContending(grid_[x * x_size_ + y], object);
+  }
+  // Gets everything that is trying to move to a cell.
+  // x: The x coordinate of the cell.
+  // y: The y coordinate of the cell.
+  // contenders: Filled in with the object pending insertion, followed by every
+  // object that is conflicted with it, in the order that they conflicted. Left
+  // empty if there's no conflict at the cell.
+  void GetContenders(int x, int y,
+                     ::std::vector<GridObject *> *contenders) const {
+    GetContenders(grid_[x * x_size_ + y], contenders);
+  }
   // Clears an object that is pending insertion at this cell. It will not
   // generate conflicts. Will clear anything pending insertion, including
-  // nullptr. If object matches the conflicted object instead of the one pending
-  // insertion, it will clear the conflicted slot instead.
+  // nullptr. If object is conflicted at this cell instead of pending insertion,
+  // it will clear it from the conflicted ones instead.
   // x: The x coordinate of the cell.
   // y: The y coordinate of the cell.
   // object: The object to clear from the cell.
@@ -116,7 +393,8 @@ class Grid {
   // object to move to.
   // x: x coordinate of the organism's current position.
   // y: y coordinate of the organism's current position.
-  // factors: A vector of movement factors that will be considered.
+  // factors: The movement factors that will be considered.
+  // random: The random number stream to use for picking a location.
   // new_x: The x coordinate of the organism's new position.
   // new_y: The y coordinate of the organism's new position.
   // levels: The number of levels that will be used when building the
@@ -124,21 +402,224 @@ class Grid {
   // we could move. See GetNeighborhood for an explanation of levels.
   // vision: The maximum number of cells we can be from any factor and still
   // perceive it.
-  bool MoveObject(int x, int y, const ::std::list<MovementFactor> &factors,
-                  int *new_x, int *new_y, int levels = 1, int vision = -1);
+  // kernel: How the weights of the factors fall off with distance.
+  // cache: If this is not nullptr, the weights from the last call that used
+  // this cache get reused if none of the factors have changed, and the cache
+  // gets updated if they have. Afterwards, it holds every location that was
+  // considered along with its weight.
+  // mover: The object that is moving. If this is not nullptr, it gets a say
+  // in whether we move to cells that something else is pending insertion at.
+  // (See GridObject::PendingWeight().)
+  // exclude: If this is not nullptr, cells that it excludes won't be picked.
+  bool MoveObject(int x, int y, const FactorSet &factors,
+                  Random *random, int *new_x, int *new_y, int levels = 1,
+                  int vision = -1, const KernelSpec &kernel = KernelSpec(),
+                  MovementCache *cache = nullptr,
+                  const GridObject *mover = nullptr,
+                  const ExclusionMask *exclude = nullptr);
+  // Checks whether MoveObject() could use a cache for a move, as far as the
+  // factors are concerned. It can still miss if the usable locations have
+  // changed. This has to look at every factor, so callers that can tell some
+  // other way whether the factors have changed should do that, and then use
+  // MoveFromCache().
+  // cache: The cache to check.
+  // See MoveObject() for the rest of the arguments.
+  // Returns: true if the factors and the other inputs match the cache.
+  bool IsCacheCurrent(const MovementCache &cache, int x, int y,
+                      const FactorSet &factors, int levels,
+                      int vision, const KernelSpec &kernel);
+  // Picks a location from a cache that the caller knows is still current,
+  // without looking at any factors. Only the availability of the locations
+  // gets checked again, like when MoveObject() reuses a cache.
+  // cache: The cache. It has to have been filled in by MoveObject() or
+  // FinishMove().
+  // random: The random number stream to use for picking a location.
+  // new_x: The x coordinate of the object's new position.
+  // new_y: The y coordinate of the object's new position.
+  // mover: The object that is moving, like in MoveObject().
+  // exclude: Cells that won't be picked, like in MoveObject().
+  void MoveFromCache(MovementCache *cache, Random *random, int *new_x,
+                     int *new_y, const GridObject *mover = nullptr,
+                     const ExclusionMask *exclude = nullptr);
+  // Does the same thing as MoveObject(), but instead of evaluating every
+  // location in the neighborhood, it evaluates a fixed number of them, so the
+  // cost doesn't grow with the size of the neighborhood. Locations are proposed
+  // from a mix of a uniform distribution and one that is biased in the
+  // direction that the factors are pulling us, and accepted or rejected
+  // Metropolis-Hastings style against their true weights, so that it picks
+  // from the same distribution that MoveObject() does. When the weights can go
+  // negative, MoveObject() shifts them by their minimum, and this shifts them
+  // by a lower bound for it instead, which can be calculated without visiting
+  // every location.
+  // x: x coordinate of the organism's current position.
+  // y: y coordinate of the organism's current position.
+  // factors: The movement factors that will be considered.
+  // random: The random number stream to use for picking a location.
+  // new_x: The x coordinate of the organism's new position.
+  // new_y: The y coordinate of the organism's new position.
+  // levels: The size of the neighborhood, like in MoveObject().
+  // vision: The maximum number of cells we can be from any factor and still
+  // perceive it.
+  // samples: How many locations to propose.
+  // kernel: How the weights of the factors fall off with distance. This has to
+  // be one whose weights never get bigger with distance.
+  // mover: The object that is moving, like in MoveObject().
+  // exclude: Cells that won't be picked, like in MoveObject().
+  bool MoveObjectSampled(int x, int y,
+                         const FactorSet &factors,
+                         Random *random, int *new_x, int *new_y, int levels,
+                         int vision, int samples,
+                         const KernelSpec &kernel = KernelSpec(),
+                         const GridObject *mover = nullptr,
+                         const ExclusionMask *exclude = nullptr);
+  // Does the expensive part of MoveObject() for a whole batch of objects at
+  // once. Objects that use the same kernel and are in the same group are
+  // sorted by where they are, and cut up into blocks of neighbors, which get
+  // split up between threads. Factors that everything in a block can see are
+  // evaluated against all of the block's locations together, a cache-sized
+  // tile of factors at a time, and only the rest are evaluated for each object
+  // separately. Factor positions are read when this is called, so everything
+  // in the batch sees the factors where they were at the start of it.
+  // requests: The requests to evaluate.
+  // Returns: false if any of the requests are for locations outside the grid.
+  bool EvaluateMoves(const ::std::vector<MoveRequest *> &requests);
+  // Finishes a move that was evaluated with EvaluateMoves(), by picking a
+  // location in the same way that MoveObject() would. Locations that have
+  // become unusable since it was evaluated are not considered.
+  // request: The request. Its locations and weights get used up, so it can't
+  // be finished again without being evaluated again.
+  // random: The random number stream to use for picking a location.
+  // new_x: The x coordinate of the object's new position.
+  // new_y: The y coordinate of the object's new position.
+  // cache: If this is not nullptr, it gets updated so that MoveObject() can
+  // reuse the distribution later.
+  // mover: The object that is moving, like in MoveObject().
+  // exclude: Cells that won't be picked, like in MoveObject().
+  void FinishMove(MoveRequest *request, Random *random, int *new_x,
+                  int *new_y, MovementCache *cache = nullptr,
+                  const GridObject *mover = nullptr,
+                  const ExclusionMask *exclude = nullptr);
+  // Excludes every cell in a mask's neighborhood that something is pending
+  // insertion at, including the center.
+  // mask: The mask to add the cells to.
+  void ExcludePending(ExclusionMask *mask);
+  // Records that an object has been moved a certain distance away from its
+  // baked position. This is used to keep track of how much the baked positions
+  // of the members of each species could have possibly changed.
+  // species: The object's species, or -1 if it doesn't have one.
+  // distance: The distance the object moved, in cells.
+  void RecordDisplacement(int species, double distance) {
+    if (species + 1 >= static_cast<int>(tick_displacements_.size())) {
+      tick_displacements_.resize(species + 2, 0);
+    }
+    double &displacement = tick_displacements_[species + 1];
+    displacement = ::std::max(displacement, distance);
+  }
+  // Only changes when Update() is called, so the difference between two
+  // readings is an upper bound on how far the baked position of any member of
+  // the species could have changed in between them. Things moving around in
+  // other species don't affect it.
+  // species: The species, or -1 for objects that don't have one.
+  // Returns: An upper bound on the total distance that any single member of a
+  // species has moved since the grid was created.
+  double motion_bound(int species) const {
+    return species + 1 < static_cast<int>(motion_bounds_.size())
+               ? motion_bounds_[species + 1]
+               : 0;
+  }
   // "Bakes" the state of the grid. Commits any new changes that were made since
   // the last time this was called to the actual grid. Also un-blacklists all
   // cells on the grid.
   // Returns: false if any cell on the grid remains in a conflicted state. All
   // conflicts must be resolved before running this.
   bool Update();
-  // Populates two lists with the objects currently involved in conflicts on the
+  // Gives an object a slot in baked_positions(). Slots that have been freed
+  // get reused.
+  // object: The object.
+  // Returns: The slot.
+  int AddSlot(GridObject *object);
+  // Frees a slot that AddSlot() gave out.
+  // slot: The slot.
+  void FreeSlot(int slot);
+  // Forgets where an object was baked, because it's been removed from the
   // grid.
+  // slot: The object's slot.
+  void ClearBakedPosition(int slot) {
+    baked_positions_.xs[slot] = -1;
+    baked_positions_.ys[slot] = -1;
+  }
+  // Returns: Where everything was baked at the last update. Moving things
+  // doesn't change this until Update() is called, so it's safe to read while
+  // things are moving. Things that get removed from the grid are cleared right
+  // away though, so that nothing keeps reacting to them.
+  const BakedPositions &baked_positions() const { return baked_positions_; }
+  // slot: A slot that AddSlot() gave out.
+  // Returns: The object in the slot, or nullptr if it's free.
+  GridObject *GetSlotObject(int slot) const { return slot_objects_[slot]; }
+  // slot: A slot that AddSlot() gave out.
+  // Returns: A handle to whatever is in the slot right now.
+  ObjectHandle GetHandle(int slot) const {
+    return (baked_positions_.generations[slot] << kHandleSlotBits) | slot;
+  }
+  // Looks up the object that a handle refers to.
+  // handle: The handle.
+  // Returns: The object, or nullptr if it's gone.
+  GridObject *ResolveHandle(ObjectHandle handle) const;
+  // Finds every member of a species that was baked within a certain distance of
+  // a location at the last update, and is still on the grid. Members are looked
+  // up in an index that gets rebuilt by Update(), so this only has to look at
+  // the parts of the grid that are close enough.
+  // species: The species to look for.
+  // x: The x coordinate of the location.
+  // y: The y coordinate of the location.
+  // radius: The maximum distance in cells. A negative value means that there is
+  // no limit.
+  // slots: Gets filled with the slots of the members that we found.
+  void FindSpecies(int species, int x, int y, int radius,
+                   ::std::vector<int> *slots) const;
+  // Tells the grid that an object's species has changed, so that anything
+  // built from FindSpecies() needs to be built again after the next update.
+  void InvalidateSpeciesIndex() { species_index_dirty_ = true; }
+  // Returns: A number that changes whenever an update adds a species member
+  // that FindSpecies() couldn't find before. Members that get removed are
+  // skipped by FindSpecies() right away, so they don't change it.
+  uint32_t species_version() const { return species_version_; }
+  // Returns: The movement factors that members of each species feel from
+  // members of other species.
+  SpeciesFactors *species_factors() { return &species_factors_; }
+  // Populates two lists with the objects currently involved in conflicts on the
+  // grid. If more than two objects are trying to move to the same cell, the
+  // one pending insertion there shows up once for each of the others.
   // objects1: The first set of objects.
   // objects2: The second set of objects. Each object in this vector is
   // conflicted with the object at the same index in objects1.
   void GetConflicted(::std::vector<GridObject *> *objects1,
                      ::std::vector<GridObject *> *objects2);
+  // Settles every conflict on the grid according to a policy, without needing
+  // anything from outside the grid. Every object trying to move to a cell gets
+  // settled against the current winner in turn, so a cell is completely
+  // sorted out in one round no matter how many things want it. Settling one
+  // conflict can cause another somewhere else though, so this goes in rounds
+  // until there's nothing left to do.
+  // policy: Decides how each conflict gets settled.
+  // results: Filled in with what happened.
+  // max_rounds: The most rounds to run before giving up.
+  // Returns: true if the only conflicts left are ones marked kCustom.
+  bool ResolveConflicts(const ConflictPolicy &policy, ConflictResults *results,
+                        int max_rounds = 8);
+  // Sets the seed that all the random numbers in the simulation are derived
+  // from.
+  // seed: The new seed.
+  void set_seed(uint64_t seed) { seed_ = seed; }
+  // Returns: The seed for the simulation.
+  uint64_t seed() const { return seed_; }
+  // Returns: The number of times that Update() has succeeded, which is the
+  // current iteration of the simulation.
+  uint32_t tick() const { return tick_; }
+  // Returns: The counters for this grid.
+  const GridStats &stats() const { return stats_; }
+  // Sets all the counters for this grid back to zero.
+  void ResetStats() { stats_ = GridStats(); }
   // Returns the current scale of the grid.
   double scale() const { return grid_scale_; }
   // Sets the scale of the grid.
@@ -171,19 +652,126 @@ class Grid {
     // automatically overrides it, but setting this flag makes it conflict
     // instead.
     bool RequestStasis;
+    // If more than two objects are trying to move here, the index in
+    // contenders_ of the first one after ConflictedObject. Otherwise -1.
+    int Contenders;
+  };
+
+  // An extra object that is trying to move to a cell which already has a
+  // conflict. Each cell keeps a linked list of these.
+  struct Contender {
+    GridObject *Object;
+    // The index in contenders_ of the next one for the same cell, or -1.
+    int Next;
   };
 
+  // Checks whether an object is conflicted at a cell.
+  // cell: The cell to check.
+  // object: The object to check for.
+  // Returns: true if it is conflicted there.
+  bool IsContending(const Cell &cell, const GridObject *object) const;
+  // Gets everything that is trying to move to a cell. See the public version.
+  // cell: The cell.
+  // contenders: Filled in with everything trying to move there.
+  void GetContenders(const Cell &cell,
+                     ::std::vector<GridObject *> *contenders) const;
+  // Takes the first extra contender off a cell's list.
+  // cell: The cell.
+  // Returns: The contender, or nullptr if there aren't any.
+  GridObject *PopContender(Cell *cell);
+  // Settles a single conflict according to a policy. (See ResolveConflicts().)
+  // policy: Decides how to settle it.
+  // holder: The object that currently looks like it gets the cell.
+  // challenger: The object conflicted with it.
+  // results: Gets any meals added to it.
+  // stats: Gets updated with what happened.
+  // Returns: Whichever of them gets to stay, or holder if neither of them
+  // moved.
+  GridObject *SettleConflict(const ConflictPolicy &policy, GridObject *holder,
+                             GridObject *challenger, ConflictResults *results,
+                             ConflictRound *stats);
+
+  // Rebuilds the index that FindSpecies() uses, from the baked positions.
+  void BuildSpeciesIndex();
+
+  // The actual implementations of MoveObject() and MoveObjectSampled(). These
+  // get instantiated once for every type of kernel, so the kernel's Weight()
+  // can get inlined into the inner loops.
+  // kernel: The kernel to use.
+  // See the public versions for the other arguments.
+  template <class Kernel>
+  bool MoveObjectWith(const Kernel &kernel, int x, int y,
+                      const FactorSet &factors,
+                      Random *random, int *new_x, int *new_y, int levels,
+                      int vision, const KernelSpec &spec,
+                      MovementCache *cache, const GridObject *mover,
+                      const ExclusionMask *exclude);
+  // Picks a location from a cache, renormalizing the weights first if the
+  // availability of any of the locations has changed since last time.
+  // cache: The cache to pick from. Its inputs and weights must be filled in.
+  // random: The random number stream to use.
+  // new_x: The x coordinate of the location we picked.
+  // new_y: The y coordinate of the location we picked.
+  // mover: The object that is moving. Can be nullptr.
+  // exclude: Cells that can't be picked. Can be nullptr.
+  // Returns: true if it had to renormalize.
+  bool PickLocation(MovementCache *cache, Random *random, int *new_x,
+                    int *new_y, const GridObject *mover,
+                    const ExclusionMask *exclude);
+  template <class Kernel>
+  bool MoveObjectSampledWith(const Kernel &kernel, int x, int y,
+                             const FactorSet &factors,
+                             Random *random, int *new_x, int *new_y,
+                             int levels, int vision, int samples,
+                             const GridObject *mover,
+                             const ExclusionMask *exclude);
+  // Gets the weight table for an exponential kernel, building it if nobody has
+  // asked for one with this scale lately. Only the kMaxExponentialTables that
+  // were used most recently are kept around.
+  // scale: The scale of the kernel.
+  // Returns: The table. It stays valid until the next call.
+  DistanceTable *GetExponentialTable(double scale);
+  // Gets a table kernel that is ready to use for factors and locations up to a
+  // certain distance apart, making the table bigger if it has to.
+  // kernel: The kernel. It has to be one that uses a table.
+  // distance_squared: The biggest squared distance that will be looked up. The
+  // table covers it if it can, and anything past that is calculated directly.
+  // Returns: The kernel.
+  movement_kernel::TableKernel GetTableKernel(const KernelSpec &kernel,
+                                              int64_t distance_squared);
+  // Works out how far apart a location that an object can move to and a
+  // factor that it can see can be.
+  // levels: The size of the neighborhood.
+  // vision: The object's vision, or -1 if it is unlimited.
+  // Returns: The biggest squared distance between them.
+  int64_t GetReachSquared(int levels, int vision) const;
   // Calculates the probability of moving to every square in the extended
-  // neighborhood.
-  // factors: a vector of factors in the grid, which are used to calculate the
+  // neighborhood, using a particular kernel.
+  // kernel: The kernel to use.
+  // See the other version for the rest of the arguments.
+  template <class Kernel>
+  void CalculateProbabilities(const Kernel &kernel,
+                              const FactorSet &factors,
+                              const ::std::vector<int> &xs,
+                              const ::std::vector<int> &ys,
+                              double *probabilities);
+  // Calculates the probability of moving to every square in the extended
+  // neighborhood, using the default kernel.
+  // factors: The factors in the grid, which are used to calculate the
   // probabilities.
   // xs: The x coordinates of the locations in the neighborhood.
   // ys: The y coordinates of the locations in the neighborhood.
   // probabilities: an array of probability values. Should be an array capable
   // of holding a number of items equal to the size of the xs and ys vectors.
-  void CalculateProbabilities(::std::list<MovementFactor> &factors,
-                              const ::std::list<int> &xs,
-                              const ::std::list<int> &ys,
+  void CalculateProbabilities(const FactorSet &factors,
+                              const ::std::vector<int> &xs,
+                              const ::std::vector<int> &ys,
+                              double *probabilities);
+  // Turns raw factor weights into probabilities that add up to one.
+  // num_factors: How many factors the weights came from.
+  // size: How many weights there are.
+  // probabilities: The weights, which get replaced with probabilities.
+  void NormalizeProbabilities(int num_factors, int size,
                               double *probabilities);
   // Gets the locations that are in a neighborhood.
   // If any locations that should be in the neighborhood are outside the bounds
@@ -200,34 +788,46 @@ class Grid {
   // surrounding them. etc.
   // Returns: true if it succeeds, false if the grid is not initialized, or if
   // the neighborhood would be out of its bounds.
-  bool GetNeighborhoodLocations(int x, int y, ::std::list<int> *xs,
-                                ::std::list<int> *ys, int levels = 1);
+  bool GetNeighborhoodLocations(int x, int y, ::std::vector<int> *xs,
+                                ::std::vector<int> *ys, int levels = 1);
   // Takes a set of probabilities, and uses them to calculate where an object
   // should move in its neighborhood.
-  // probabilities: The array of probabilities for each location, generally
-  // should be the one produced by CalculateProbabilities.
+  // sampler: A sampler for the probabilities of each location, generally
+  // the ones produced by CalculateProbabilities.
   // xs: The x coordinates of the locations in the neighborhood. Should be the
   // same one as was passed to CalculateProbabilities.
   // ys: The y coordinates of the locations in the neighborhood. Should be the
   // same one as was passed to CalculateProbabilities.
+  // random: A random number in [0, 1) that determines the location we pick.
   // new_x: The x coordinate of the organism's new location.
   // new_y: The y coordinate of the organism's new location.
-  void DoMovement(const double *probabilities, const ::std::list<int> &xs,
-                  const ::std::list<int> &ys, int *new_x, int *new_y);
-  // Looks at factor visibilities and removes any that are not visible to the
-  // object.
-  // x: The x coordinate of the objects's position.
-  // y: The y coordinate of the objects's position.
-  // factors: The vector of factors that we will be processing.
-  // vision: Maximum distance we can be from a factor in cells, and still
-  // perceive it. A negative value means that there is no limit.
-  void RemoveInvisible(int x, int y, ::std::list<MovementFactor> *factors,
-                       int vision);
+  void DoMovement(DiscreteSampler *sampler, const ::std::vector<int> &xs,
+                  const ::std::vector<int> &ys, double random, int *new_x,
+                  int *new_y);
   // Removes any cells for which the Blacklisted attribute is set to true or
   // which are conflicted from consideration for movement.
   // xs: The x coordinates of the cells to consider.
   // ys: The y coordinates of the cells to consider.
-  void RemoveUnusable(::std::list<int> *xs, ::std::list<int> *ys);
+  void RemoveUnusable(::std::vector<int> *xs, ::std::vector<int> *ys);
+
+  // Figures out how much an object wants to move to a cell, based only on
+  // what's going on at that cell.
+  // x: The x coordinate of the cell.
+  // y: The y coordinate of the cell.
+  // mover: The object that is moving. Can be nullptr.
+  // exclude: Cells that the mover can't use. Can be nullptr.
+  // Returns: 0 if the cell is unusable, a multiplier from the mover if
+  // something else is pending insertion there, and 1 otherwise.
+  double GetAvailability(int x, int y, const GridObject *mover,
+                         const ExclusionMask *exclude);
+  // Checks whether something could move to a cell.
+  // x: The x coordinate of the cell.
+  // y: The y coordinate of the cell.
+  // Returns: false if the cell is blacklisted or conflicted, true otherwise.
+  bool IsUsable(int x, int y) const {
+    const Cell &cell = grid_[x * x_size_ + y];
+    return !cell.Blacklisted && !cell.ConflictedObject;
+  }
 
   // Returns whether or not the underlying array is initialized.
   bool IsInitialized() { return initialized_; }
@@ -239,8 +839,63 @@ class Grid {
   int y_size_;
   // A pointer to the underlying grid array.
   Cell *grid_;
+  // The object in each slot, or nullptr for slots that are free.
+  ::std::vector<GridObject *> slot_objects_;
+  // Slots that can be given out again.
+  ::std::vector<int> free_slots_;
+  // Where everything was baked at the last update.
+  BakedPositions baked_positions_;
+  // The slots of the members of every species that were baked at the last
+  // update, bucketed by species and by which tile of the grid they were in.
+  // The members in bucket b are at species_slots_[species_offsets_[b]] up to
+  // species_slots_[species_offsets_[b + 1]].
+  ::std::vector<int> species_offsets_;
+  ::std::vector<int> species_slots_;
+  // How many species the index has buckets for.
+  int indexed_species_ = 0;
+  // Whether something has happened that the index needs to be rebuilt for.
+  bool species_index_dirty_ = false;
+  // See species_version().
+  uint32_t species_version_ = 0;
+  // The factors that members of each species feel from other species.
+  SpeciesFactors species_factors_;
+  // Storage for the extra contenders of every cell. It only grows during a
+  // tick, and gets cleared when the grid is updated.
+  ::std::vector<Contender> contenders_;
   // The size of one side of a grid square.
   double grid_scale_ = -1;
+  // Movement factor weights for every distance on the grid, for the default
+  // kernel.
+  DistanceTable weight_table_;
+  // A weight table for an exponential kernel.
+  struct ExponentialTable {
+    ::std::unique_ptr<DistanceTable> table;
+    // The value of exponential_table_uses_ the last time it was used.
+    uint64_t last_use;
+  };
+  // The most exponential tables that we keep at once.
+  static constexpr int kMaxExponentialTables = 8;
+  // Weight tables for exponential kernels, indexed by scale.
+  ::std::map<double, ExponentialTable> exponential_tables_;
+  // How many times an exponential table has been asked for.
+  uint64_t exponential_table_uses_ = 0;
+  // The farthest that any one member of each species has moved since the last
+  // update, indexed by species + 1, so that objects without a species go
+  // first.
+  ::std::vector<double> tick_displacements_;
+  // The sum of tick_displacements_ over all the updates so far, indexed the
+  // same way.
+  ::std::vector<double> motion_bounds_;
+  // The indices of the factors that are visible for the move we're working on.
+  // This keeps its capacity between moves, so that finding them doesn't
+  // allocate anything.
+  ::std::vector<int> visible_;
+  // The seed for all the random numbers in the simulation.
+  uint64_t seed_ = 0;
+  // How many times we've been updated.
+  uint32_t tick_ = 0;
+  // Counters for profiling.
+  GridStats stats_;
 };
 
 }  // namespace automata
@@ -1,22 +1,36 @@
 #include <assert.h>
-#include <stdio.h>  // TEMP
+#include <math.h>
 
 #include "grid_object.h"
 
 namespace automata {
 
-GridObject::GridObject(Grid *grid, int index) : index_(index), grid_(grid) {}
+GridObject::GridObject(Grid *grid, int index)
+    : GridObject(grid, index, kObject) {}
+
+GridObject::GridObject(Grid *grid, int index, Kind kind)
+    : index_(index),
+      grid_(grid),
+      kind_(kind),
+      slot_(grid->AddSlot(this)),
+      handle_(grid->GetHandle(slot_)) {}
 
 GridObject::~GridObject() {
+  if (!grid_) {
+    // The grid is already gone, and it took everything with it.
+    return;
+  }
+
   // Technically, this can return false, but there's not much to do about it if
   // it does.
   RemoveFromGrid();
+  grid_->FreeSlot(slot_);
 }
 
 bool GridObject::RemoveFromGrid() {
   if (on_grid_) {
     if (grid_->GetPending(x_, y_) == this ||
-        grid_->GetConflict(x_, y_) == this) {
+        grid_->IsContending(x_, y_, this)) {
       // If it hasn't been updated yet, we need to get rid of ourselves at the
       // new location.
       if (!grid_->PurgeNew(x_, y_, this)) {
@@ -25,6 +39,8 @@ bool GridObject::RemoveFromGrid() {
     }
 
 		on_grid_ = false;
+    // Nothing should react to us anymore.
+    grid_->ClearBakedPosition(slot_);
 
     int baked_x, baked_y;
     if (!GetBakedPosition(&baked_x, &baked_y)) {
@@ -48,7 +64,7 @@ bool GridObject::SetPosition(int x, int y) {
   // Set ourselves at our new location.
   bool conflicted = false;
   if (!grid_->SetOccupant(x, y, this)) {
-    if (grid_->GetConflict(x, y) == this) {
+    if (grid_->IsContending(x, y, this)) {
       // We're conflicted.
       conflicted = true;
     } else {
@@ -66,18 +82,24 @@ bool GridObject::SetPosition(int x, int y) {
     return !conflicted;
   }
 
-  printf("New position: (%d, %d)\n", x, y);
-  printf("Old position: (%d, %d)\n", x_, y_);
+  // Let the grid know how far we're going to end up from where we're baked, so
+  // that anyone caching things based on our position knows to check again.
+  int baked_x, baked_y;
+  if (GetBakedPosition(&baked_x, &baked_y)) {
+    grid_->RecordDisplacement(species_, hypot(x - baked_x, y - baked_y));
+  }
   // We have to remove ourself from our old location on the grid.
-  if (grid_->GetPending(x_, y_) == this || grid_->GetConflict(x_, y_) == this) {
+  if (grid_->GetPending(x_, y_) == this || grid_->IsContending(x_, y_, this)) {
     // The grid hasn't been updated since the last time we set the position.
-    assert(grid_->PurgeNew(x_, y_, this) &&
-           "PurgeNew() should not return false.");
+    const bool purged = grid_->PurgeNew(x_, y_, this);
+    assert(purged && "PurgeNew() should not return false.");
+    (void)purged;
   } else {
     // The grid has been updated.
     // It's pretty hard for SetOccupant with nullptr to fail...
-    assert(grid_->SetOccupant(x_, y_, nullptr) &&
-           "SetOccupant() failing on nullptr.");
+    const bool cleared = grid_->SetOccupant(x_, y_, nullptr);
+    assert(cleared && "SetOccupant() failing on nullptr.");
+    (void)cleared;
     last_x_ = x_;
     last_y_ = y_;
   }
@@ -111,7 +133,7 @@ bool GridObject::GetBakedPosition(int *x, int *y) {
 GridObject *GridObject::GetConflict() {
   if (grid_->GetPending(x_, y_) == this) {
     return grid_->GetConflict(x_, y_);
-  } else if (grid_->GetConflict(x_, y_) == this) {
+  } else if (grid_->IsContending(x_, y_, this)) {
     return grid_->GetPending(x_, y_);
   } else {
     return nullptr;
@@ -9,6 +9,16 @@ namespace automata {
 // A simple superclass that represents all objects on the grid.
 class GridObject {
  public:
+  // What sort of thing an object is. This gets set at construction and never
+  // changes, so code that only has a GridObject can check it and then use
+  // static_cast instead of dynamic_cast.
+  enum Kind {
+    // A plain GridObject.
+    kObject = 0,
+    // An Organism.
+    kOrganism = 1,
+  };
+
   // grid:  The grid that this object will exist in.
   // index: The object's index in the Python code.
   // x: The x coordinate of the object's position.
@@ -31,6 +41,26 @@ class GridObject {
   void set_index(int index) { index_ = index; }
   // Returns: The organism's index in the Python code.
   int get_index() const { return index_; };
+  // Sets which species the object belongs to. The grid uses this to decide how
+  // to settle conflicts. (See Grid::ResolveConflicts().)
+  // species: An identifier for the species. Objects of the same species
+  // should all use the same one.
+  void set_species(int species) {
+    species_ = species;
+    grid_->InvalidateSpeciesIndex();
+  }
+  // Returns: The object's species, or -1 if it was never set.
+  int get_species() const { return species_; }
+  // Returns: What sort of thing we are.
+  Kind kind() const { return kind_; }
+  // Returns: The grid that we're on.
+  Grid *get_grid() const { return grid_; }
+  // Returns: Where the grid keeps our baked position in its
+  // baked_positions(). This stays the same for as long as we exist.
+  int slot() const { return slot_; }
+  // Returns: A handle that refers to us, and goes stale once we're destroyed.
+  // (See Grid::ResolveHandle().)
+  ObjectHandle handle() const { return handle_; }
   // Set the position of the object.
   // x: The x coordinate of the object's position.
   // y: The y coordinate of the object's position.
@@ -54,12 +84,32 @@ class GridObject {
   // Removes the object from the grid. It is okay to call this function more
   // than once.
   bool RemoveFromGrid();
+  // Decides how willing we are to move to a cell that something else is
+  // already pending insertion at. Moving there anyway causes a conflict.
+  // occupant: The object pending insertion at the cell.
+  // Returns: A multiplier for the probability of moving there. 1 means that we
+  // don't mind, and 0 means that we won't go there at all.
+  virtual double PendingWeight(const GridObject *occupant) const {
+    return 1.0;
+  }
+  // Picks somewhere else to move to after losing a conflict, starting from
+  // wherever the object is baked.
+  // Returns: true if it found somewhere to go. The default implementation
+  // can't move anywhere, so it always returns false.
+  virtual bool Relocate() { return false; }
   // Figures out who we're conflicted with.
   // Returns: A pointer to the object we are conflicted with, or nullptr if we
-  // are not conflicted with anybody.
+  // are not conflicted with anybody. If we're pending insertion and more than
+  // one object is conflicted with us, this is the first of them.
   GridObject *GetConflict();
 
  protected:
+  // Constructor for subclasses, which have to say what kind they are.
+  // grid: The grid that this object will exist in.
+  // index: The object's index in the Python code.
+  // kind: What kind of object it is.
+  GridObject(Grid *grid, int index, Kind kind);
+
   // x and y coordinates of the object's position, present and past, index of
   // the object in the Python code.
   int x_, y_, index_;
@@ -71,9 +121,21 @@ class GridObject {
 
   // Whether we are on the grid or not.
   bool on_grid_ = false;
+  // Which species we belong to.
+  int species_ = -1;
 
  private:
+  // The grid clears grid_ when it gets destroyed before we do.
+  friend class Grid;
+
   DISSALOW_COPY_AND_ASSIGN(GridObject);
+
+  // What sort of thing we are.
+  const Kind kind_;
+  // Our slot in the grid's baked positions.
+  int slot_;
+  // A handle to us.
+  ObjectHandle handle_;
 };
 
 }  //  automata
@@ -14,8 +14,9 @@ class AnimalMetabolism : public Metabolism {
   // body_temp: The body temperature of the animal. (K)
   // scale: The scale of the animal. (m)
   // drag_coefficient: The drag coefficient of the animal in air.
+  // pool: The pool to keep our state in, or nullptr to get one to ourselves.
   AnimalMetabolism(double mass, double fat_mass, double body_temp, double scale,
-                   double drag_coefficient);
+                   double drag_coefficient, MetabolismPool *pool = nullptr);
   virtual ~AnimalMetabolism() = default;
 
   virtual void Update(int time);
@@ -30,18 +31,6 @@ class AnimalMetabolism : public Metabolism {
   // time: Time it took us to move that distance. (s)
   void Move(double distance, int time);
 
- private:
-  // Updates the basal metabolic rate based on the current mass.
-  void UpdateBasalRate();
-
-  // Basal metabolic rate. (W/kg)
-  double basal_rate_;
-  // Body temperature of organism. (K)
-  double body_temp_;
-  // Scale of the organism. (m)
-  double scale_;
-  // Air drag coefficient of the organism.
-  double drag_coefficient_;
 };
 
 }  // namespace metabolism
@@ -0,0 +1,62 @@
+#include "automata/metabolism/biomass_field.h"
+#include "automata/metabolism/plant_constants.h"
+
+namespace automata {
+namespace metabolism {
+
+BiomassField::BiomassField(int x_size, int y_size, double mass,
+                           double max_mass, double efficiency,
+                           double area_mean, double cellulose,
+                           double hemicellulose, double lignin)
+    : x_size_(x_size), y_size_(y_size), max_mass_(max_mass) {
+  // This is all the same as for a single plant. See MetabolismPool.
+  const double usable = 1 - (cellulose + hemicellulose + lignin);
+  const double power = area_mean * kSolarEnergy * efficiency;
+  mass_rate_ = power / kPhotosynthesisDeltaG * kGlucoseMolecularMass / 1000.0;
+  energy_per_mass_ =
+      kPhotosynthesisDeltaG / kGlucoseMolecularMass * 1000.0 * usable;
+
+  const double max_energy =
+      (mass * 1000) / kGlucoseMolecularMass * -kRespirationDeltaG;
+  mass_.assign(x_size * y_size, mass);
+  energy_.assign(x_size * y_size, max_energy * usable);
+}
+
+void BiomassField::Update(int time) {
+  const double mass_gain = mass_rate_ * time;
+  const double max_mass = max_mass_;
+  const double energy_per_mass = energy_per_mass_;
+
+  double *mass = mass_.data();
+  double *energy = energy_.data();
+  const int size = mass_.size();
+  // Every cell grows by the same amount until it fills up, so this is just
+  // arithmetic and clamping on contiguous arrays, which the compiler can turn
+  // into vector instructions.
+  for (int i = 0; i < size; ++i) {
+    const double room = max_mass - mass[i];
+    double gain = mass_gain < room ? mass_gain : room;
+    gain = gain > 0 ? gain : 0;
+    mass[i] += gain;
+    energy[i] += gain * energy_per_mass;
+  }
+}
+
+double BiomassField::Graze(int x, int y, double fraction) {
+  const int index = Index(x, y);
+  const double eaten = energy_[index] * fraction;
+  mass_[index] -= mass_[index] * fraction;
+  energy_[index] -= eaten;
+  return eaten;
+}
+
+double BiomassField::total_mass() const {
+  double total = 0;
+  for (double mass : mass_) {
+    total += mass;
+  }
+  return total;
+}
+
+}  // namespace metabolism
+}  // namespace automata
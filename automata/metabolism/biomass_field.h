@@ -0,0 +1,76 @@
+#ifndef ECOSYSTEM_AUTOMATA_METABOLISM_BIOMASS_FIELD_H_
+#define ECOSYSTEM_AUTOMATA_METABOLISM_BIOMASS_FIELD_H_
+
+#include <vector>
+
+#include "automata/macros.h"
+
+namespace automata {
+namespace metabolism {
+
+// Simulates plants that cover the ground, like grass, as one amount of biomass
+// per grid cell instead of as individual organisms. Cells grow the same way
+// that a PlantMetabolism does, except that each one averages over so many
+// tufts that the random leaf area is left out, and they stop growing once they
+// get as dense as the species allows. Animals graze on the cell that they are
+// standing in.
+class BiomassField {
+ public:
+  // x_size: The horizontal size of the field, in cells.
+  // y_size: The vertical size of the field, in cells.
+  // mass: The initial plant mass in each cell. (kg)
+  // max_mass: The most plant mass that a cell can hold. (kg)
+  // efficiency: Efficiency of photosynthesis. See PlantMetabolism.
+  // area_mean: Leaf area exposed to sunlight in each cell. (m^2)
+  // cellulose: Percent of dry biomass that is cellulose.
+  // hemicellulose: Percent of dry biomass that is hemicellulose.
+  // lignin: Percent of dry biomass that is lignin.
+  BiomassField(int x_size, int y_size, double mass, double max_mass,
+               double efficiency, double area_mean, double cellulose,
+               double hemicellulose, double lignin);
+
+  // Grows every cell.
+  // time: How much time passed. (s)
+  void Update(int time);
+  // Eats part of the plants in a cell.
+  // x: The x coordinate of the cell.
+  // y: The y coordinate of the cell.
+  // fraction: How much of what is there to eat, between 0 and 1.
+  // Returns: The energy that was eaten. (J)
+  double Graze(int x, int y, double fraction);
+
+  // Returns: The plant mass in a cell. (kg)
+  double mass(int x, int y) const { return mass_[Index(x, y)]; }
+  // Returns: The usable energy stored in a cell. (J)
+  double energy(int x, int y) const { return energy_[Index(x, y)]; }
+  // Returns: The total plant mass in the field. (kg)
+  double total_mass() const;
+
+  int x_size() const { return x_size_; }
+  int y_size() const { return y_size_; }
+
+ private:
+  DISSALOW_COPY_AND_ASSIGN(BiomassField);
+
+  // Returns: The index in the arrays of a cell.
+  int Index(int x, int y) const { return x * y_size_ + y; }
+
+  int x_size_;
+  int y_size_;
+  double max_mass_;
+  // How much mass a cell gains per second while it has room to grow. (kg/s)
+  double mass_rate_;
+  // The usable energy that comes along with each kg of growth. (J/kg)
+  double energy_per_mass_;
+
+  // The mass and energy in each cell. These are double precision, because
+  // each tick's growth is tiny compared to what is already there, and would
+  // mostly get rounded away in single precision.
+  ::std::vector<double> mass_;
+  ::std::vector<double> energy_;
+};
+
+}  // namespace metabolism
+}  // namespace automata
+
+#endif  // ECOSYSTEM_AUTOMATA_METABOLISM_BIOMASS_FIELD_H_
@@ -0,0 +1,91 @@
+#include "gtest/gtest.h"
+
+#include "automata/metabolism/biomass_field.h"
+#include "automata/metabolism/plant_metabolism.h"
+
+namespace automata {
+namespace metabolism {
+
+class BiomassFieldTest : public ::testing::Test {
+ public:
+  BiomassFieldTest()
+      : field_(kXSize, kYSize, kInitialMass, kMaxMass, 0.02, 0.1,
+               kPercentCellulose, kPercentHemicellulose, kPercentLignin) {}
+
+ protected:
+  static constexpr int kXSize = 7;
+  static constexpr int kYSize = 5;
+  static constexpr double kInitialMass = 0.01;
+  static constexpr double kMaxMass = 0.0101;
+  static constexpr double kPercentCellulose = 0.4;
+  static constexpr double kPercentHemicellulose = 0.3;
+  static constexpr double kPercentLignin = 0.2;
+
+  BiomassField field_;
+};
+
+// Does a cell grow the same way as a single plant with a fixed leaf area?
+TEST_F(BiomassFieldTest, GrowthTest) {
+  PlantMetabolism plant(kInitialMass, 0.02, 0.1, 0.0, kPercentCellulose,
+                        kPercentHemicellulose, kPercentLignin);
+  EXPECT_FLOAT_EQ(plant.mass(), field_.mass(0, 0));
+  EXPECT_FLOAT_EQ(plant.energy(), field_.energy(0, 0));
+
+  plant.Update(10);
+  field_.Update(10);
+  for (int x = 0; x < kXSize; ++x) {
+    for (int y = 0; y < kYSize; ++y) {
+      EXPECT_DOUBLE_EQ(plant.mass(), field_.mass(x, y));
+      EXPECT_DOUBLE_EQ(plant.energy(), field_.energy(x, y));
+    }
+  }
+}
+
+// Does growth over a lot of short ticks keep up with a single plant?
+TEST_F(BiomassFieldTest, LongGrowthTest) {
+  PlantMetabolism plant(kInitialMass, 0.02, 0.1, 0.0, kPercentCellulose,
+                        kPercentHemicellulose, kPercentLignin);
+  // Make it big enough that nothing fills up.
+  BiomassField field(1, 1, kInitialMass, 100, 0.02, 0.1, kPercentCellulose,
+                     kPercentHemicellulose, kPercentLignin);
+  for (int i = 0; i < 80000; ++i) {
+    plant.Update(10);
+    field.Update(10);
+  }
+
+  EXPECT_NEAR(plant.mass(), field.mass(0, 0), plant.mass() * 1e-9);
+  EXPECT_NEAR(plant.energy(), field.energy(0, 0), plant.energy() * 1e-9);
+}
+
+// Do cells stop growing once they are full?
+TEST_F(BiomassFieldTest, MaxMassTest) {
+  for (int i = 0; i < 1000; ++i) {
+    field_.Update(10);
+  }
+  EXPECT_DOUBLE_EQ(kMaxMass, field_.mass(3, 2));
+  const double energy = field_.energy(3, 2);
+  field_.Update(10);
+  EXPECT_EQ(energy, field_.energy(3, 2));
+  EXPECT_NEAR(kMaxMass * kXSize * kYSize, field_.total_mass(), 1e-6);
+}
+
+// Does grazing take from just the one cell, and does it grow back?
+TEST_F(BiomassFieldTest, GrazeTest) {
+  const double energy = field_.energy(6, 4);
+  EXPECT_FLOAT_EQ(energy * 0.25, field_.Graze(6, 4, 0.25));
+  EXPECT_FLOAT_EQ(energy * 0.75, field_.energy(6, 4));
+  EXPECT_FLOAT_EQ(kInitialMass * 0.75, field_.mass(6, 4));
+  EXPECT_FLOAT_EQ(energy, field_.energy(4, 4));
+
+  // Eating everything leaves nothing.
+  field_.Graze(6, 4, 1.0);
+  EXPECT_EQ(0, field_.mass(6, 4));
+  EXPECT_EQ(0, field_.energy(6, 4));
+
+  field_.Update(10);
+  EXPECT_GT(field_.mass(6, 4), 0);
+  EXPECT_GT(field_.energy(6, 4), 0);
+}
+
+}  // namespace metabolism
+}  // namespace automata
@@ -0,0 +1,159 @@
+#ifndef ECOSYSTEM_AUTOMATA_METABOLISM_FAST_MATH_H_
+#define ECOSYSTEM_AUTOMATA_METABOLISM_FAST_MATH_H_
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// Approximations of transcendental functions that are built only out of
+// arithmetic, comparisons and bit manipulation. There are no branches or
+// library calls, and every step has an exact counterpart in the vector
+// instruction sets, so the vectorized kernels can do exactly the same thing
+// four or eight values at a time and get bit-for-bit the same answers.
+
+namespace automata {
+namespace metabolism {
+namespace fast_math {
+
+constexpr double kLn2 = 0.693147180559945309417;
+constexpr double kLn10 = 2.302585092994045684018;
+constexpr double kSqrt2 = 1.4142135623730951;
+constexpr double kTwoPi = 6.283185307179586477;
+
+// Coefficients of the series for log(m) / (2 * s), in powers of s^2, where
+// s = (m - 1) / (m + 1).
+constexpr double kLogSeries[] = {1.0,       1.0 / 3, 1.0 / 5,
+                                 1.0 / 7,   1.0 / 9, 1.0 / 11};
+constexpr int kLogSeriesLength = 6;
+// Coefficients of the Taylor series for cos(a), in powers of -a^2.
+constexpr double kCosSeries[] = {
+    1.0,           1.0 / 2,         1.0 / 24,         1.0 / 720,
+    1.0 / 40320,   1.0 / 3628800,   1.0 / 479001600,  1.0 / 87178291200,
+    1.0 / 20922789888000};
+constexpr int kCosSeriesLength = 9;
+
+// Natural log, for positive, finite, normal numbers. The relative error is
+// around 1e-11.
+inline double Log(double x) {
+  uint64_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  // Split x into mantissa * 2^exponent, with the mantissa in [1, 2).
+  double exponent = static_cast<int32_t>(bits >> 52) - 1023;
+  bits = (bits & 0x000FFFFFFFFFFFFFull) | 0x3FF0000000000000ull;
+  double mantissa;
+  memcpy(&mantissa, &bits, sizeof(mantissa));
+  // Move the mantissa into [sqrt(1/2), sqrt(2)), where the series converges
+  // fastest.
+  const bool big = mantissa > kSqrt2;
+  mantissa = big ? mantissa * 0.5 : mantissa;
+  exponent = big ? exponent + 1.0 : exponent;
+
+  // log(m) = 2 * atanh((m - 1) / (m + 1)).
+  const double s = (mantissa - 1.0) / (mantissa + 1.0);
+  const double s2 = s * s;
+  double series = kLogSeries[kLogSeriesLength - 1];
+  for (int i = kLogSeriesLength - 2; i >= 0; --i) {
+    series = series * s2 + kLogSeries[i];
+  }
+  return 2.0 * s * series + exponent * kLn2;
+}
+
+// e^x. The relative error is around 1e-14. Anything outside of about
+// [-708, 709] gets clamped to that range.
+inline double Exp(double x) {
+  // This is written so that NaN ends up at the bottom, since converting it to
+  // an integer below wouldn't be safe.
+  x = x > -708.0 ? x : -708.0;
+  x = x < 709.0 ? x : 709.0;
+  // e^x = 2^k * e^r, with r in [-ln(2) / 2, ln(2) / 2].
+  const double k = floor(x * (1.0 / kLn2) + 0.5);
+  const double r = x - k * kLn2;
+  // Taylor series, which is plenty accurate over such a small range.
+  double series = 1.0 / 479001600;
+  series = series * r + 1.0 / 39916800;
+  series = series * r + 1.0 / 3628800;
+  series = series * r + 1.0 / 362880;
+  series = series * r + 1.0 / 40320;
+  series = series * r + 1.0 / 5040;
+  series = series * r + 1.0 / 720;
+  series = series * r + 1.0 / 120;
+  series = series * r + 1.0 / 24;
+  series = series * r + 1.0 / 6;
+  series = series * r + 1.0 / 2;
+  series = series * r + 1.0;
+  series = series * r + 1.0;
+
+  const uint64_t bits = static_cast<uint64_t>(static_cast<int32_t>(k) + 1023)
+                        << 52;
+  double scale;
+  memcpy(&scale, &bits, sizeof(scale));
+  return series * scale;
+}
+
+// log(1 + x), for x > -1, without losing precision when x is small. Anything at
+// or below -1 gets treated as being just above it.
+inline double Log1p(double x) {
+  // Log() itself is accurate enough once 1 + x is far from 1.
+  double one_plus = 1.0 + x;
+  one_plus = one_plus > 1e-300 ? one_plus : 1e-300;
+  const double far = Log(one_plus);
+
+  // Otherwise, use log(1 + x) = 2 * atanh(x / (2 + x)) directly, which never
+  // has to round 1 + x. This is the same series that Log() uses.
+  const double s = x / (2.0 + x);
+  const double s2 = s * s;
+  double series = kLogSeries[kLogSeriesLength - 1];
+  for (int i = kLogSeriesLength - 2; i >= 0; --i) {
+    series = series * s2 + kLogSeries[i];
+  }
+  const double near = 2.0 * s * series;
+
+  const bool small = x > -0.25 && x < 0.25;
+  return small ? near : far;
+}
+
+// e^x - 1, without losing precision when x is small. The same clamping as
+// Exp() applies.
+inline double Expm1(double x) {
+  const double far = Exp(x) - 1.0;
+
+  // Taylor series, which is plenty accurate for small x.
+  double series = 1.0 / 39916800;
+  series = series * x + 1.0 / 3628800;
+  series = series * x + 1.0 / 362880;
+  series = series * x + 1.0 / 40320;
+  series = series * x + 1.0 / 5040;
+  series = series * x + 1.0 / 720;
+  series = series * x + 1.0 / 120;
+  series = series * x + 1.0 / 24;
+  series = series * x + 1.0 / 6;
+  series = series * x + 1.0 / 2;
+  series = series * x + 1.0;
+  const double near = series * x;
+
+  const bool small = x > -0.25 && x < 0.25;
+  return small ? near : far;
+}
+
+// cos(2 * pi * x), for x in [0, 1). The absolute error is around 1e-12.
+inline double CosTwoPi(double x) {
+  // Fold x into [0, 1/4], using the symmetries of cosine.
+  const double half = fabs(x - 0.5);
+  const bool flip = half < 0.25;
+  const double quarter = flip ? half : 0.5 - half;
+  const double angle = kTwoPi * quarter;
+  const double angle2 = angle * angle;
+
+  double series = kCosSeries[kCosSeriesLength - 1];
+  for (int i = kCosSeriesLength - 2; i >= 0; --i) {
+    series = kCosSeries[i] - series * angle2;
+  }
+  // Near x = 1/2, cos(2 * pi * x) is near -1.
+  return flip ? -series : series;
+}
+
+}  // namespace fast_math
+}  // namespace metabolism
+}  // namespace automata
+
+#endif
@@ -0,0 +1,20 @@
+#include "automata/metabolism/metabolism.h"
+
+namespace automata {
+namespace metabolism {
+
+Metabolism::Metabolism(MetabolismPool *pool) : pool_(pool) {
+  if (!pool_) {
+    own_pool_.reset(new MetabolismPool());
+    pool_ = own_pool_.get();
+  }
+}
+
+Metabolism::~Metabolism() {
+  if (lane_) {
+    MetabolismPool::Remove(lane_, id_);
+  }
+}
+
+}  // metabolism
+}  // automata
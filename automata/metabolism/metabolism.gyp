@@ -4,6 +4,10 @@
       'target_name': 'metabolism',
       'type': 'static_library',
       'sources': [
+        'biomass_field.cc',
+        'metabolism.cc',
+        'metabolism_pool.cc',
+        'normal_kernel.cc',
         'plant_metabolism.cc',
         'animal_metabolism.cc',
       ],
@@ -19,6 +23,28 @@
         '<(externals):gtest',
       ],
     },
+    {
+      'target_name': 'metabolism_pool_test',
+      'type': 'executable',
+      'sources': [
+        'metabolism_pool_test.cc',
+      ],
+      'dependencies': [
+        'metabolism',
+        '<(externals):gtest',
+      ],
+    },
+    {
+      'target_name': 'biomass_field_test',
+      'type': 'executable',
+      'sources': [
+        'biomass_field_test.cc',
+      ],
+      'dependencies': [
+        'metabolism',
+        '<(externals):gtest',
+      ],
+    },
     {
       'target_name': 'animal_metabolism_test',
       'type': 'executable',
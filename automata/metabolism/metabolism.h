@@ -1,15 +1,20 @@
 #ifndef ECOSYSTEM_AUTOMATA_METABOLISM_METABOLISM_H_
 #define ECOSYSTEM_AUTOMATA_METABOLISM_METABOLISM_H_
 
+#include <memory>
+
+#include "automata/macros.h"
+#include "automata/metabolism/metabolism_pool.h"
+
 namespace automata {
 namespace metabolism {
 
-// Interface for simulating organism metabolism.
+// Interface for simulating organism metabolism. The state of the organism
+// lives in a MetabolismPool, and this is a view into it.
 class Metabolism {
  public:
-  // mass: The initial total mass of the organism. (kG)
-  Metabolism(double mass) : mass_(mass) {}
-  virtual ~Metabolism() = default;
+  // Removes our state from the pool.
+  virtual ~Metabolism();
 
   // Calculates change in energy over a given amount of time.
   // time: How much time (in secs).
@@ -19,15 +24,58 @@ class Metabolism {
   virtual void UseEnergy(double amount) = 0;
 
   // Returns: The current mass of the organism in Kg's.
-  double mass() const { return mass_; }
+  double mass() const {
+    double mass, energy;
+    pool_->Get(lane_, id_, &mass, &energy);
+    return mass;
+  }
   // Returns: The current energy reserves of the organism in J's.
-  double energy() const { return energy_; }
+  double energy() const {
+    double mass, energy;
+    pool_->Get(lane_, id_, &mass, &energy);
+    return energy;
+  }
+  // Sets whether we get updated. Inactive metabolisms keep their mass and
+  // energy, but both Update() and MetabolismPool::UpdateAll() skip them.
+  // active: Whether to update us.
+  void set_active(bool active) {
+    // Settle whatever happened while we were in the old state first.
+    pool_->Materialize(lane_, id_);
+    lane_->active[id_] = active ? 1 : 0;
+  }
+  // Returns: Whether we get updated.
+  bool is_active() const { return lane_->active[id_] > 0; }
+  // Returns: The pool that our state lives in.
+  MetabolismPool *pool() const { return pool_; }
+  // Returns: Our id in the pool.
+  int id() const { return id_; }
 
  protected:
-  // The mass of the organism in Kg's.
-  double mass_;
-  // The energy reserves of the organism in Joules.
-  double energy_ = 0;
+  // pool: The pool to keep our state in, or nullptr to get a pool all to
+  // ourselves. A shared pool has to outlive us.
+  explicit Metabolism(MetabolismPool *pool);
+
+  // Tells us where our state is. Subclasses have to call this once they have
+  // added themselves to the pool.
+  // lane: The lane that our state is in.
+  // id: Our id in the pool.
+  void Attach(MetabolismPool::Lane *lane, int id) {
+    lane_ = lane;
+    id_ = id;
+  }
+
+  // The pool that our state lives in.
+  MetabolismPool *pool_;
+  // Our id in the pool.
+  int id_ = -1;
+
+ private:
+  DISSALOW_COPY_AND_ASSIGN(Metabolism);
+
+  // The pool, if it belongs to us.
+  ::std::unique_ptr<MetabolismPool> own_pool_;
+  // The lane in the pool that our state is in.
+  MetabolismPool::Lane *lane_ = nullptr;
 };
 
 }  // automata
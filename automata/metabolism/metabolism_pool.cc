@@ -0,0 +1,346 @@
+#include <math.h>
+
+#include "automata/metabolism/fast_math.h"
+#include "automata/metabolism/metabolism_pool.h"
+#include "automata/metabolism/normal_kernel.h"
+#include "automata/metabolism/plant_constants.h"
+#include "automata/random.h"
+
+namespace automata {
+namespace metabolism {
+namespace {
+
+// Energy in fat. (kJ/g)
+constexpr double kFatEnergy = 37.0;
+// Normalization constants for Kleiber's law. These come from here:
+// https://universe-review.ca/R10-35-metabolic.htm
+constexpr double kB0 = 14.0149;
+constexpr double kB1 = 0.5371;
+constexpr double kB2 = 0.0294;
+constexpr double kB3 = 4799.0;
+// Energy in fat. (J/kg)
+constexpr double kFatEnergyPerKg = kFatEnergy * 1000 * 1000;
+// The most of its mass that an animal can lose in one integration step. Steps
+// only have to be split up when an update covers a very long time.
+constexpr double kMaxStepLoss = 0.001;
+// The most integration steps that one update can take for an animal. Anything
+// left over after that gets covered by one last step.
+constexpr int kMaxSteps = 100000;
+
+// Works out how fast an animal is burning through its mass.
+// mass: The mass of the animal. (kg)
+// body_temp: The body temperature of the animal. (K)
+// time: How long to burn it for. (s)
+// log_mass_out: Set to the natural log of the mass.
+// Returns: The fraction of its mass that the animal would lose in that time if
+// its basal rate stayed the same.
+inline double StepLoss(double mass, double body_temp, double time,
+                       double *log_mass_out) {
+  // Calculate the basal metabolic rate (W/kg) from an updated version of
+  // Kleiber's law. This comes from a 2010 article in nature.
+  const double log_mass = fast_math::Log(mass);
+  const double basal_rate =
+      fast_math::Exp(fast_math::kLn10 *
+                     (kB0 + kB1 * log_mass + kB2 * log_mass * log_mass -
+                      kB3 / body_temp));
+  *log_mass_out = log_mass;
+  return basal_rate * time / (kFatEnergyPerKg * mass);
+}
+
+// Works out how much mass an animal really loses, given that its basal rate
+// falls off as it loses mass. Over a short stretch, the rate is a power law in
+// the mass, rate ~ mass^exponent, and dm/dt = -k * m^exponent can be solved
+// exactly. If kB2 were zero, it would be a power law everywhere, and this would
+// be exact for any amount of time.
+// loss: What StepLoss() returned.
+// log_mass: The log of the mass that StepLoss() gave.
+// Returns: The fraction of its mass that the animal actually loses.
+inline double PowerLawLoss(double loss, double log_mass) {
+  // The exponent is d log(rate) / d log(mass). Taking it from about halfway
+  // through the step makes the error much smaller than taking it from the
+  // start.
+  const double exponent =
+      fast_math::kLn10 * (kB1 + 2 * kB2 * (log_mass - loss / 2));
+  // The solution is m(t) / m(0) = (1 - (1 - exponent) * loss)^(1 / (1 -
+  // exponent)). Exponents of exactly 1 make it exponential, and get nudged a
+  // little so as not to divide by zero.
+  double power = 1 - exponent;
+  power = power > 1e-9 || power < -1e-9 ? power : 1e-9;
+  if (power * loss >= 1) {
+    // It runs out of mass before the time is up.
+    return 1;
+  }
+  return -fast_math::Expm1(fast_math::Log1p(-power * loss) / power);
+}
+
+// Checks whether an animal runs out of mass completely before some amount of
+// time is up. Small animals have exponents below 1, and burn through their
+// mass in a finite time, when (1 - exponent) * loss reaches 1.
+// loss: What StepLoss() returned for the whole time.
+// log_mass: The log of the mass that StepLoss() gave.
+// Returns: true if it runs out.
+inline bool RunsOut(double loss, double log_mass) {
+  const double power = 1 - fast_math::kLn10 * (kB1 + 2 * kB2 * log_mass);
+  return power > 0 && power * loss >= 1;
+}
+
+}  // namespace
+
+int MetabolismPool::Allocate(Lane *lane, bool *grow) {
+  *grow = lane->free.empty();
+  if (*grow) {
+    lane->mass.push_back(0);
+    lane->energy.push_back(0);
+    lane->active.push_back(1);
+    return lane->size() - 1;
+  }
+
+  const int id = lane->free.back();
+  lane->free.pop_back();
+  lane->active[id] = 1;
+  return id;
+}
+
+int MetabolismPool::AddAnimal(double mass, double fat_mass, double body_temp,
+                              double scale, double drag_coefficient) {
+  bool grow;
+  const int id = Allocate(&animals_, &grow);
+  if (grow) {
+    animals_.body_temp.push_back(0);
+    animals_.scale.push_back(0);
+    animals_.drag_coefficient.push_back(0);
+  }
+
+  animals_.mass[id] = mass;
+  // Figure out the initial energy from fat reserves.
+  animals_.energy[id] = fat_mass * 1000 * kFatEnergy * 1000;
+  animals_.body_temp[id] = body_temp;
+  animals_.scale[id] = scale;
+  animals_.drag_coefficient[id] = drag_coefficient;
+  return id;
+}
+
+int MetabolismPool::AddPlant(double mass, double efficiency, double area_mean,
+                             double area_stddev, double cellulose,
+                             double hemicellulose, double lignin,
+                             uint64_t seed, uint32_t index) {
+  bool grow;
+  const int id = Allocate(&plants_, &grow);
+  if (grow) {
+    plants_.efficiency.push_back(0);
+    plants_.area_mean.push_back(0);
+    plants_.area_stddev.push_back(0);
+    plants_.usable.push_back(0);
+    plants_.seed.push_back(0);
+    plants_.index.push_back(0);
+    plants_.updates.push_back(0);
+    plants_.clock.push_back(0);
+    plants_.clock_squared.push_back(0);
+  }
+
+  const double usable = 1 - (cellulose + hemicellulose + lignin);
+  plants_.mass[id] = mass;
+  // Figure out how much energy we start with.
+  const double max_energy =
+      (mass * 1000) / kGlucoseMolecularMass * -kRespirationDeltaG;
+  plants_.energy[id] = max_energy * usable;
+  plants_.efficiency[id] = efficiency;
+  plants_.area_mean[id] = area_mean;
+  plants_.area_stddev[id] = area_stddev;
+  plants_.usable[id] = usable;
+  plants_.seed[id] = seed;
+  plants_.index[id] = index;
+  plants_.updates[id] = 0;
+  // It only grows from now on.
+  plants_.clock[id] = plant_clock_;
+  plants_.clock_squared[id] = plant_clock_squared_;
+  return id;
+}
+
+void MetabolismPool::Remove(Lane *lane, int id) {
+  // Leave harmless values behind, so the update loops can keep running over
+  // it without producing anything weird.
+  lane->mass[id] = 1;
+  lane->energy[id] = 0;
+  lane->active[id] = 0;
+  lane->free.push_back(id);
+}
+
+void MetabolismPool::UpdateAll(int time) {
+  UpdateAnimals(time, 0, animals_.size());
+  plant_clock_ += time;
+  plant_clock_squared_ += static_cast<double>(time) * time;
+}
+
+void MetabolismPool::UpdateAnimals(int time, int begin, int end) {
+  if (begin >= end) {
+    return;
+  }
+  double *mass = animals_.mass.data();
+  double *energy = animals_.energy.data();
+  const double *active = animals_.active.data();
+  const double *body_temp = animals_.body_temp.data();
+  animal_pending_.resize(end - begin);
+  double *pending = animal_pending_.data();
+
+  // Everything in here is straight-line arithmetic on contiguous arrays, so
+  // the compiler can turn it into vector instructions. Animals that need more
+  // than one step are left alone and marked, and get done afterwards.
+  double num_pending = 0;
+  for (int i = begin; i < end; ++i) {
+    double log_mass;
+    const double loss =
+        StepLoss(mass[i], body_temp[i], time * active[i], &log_mass);
+    // Animals with no mass left get a loss that isn't a number, and get
+    // marked too.
+    const double too_long = !(loss <= kMaxStepLoss);
+    pending[i - begin] = too_long;
+    num_pending += too_long;
+
+    const double mass_loss =
+        mass[i] * PowerLawLoss(too_long ? 0 : loss, log_mass);
+    mass[i] -= mass_loss;
+    energy[i] -= mass_loss * kFatEnergyPerKg;
+  }
+
+  if (!num_pending) {
+    return;
+  }
+  for (int i = begin; i < end; ++i) {
+    if (pending[i - begin]) {
+      IntegrateAnimal(i, time);
+    }
+  }
+}
+
+void MetabolismPool::IntegrateAnimal(int id, double time) {
+  double &mass = animals_.mass[id];
+  double &energy = animals_.energy[id];
+  const double body_temp = animals_.body_temp[id];
+
+  // Take the biggest steps that lose no more than kMaxStepLoss each. Each one
+  // treats the exponent as fixed, and the exponent only moves with log(mass),
+  // so this bounds the error.
+  for (int steps = 1; time > 0 && mass > 0; ++steps) {
+    double log_mass;
+    double loss = StepLoss(mass, body_temp, time, &log_mass);
+    if (RunsOut(loss, log_mass)) {
+      // Close to the end, each step only covers a little of what's left, so
+      // stepping would never get there.
+      energy -= mass * kFatEnergyPerKg;
+      mass = 0;
+      break;
+    }
+    double step = time;
+    if (loss > kMaxStepLoss && steps < kMaxSteps) {
+      step = time * kMaxStepLoss / loss;
+      loss = kMaxStepLoss;
+    }
+
+    const double mass_loss = mass * PowerLawLoss(loss, log_mass);
+    mass -= mass_loss;
+    energy -= mass_loss * kFatEnergyPerKg;
+    time -= step;
+  }
+}
+
+void MetabolismPool::UpdatePlants(int time, int begin, int end) {
+  CatchUpPlants(begin, end);
+  // Now make it look like they were last caught up a little earlier.
+  for (int id = begin; id < end; ++id) {
+    plants_.clock[id] -= time;
+    plants_.clock_squared[id] -= static_cast<double>(time) * time;
+  }
+  CatchUpPlants(begin, end);
+}
+
+void MetabolismPool::CatchUpPlants(int begin, int end) {
+  if (begin >= end) {
+    return;
+  }
+  const int count = end - begin;
+
+  // Draw a sample for every plant in one batch, each from the plant's own
+  // stream. Plants that are already caught up don't use theirs.
+  leaf_normals_.resize(count);
+  GetNormalKernel()(plants_.seed.data() + begin, plants_.updates.data() + begin,
+                    plants_.index.data() + begin, Random::kLeafArea, count,
+                    leaf_normals_.data());
+
+  for (int i = 0; i < count; ++i) {
+    const int id = begin + i;
+    double mass_gain, energy_gain;
+    PlantGrowth(id, leaf_normals_[i], &mass_gain, &energy_gain);
+    plants_.energy[id] += energy_gain;
+    plants_.mass[id] += mass_gain;
+
+    // Only move along the stream if the sample actually got used, so plants
+    // pick up where they left off after being inactive.
+    const double elapsed_squared =
+        plant_clock_squared_ - plants_.clock_squared[id];
+    plants_.updates[id] += elapsed_squared > 0 && plants_.active[id] > 0;
+    plants_.clock[id] = plant_clock_;
+    plants_.clock_squared[id] = plant_clock_squared_;
+  }
+}
+
+void MetabolismPool::PeekPlant(int id, double *mass, double *energy) const {
+  // This has to be the same number that CatchUpPlants() would draw.
+  double normal;
+  normal_kernel::DrawScalar(&plants_.seed[id], &plants_.updates[id],
+                            &plants_.index[id], Random::kLeafArea, 1, &normal);
+
+  double mass_gain, energy_gain;
+  PlantGrowth(id, normal, &mass_gain, &energy_gain);
+  *mass = plants_.mass[id] + mass_gain;
+  *energy = plants_.energy[id] + energy_gain;
+}
+
+void MetabolismPool::PlantGrowth(int id, double normal, double *mass_gain,
+                                 double *energy_gain) const {
+  const double elapsed = plant_clock_ - plants_.clock[id];
+  const double elapsed_squared =
+      plant_clock_squared_ - plants_.clock_squared[id];
+
+  // Each tick contributes its leaf area, which is normally distributed, times
+  // its length. The total of that over all the ticks is normal too, with the
+  // means and variances adding up. This is in m^2 * s.
+  const double area_time =
+      plants_.area_mean[id] * elapsed +
+      plants_.area_stddev[id] * sqrt(elapsed_squared) * normal;
+
+  // Calculate how much energy we produced in this time, in Joules. Inactive
+  // plants don't produce any.
+  const double energy = area_time * kSolarEnergy * plants_.efficiency[id] *
+                        plants_.active[id];
+
+  // To calculate the mass gain, we figure out how many moles of glucose we
+  // produced.
+  // The basic equation is this: 6C02 + 6H2O --> C6H12O6 + 6O2
+  const double mols_glucose = energy / kPhotosynthesisDeltaG;
+  const double grams_glucose = mols_glucose * kGlucoseMolecularMass;
+  *mass_gain = grams_glucose / 1000.0;
+
+  // We'll assume that we can't free up energy from cellulose, hemicellulose,
+  // or lignin reserves, so that decreases our total energy.
+  *energy_gain = energy * plants_.usable[id];
+}
+
+void MetabolismPool::UseAnimalEnergy(int id, double amount) {
+  animals_.mass[id] -= amount / 1000 / kFatEnergy / 1000;
+  animals_.energy[id] -= amount;
+}
+
+void MetabolismPool::UsePlantEnergy(int id, double amount) {
+  // Figure out how much glucose we'd need to metabolize. (Assume anything more
+  // sophisticated has metabolic pathways that release an equivalent amount of
+  // energy.)
+  const double mols_required = amount / -kRespirationDeltaG;
+  const double kg_required = mols_required * kGlucoseMolecularMass / 1000.0;
+
+  plants_.mass[id] -= kg_required;
+  plants_.energy[id] -= amount;
+}
+
+}  // namespace metabolism
+}  // namespace automata
@@ -0,0 +1,206 @@
+#ifndef ECOSYSTEM_AUTOMATA_METABOLISM_METABOLISM_POOL_H_
+#define ECOSYSTEM_AUTOMATA_METABOLISM_METABOLISM_POOL_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "automata/macros.h"
+
+namespace automata {
+namespace metabolism {
+
+// Keeps the state of a lot of metabolisms in parallel arrays, one set of arrays
+// for each kind of organism, so that all of them can be updated in one pass
+// that streams through memory. The Metabolism subclasses are views into one of
+// these. Entries are referred to by an id that stays the same for as long as
+// the entry exists. Ids of removed entries get reused.
+//
+// Plants are updated lazily. Their growth over any stretch of ticks is a sum of
+// independent normal samples, which is itself normal, so instead of drawing one
+// sample per plant per tick, the pool just keeps track of how much time has
+// passed. Each plant remembers how far it has been caught up, and gets caught
+// up with a single sample when something changes it in a way that affects its
+// growth. Plants that nothing changes don't cost anything per tick. Just
+// looking at a plant works out what catching it up would give without actually
+// doing it, so how often things look at plants doesn't change which random
+// numbers they use, and runs come out the same however often they are drawn.
+class MetabolismPool {
+ public:
+  // The state that every kind of metabolism has.
+  struct Lane {
+    // Total mass. (kg)
+    ::std::vector<double> mass;
+    // Energy reserves. (J)
+    ::std::vector<double> energy;
+    // 1 for entries that UpdateAll() should update, and 0 for ones that it
+    // should leave alone. Using a number instead of a flag lets the update
+    // loops multiply by it instead of branching.
+    ::std::vector<double> active;
+    // Ids of entries that have been removed and can be reused.
+    ::std::vector<int> free;
+
+    // Returns: How many entries there is room for, including removed ones.
+    int size() const { return mass.size(); }
+  };
+
+  // State for animals.
+  struct Animals : public Lane {
+    // Body temperature. (K)
+    ::std::vector<double> body_temp;
+    // Scale of the animal. (m)
+    ::std::vector<double> scale;
+    // Air drag coefficient of the animal.
+    ::std::vector<double> drag_coefficient;
+  };
+
+  // State for plants.
+  struct Plants : public Lane {
+    // Efficiency of photosynthesis.
+    ::std::vector<double> efficiency;
+    // Parameters of the normal distribution for picking leaf area. (m^2)
+    ::std::vector<double> area_mean;
+    ::std::vector<double> area_stddev;
+    // Fraction of the produced energy that isn't locked up in cellulose,
+    // hemicellulose or lignin.
+    ::std::vector<double> usable;
+    // Identifies the random number stream that leaf areas come from.
+    ::std::vector<uint64_t> seed;
+    ::std::vector<uint32_t> index;
+    // How many times each plant has been caught up, which is where it is in
+    // its stream.
+    ::std::vector<uint32_t> updates;
+    // The pool's plant_clock() and plant_clock_squared() as of when each plant
+    // was last caught up.
+    ::std::vector<double> clock;
+    ::std::vector<double> clock_squared;
+  };
+
+  MetabolismPool() = default;
+
+  // Adds an animal. See AnimalMetabolism for the arguments.
+  // Returns: The id of the new animal.
+  int AddAnimal(double mass, double fat_mass, double body_temp, double scale,
+                double drag_coefficient);
+  // Adds a plant. See PlantMetabolism for the arguments.
+  // Returns: The id of the new plant.
+  int AddPlant(double mass, double efficiency, double area_mean,
+               double area_stddev, double cellulose, double hemicellulose,
+               double lignin, uint64_t seed, uint32_t index);
+  // Removes an entry, so its id can be reused.
+  // lane: The lane that the entry is in.
+  // id: The id of the entry.
+  static void Remove(Lane *lane, int id);
+
+  // Updates every active animal and plant. Plants don't actually get touched
+  // until they are caught up.
+  // time: How much time passed. (s)
+  void UpdateAll(int time);
+  // Updates a range of animals. Inactive ones are left alone. This takes into
+  // account that animals burn energy more slowly as they lose mass, so any
+  // amount of time can be covered in one call.
+  // time: How much time passed. (s)
+  // begin: The id of the first animal to update.
+  // end: One past the id of the last animal to update.
+  void UpdateAnimals(int time, int begin, int end);
+  // Catches up a range of plants, and then updates them by some extra time that
+  // only applies to them. See UpdateAnimals() for the arguments.
+  void UpdatePlants(int time, int begin, int end);
+  // Catches up a range of plants with all the time that has passed since they
+  // were last caught up. Inactive ones don't grow.
+  // begin: The id of the first plant to catch up.
+  // end: One past the id of the last plant to catch up.
+  void CatchUpPlants(int begin, int end);
+  // Catches up every plant.
+  void CatchUpAll() { CatchUpPlants(0, plants_.size()); }
+  // Makes sure that the stored mass and energy of an entry are current. This
+  // has to be done before changing anything that affects how it grows.
+  // lane: The lane that the entry is in.
+  // id: The id of the entry.
+  void Materialize(const Lane *lane, int id) {
+    if (lane == &plants_ && plants_.clock[id] != plant_clock_) {
+      CatchUpPlants(id, id + 1);
+    }
+  }
+  // Works out the current mass and energy of an entry, without catching it up.
+  // lane: The lane that the entry is in.
+  // id: The id of the entry.
+  // mass: Set to the mass. (kg)
+  // energy: Set to the energy. (J)
+  void Get(const Lane *lane, int id, double *mass, double *energy) const {
+    if (lane == &plants_ && plants_.clock[id] != plant_clock_) {
+      PeekPlant(id, mass, energy);
+      return;
+    }
+    *mass = lane->mass[id];
+    *energy = lane->energy[id];
+  }
+
+  // Subtracts energy from an animal, and the fat that it came from.
+  // id: The id of the animal.
+  // amount: The energy to use. (J)
+  void UseAnimalEnergy(int id, double amount);
+  // Subtracts energy from a plant, and the glucose that it came from.
+  // id: The id of the plant.
+  // amount: The energy to use. (J)
+  void UsePlantEnergy(int id, double amount);
+
+  Animals &animals() { return animals_; }
+  const Animals &animals() const { return animals_; }
+  Plants &plants() { return plants_; }
+  const Plants &plants() const { return plants_; }
+
+  // Returns: The total time that UpdateAll() has been given. (s)
+  double plant_clock() const { return plant_clock_; }
+  // Returns: The total of the squares of the times that UpdateAll() has been
+  // given. (s^2)
+  double plant_clock_squared() const { return plant_clock_squared_; }
+
+  // Returns: How many animals there are.
+  int num_animals() const { return animals_.size() - animals_.free.size(); }
+  // Returns: How many plants there are.
+  int num_plants() const { return plants_.size() - plants_.free.size(); }
+
+ private:
+  DISSALOW_COPY_AND_ASSIGN(MetabolismPool);
+
+  // Finds an id for a new entry, growing the shared arrays if there are no free
+  // ones.
+  // lane: The lane to put the entry in.
+  // Returns: The id, and whether the kind-specific arrays have to be grown.
+  static int Allocate(Lane *lane, bool *grow);
+  // Works out what catching up a plant would give it. See Get().
+  // id: The id of the plant.
+  // mass: Set to the caught up mass. (kg)
+  // energy: Set to the caught up energy. (J)
+  void PeekPlant(int id, double *mass, double *energy) const;
+  // Works out how much a plant has grown since it was last caught up.
+  // id: The id of the plant.
+  // normal: The standard normal sample to use for its leaf area.
+  // mass_gain: Set to the mass that it gained. (kg)
+  // energy_gain: Set to the energy that it gained. (J)
+  void PlantGrowth(int id, double normal, double *mass_gain,
+                   double *energy_gain) const;
+  // Updates a single animal in as many steps as it takes to keep the error
+  // down.
+  // id: The id of the animal.
+  // time: How much time passed. (s)
+  void IntegrateAnimal(int id, double time);
+
+  Animals animals_;
+  Plants plants_;
+  // The total time and total squared time that plants have had to grow. These
+  // are integers, so they stay exact up to 2^53.
+  double plant_clock_ = 0;
+  double plant_clock_squared_ = 0;
+  // Scratch space for the normal numbers that leaf areas get made from.
+  ::std::vector<double> leaf_normals_;
+  // Scratch space for marking animals that need more than one step. These are
+  // 1 or 0, like Lane::active.
+  ::std::vector<double> animal_pending_;
+};
+
+}  // namespace metabolism
+}  // namespace automata
+
+#endif
@@ -0,0 +1,318 @@
+#include <math.h>
+
+#include <memory>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "automata/metabolism/animal_metabolism.h"
+#include "automata/metabolism/metabolism_pool.h"
+#include "automata/metabolism/normal_kernel.h"
+#include "automata/metabolism/plant_metabolism.h"
+#include "automata/random.h"
+
+namespace automata {
+namespace metabolism {
+
+class MetabolismPoolTest : public ::testing::Test {
+ protected:
+  static constexpr double kBodyTemp = 310.15;
+  static constexpr double kScale = 0.5;
+  static constexpr double kDragCoefficient = 0.37;
+
+  // Makes an animal with a particular mass.
+  // mass: The mass of the animal.
+  // pool: The pool to put it in.
+  static AnimalMetabolism *MakeAnimal(double mass,
+                                      MetabolismPool *pool = nullptr) {
+    return new AnimalMetabolism(mass, mass / 5, kBodyTemp, kScale,
+                                kDragCoefficient, pool);
+  }
+  // Makes a plant with a particular index.
+  // index: The index of the plant.
+  // pool: The pool to put it in.
+  static PlantMetabolism *MakePlant(uint32_t index,
+                                    MetabolismPool *pool = nullptr) {
+    return new PlantMetabolism(0.01, 0.02, 0.1, 0.03, 0.4, 0.3, 0.2, 42, index,
+                               pool);
+  }
+
+  MetabolismPool pool_;
+};
+
+// Does updating everything at once give the same results as updating things
+// one at a time?
+TEST_F(MetabolismPoolTest, UpdateAllTest) {
+  ::std::vector<::std::unique_ptr<Metabolism>> pooled, alone;
+  for (int i = 0; i < 10; ++i) {
+    pooled.emplace_back(MakeAnimal(0.1 + i, &pool_));
+    alone.emplace_back(MakeAnimal(0.1 + i));
+    pooled.emplace_back(MakePlant(i, &pool_));
+    alone.emplace_back(MakePlant(i));
+  }
+  EXPECT_EQ(10, pool_.num_animals());
+  EXPECT_EQ(10, pool_.num_plants());
+
+  for (int tick = 0; tick < 5; ++tick) {
+    pool_.UpdateAll(10);
+    for (auto &metabolism : alone) {
+      metabolism->Update(10);
+    }
+    // Catching the pooled plants up every tick makes them use exactly the same
+    // samples.
+    pool_.CatchUpAll();
+  }
+
+  for (int i = 0; i < 20; ++i) {
+    EXPECT_EQ(alone[i]->mass(), pooled[i]->mass());
+    EXPECT_EQ(alone[i]->energy(), pooled[i]->energy());
+  }
+}
+
+// Is the approximate basal rate close to the real thing?
+TEST_F(MetabolismPoolTest, BasalRateAccuracyTest) {
+  for (double mass = 0.001; mass < 5000; mass *= 1.7) {
+    ::std::unique_ptr<AnimalMetabolism> animal(MakeAnimal(mass, &pool_));
+    const double start_energy = animal->energy();
+    animal->Update(1);
+
+    const double log_mass = log(mass);
+    const double expected = pow(10, 14.0149 + 0.5371 * log_mass +
+                                        0.0294 * pow(log_mass, 2) -
+                                        4799.0 / kBodyTemp);
+    // The rate falls off a little as the animal loses mass during the second,
+    // which is the biggest difference for big animals.
+    EXPECT_NEAR(1.0, (start_energy - animal->energy()) / expected, 1e-5);
+  }
+}
+
+// Can we cover a long time in one update?
+TEST_F(MetabolismPoolTest, LongUpdateTest) {
+  // This is long enough for a big animal to burn through most of its mass.
+  constexpr int kTime = 2000000000;
+  constexpr double kMass = 50;
+  ::std::unique_ptr<AnimalMetabolism> animal(MakeAnimal(kMass, &pool_));
+  ::std::unique_ptr<AnimalMetabolism> stepped(MakeAnimal(kMass, &pool_));
+  const double start_energy = animal->energy();
+  animal->Update(kTime);
+  for (int i = 0; i < 100; ++i) {
+    stepped->Update(kTime / 100);
+  }
+
+  // Integrate dm/dt = -rate(m) / fat energy with lots of small RK4 steps.
+  auto derivative = [](double mass) {
+    const double log_mass = log(mass);
+    const double rate = pow(10, 14.0149 + 0.5371 * log_mass +
+                                    0.0294 * pow(log_mass, 2) -
+                                    4799.0 / kBodyTemp);
+    return -rate / (37.0 * 1000 * 1000);
+  };
+  constexpr int kSteps = 100000;
+  constexpr double kStep = static_cast<double>(kTime) / kSteps;
+  double mass = kMass;
+  for (int i = 0; i < kSteps; ++i) {
+    const double k1 = derivative(mass);
+    const double k2 = derivative(mass + kStep / 2 * k1);
+    const double k3 = derivative(mass + kStep / 2 * k2);
+    const double k4 = derivative(mass + kStep * k3);
+    mass += kStep / 6 * (k1 + 2 * k2 + 2 * k3 + k4);
+  }
+  ASSERT_LT(mass, kMass / 2);
+
+  EXPECT_NEAR(mass, animal->mass(), mass * 1e-6);
+  EXPECT_NEAR(mass, stepped->mass(), mass * 1e-6);
+  // Energy and mass should go down together.
+  EXPECT_NEAR((kMass - animal->mass()) * 37.0 * 1000 * 1000,
+              start_energy - animal->energy(), start_energy * 1e-9);
+}
+
+// Does a small animal that burns through all of its mass stop at zero?
+TEST_F(MetabolismPoolTest, RunOutTest) {
+  // Animals this small run out of mass in a finite amount of time, which is
+  // much less than this.
+  constexpr double kMass = 0.001;
+  ::std::unique_ptr<AnimalMetabolism> animal(MakeAnimal(kMass, &pool_));
+  const double start_energy = animal->energy();
+  animal->Update(2000000000);
+  EXPECT_EQ(0, animal->mass());
+  EXPECT_NEAR(kMass * 37.0 * 1000 * 1000, start_energy - animal->energy(),
+              start_energy * 1e-9);
+
+  // Nothing happens after that.
+  const double energy = animal->energy();
+  pool_.UpdateAll(2000000000);
+  EXPECT_EQ(0, animal->mass());
+  EXPECT_EQ(energy, animal->energy());
+}
+
+// Do batched leaf areas come out the same as drawing them one at a time?
+TEST_F(MetabolismPoolTest, LeafAreaTest) {
+  ::std::vector<::std::unique_ptr<PlantMetabolism>> plants;
+  for (int i = 0; i < 100; ++i) {
+    plants.emplace_back(MakePlant(i, &pool_));
+  }
+
+  for (uint32_t tick = 0; tick < 3; ++tick) {
+    ::std::vector<double> start_energies;
+    for (const auto &plant : plants) {
+      start_energies.push_back(plant->energy());
+    }
+    pool_.UpdateAll(10);
+    pool_.CatchUpAll();
+
+    for (uint32_t i = 0; i < plants.size(); ++i) {
+      Random random(42, tick, i, Random::kLeafArea);
+      const double leaf_area = random.Normal(0.1, 0.03);
+      // See MakePlant() for where these numbers come from.
+      const double expected = leaf_area * 1120 * 0.02 * 10 * (1 - 0.9);
+      EXPECT_NEAR(expected, plants[i]->energy() - start_energies[i],
+                  fabs(expected) * 1e-9);
+    }
+  }
+}
+
+// Do plants that nobody looks at for a while catch up correctly?
+TEST_F(MetabolismPoolTest, LazyPlantTest) {
+  ::std::vector<::std::unique_ptr<PlantMetabolism>> plants;
+  ::std::vector<double> start_energies;
+  for (int i = 0; i < 10; ++i) {
+    plants.emplace_back(MakePlant(i, &pool_));
+    start_energies.push_back(plants.back()->energy());
+  }
+
+  // Ticks of different lengths.
+  for (int tick = 0; tick < 100; ++tick) {
+    pool_.UpdateAll(tick % 2 ? 10 : 20);
+  }
+  EXPECT_EQ(1500, pool_.plant_clock());
+  EXPECT_EQ(25000, pool_.plant_clock_squared());
+  // Nothing should have actually happened yet.
+  EXPECT_EQ(0u, pool_.plants().updates[0]);
+
+  // Catch up half of them in one batch, and just look at the rest.
+  pool_.CatchUpPlants(0, 5);
+  for (int i = 0; i < 10; ++i) {
+    // The whole stretch should be covered by a single sample. See MakePlant()
+    // for where these numbers come from.
+    Random random(42, 0, i, Random::kLeafArea);
+    const double area_time = 0.1 * 1500 + 0.03 * sqrt(25000) *
+                                              random.Normal(0, 1);
+    const double expected = area_time * 1120 * 0.02 * (1 - 0.9);
+    EXPECT_NEAR(expected, plants[i]->energy() - start_energies[i],
+                fabs(expected) * 1e-9);
+    EXPECT_EQ(i < 5 ? 1u : 0u, pool_.plants().updates[i]);
+  }
+
+  // Looking again shouldn't change anything.
+  const double energy = plants[0]->energy();
+  EXPECT_EQ(energy, plants[0]->energy());
+  EXPECT_EQ(1u, pool_.plants().updates[0]);
+
+  // Actually catching up the ones that we only looked at should give what we
+  // saw.
+  const double looked_energy = plants[9]->energy();
+  const double looked_mass = plants[9]->mass();
+  pool_.CatchUpPlants(5, 10);
+  EXPECT_EQ(1u, pool_.plants().updates[9]);
+  EXPECT_EQ(looked_energy, plants[9]->energy());
+  EXPECT_EQ(looked_mass, plants[9]->mass());
+
+  // Plants that show up later only grow from then on.
+  ::std::unique_ptr<PlantMetabolism> late(MakePlant(10, &pool_));
+  const double late_energy = late->energy();
+  EXPECT_EQ(late_energy, late->energy());
+  EXPECT_EQ(0u, pool_.plants().updates[late->id()]);
+}
+
+// Does looking at plants leave what happens to them alone?
+TEST_F(MetabolismPoolTest, ObservationTest) {
+  MetabolismPool watched_pool;
+  ::std::vector<::std::unique_ptr<PlantMetabolism>> watched, ignored;
+  for (int i = 0; i < 10; ++i) {
+    watched.emplace_back(MakePlant(i, &watched_pool));
+    ignored.emplace_back(MakePlant(i, &pool_));
+  }
+
+  for (int tick = 0; tick < 20; ++tick) {
+    watched_pool.UpdateAll(10);
+    pool_.UpdateAll(10);
+    // Look at some of them, some of the time.
+    for (int i = 0; i < 10; i += 1 + tick % 3) {
+      watched[i]->mass();
+      watched[i]->energy();
+    }
+  }
+
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(ignored[i]->mass(), watched[i]->mass());
+    EXPECT_EQ(ignored[i]->energy(), watched[i]->energy());
+    EXPECT_EQ(0u, watched_pool.plants().updates[i]);
+  }
+}
+
+// Do all the normal kernels give the same answers?
+TEST_F(MetabolismPoolTest, NormalKernelTest) {
+  // Use an odd size, so the vectorized versions have some left over.
+  constexpr int kCount = 1003;
+  ::std::vector<uint64_t> seeds(kCount);
+  ::std::vector<uint32_t> ticks(kCount), indices(kCount);
+  for (int i = 0; i < kCount; ++i) {
+    seeds[i] = 0x123456789ull * (i % 3);
+    ticks[i] = i % 7;
+    indices[i] = i;
+  }
+
+  ::std::vector<double> scalar(kCount);
+  normal_kernel::DrawScalar(seeds.data(), ticks.data(), indices.data(),
+                            Random::kLeafArea, kCount, scalar.data());
+  for (int i = 0; i < kCount; ++i) {
+    // These should be really close to the exact version.
+    Random random(seeds[i], ticks[i], indices[i], Random::kLeafArea);
+    EXPECT_NEAR(random.Normal(0, 1), scalar[i], 1e-9);
+  }
+
+  if (!normal_kernel::HasAvx2()) {
+    return;
+  }
+  ::std::vector<double> avx2(kCount);
+  normal_kernel::DrawAvx2(seeds.data(), ticks.data(), indices.data(),
+                          Random::kLeafArea, kCount, avx2.data());
+  for (int i = 0; i < kCount; ++i) {
+    EXPECT_EQ(scalar[i], avx2[i]);
+  }
+}
+
+// Are inactive and removed entries left alone, and do ids get reused?
+TEST_F(MetabolismPoolTest, LifetimeTest) {
+  ::std::unique_ptr<AnimalMetabolism> animal(MakeAnimal(1, &pool_));
+  ::std::unique_ptr<PlantMetabolism> plant(MakePlant(0, &pool_));
+  ::std::unique_ptr<AnimalMetabolism> doomed(MakeAnimal(2, &pool_));
+  const int doomed_id = doomed->id();
+
+  animal->set_active(false);
+  plant->set_active(false);
+  EXPECT_FALSE(animal->is_active());
+  const double animal_energy = animal->energy();
+  const double plant_energy = plant->energy();
+  pool_.UpdateAll(10);
+  animal->Update(10);
+  plant->Update(10);
+  EXPECT_EQ(animal_energy, animal->energy());
+  EXPECT_EQ(plant_energy, plant->energy());
+
+  // Once it comes back, it should pick up where it left off.
+  plant->set_active(true);
+  pool_.UpdateAll(10);
+  EXPECT_GT(plant->energy(), plant_energy);
+
+  doomed.reset();
+  EXPECT_EQ(1, pool_.num_animals());
+  ::std::unique_ptr<AnimalMetabolism> replacement(MakeAnimal(3, &pool_));
+  EXPECT_EQ(doomed_id, replacement->id());
+  EXPECT_EQ(3, replacement->mass());
+  EXPECT_TRUE(replacement->is_active());
+  EXPECT_EQ(2, pool_.num_animals());
+}
+
+}  // namespace metabolism
+}  // namespace automata
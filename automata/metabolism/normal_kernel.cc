@@ -0,0 +1,208 @@
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ECOSYSTEM_X86_KERNELS
+#endif
+
+#include <math.h>
+
+#include "automata/metabolism/fast_math.h"
+#include "automata/metabolism/normal_kernel.h"
+#include "automata/random.h"
+
+namespace automata {
+namespace metabolism {
+namespace normal_kernel {
+namespace {
+
+// Draws a single number. See NormalKernel for the arguments.
+inline double DrawOne(uint64_t seed, uint32_t tick, uint32_t index,
+                      uint32_t purpose) {
+  const uint32_t key[2] = {static_cast<uint32_t>(seed),
+                           static_cast<uint32_t>(seed >> 32)};
+  const uint32_t counter[4] = {tick, index, purpose, 0};
+  uint32_t block[4];
+  Random::Philox(counter, key, block);
+
+  // Box-Muller. This uses the same four words for its two uniform numbers
+  // that Random::Normal() would.
+  const double u1 = 1.0 - Random::ToUniform(block[0], block[1]);
+  const double u2 = Random::ToUniform(block[2], block[3]);
+  return sqrt(-2.0 * fast_math::Log(u1)) * fast_math::CosTwoPi(u2);
+}
+
+}  // namespace
+
+void DrawScalar(const uint64_t *seeds, const uint32_t *ticks,
+                const uint32_t *indices, uint32_t purpose, int count,
+                double *normals) {
+  for (int i = 0; i < count; ++i) {
+    normals[i] = DrawOne(seeds[i], ticks[i], indices[i], purpose);
+  }
+}
+
+#ifdef ECOSYSTEM_X86_KERNELS
+
+namespace {
+
+// Everything in here keeps 32 bit words in the low halves of 64 bit lanes,
+// because that's what _mm256_mul_epu32 works on. The high halves stay zero.
+
+// Converts lanes holding integers below 2^52 to doubles.
+__attribute__((target("avx2")))
+inline __m256d ToDouble(__m256i small) {
+  // Putting the integer in the mantissa of 2^52 and then subtracting 2^52 is
+  // exact, and AVX2 has no instruction for the conversion.
+  const __m256i magic = _mm256_set1_epi64x(0x4330000000000000ll);
+  return _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(small, magic)),
+                       _mm256_set1_pd(4503599627370496.0));
+}
+
+// Four copies of Random::ToUniform().
+__attribute__((target("avx2")))
+inline __m256d ToUniform(__m256i high, __m256i low) {
+  const __m256d high_bits = ToDouble(_mm256_srli_epi64(high, 5));
+  const __m256d low_bits = ToDouble(_mm256_srli_epi64(low, 6));
+  return _mm256_mul_pd(
+      _mm256_add_pd(_mm256_mul_pd(high_bits, _mm256_set1_pd(67108864.0)),
+                    low_bits),
+      _mm256_set1_pd(1.0 / 9007199254740992.0));
+}
+
+// Four copies of fast_math::Log().
+__attribute__((target("avx2")))
+inline __m256d Log(__m256d x) {
+  const __m256i bits = _mm256_castpd_si256(x);
+  __m256d exponent = _mm256_sub_pd(ToDouble(_mm256_srli_epi64(bits, 52)),
+                                   _mm256_set1_pd(1023.0));
+  __m256d mantissa = _mm256_castsi256_pd(_mm256_or_si256(
+      _mm256_and_si256(bits, _mm256_set1_epi64x(0x000FFFFFFFFFFFFFll)),
+      _mm256_set1_epi64x(0x3FF0000000000000ll)));
+  const __m256d big =
+      _mm256_cmp_pd(mantissa, _mm256_set1_pd(fast_math::kSqrt2), _CMP_GT_OQ);
+  mantissa = _mm256_blendv_pd(
+      mantissa, _mm256_mul_pd(mantissa, _mm256_set1_pd(0.5)), big);
+  exponent = _mm256_blendv_pd(
+      exponent, _mm256_add_pd(exponent, _mm256_set1_pd(1.0)), big);
+
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d s = _mm256_div_pd(_mm256_sub_pd(mantissa, one),
+                                  _mm256_add_pd(mantissa, one));
+  const __m256d s2 = _mm256_mul_pd(s, s);
+  __m256d series =
+      _mm256_set1_pd(fast_math::kLogSeries[fast_math::kLogSeriesLength - 1]);
+  for (int i = fast_math::kLogSeriesLength - 2; i >= 0; --i) {
+    series = _mm256_add_pd(_mm256_mul_pd(series, s2),
+                           _mm256_set1_pd(fast_math::kLogSeries[i]));
+  }
+  return _mm256_add_pd(
+      _mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(2.0), s), series),
+      _mm256_mul_pd(exponent, _mm256_set1_pd(fast_math::kLn2)));
+}
+
+// Four copies of fast_math::CosTwoPi().
+__attribute__((target("avx2")))
+inline __m256d CosTwoPi(__m256d x) {
+  const __m256d sign = _mm256_set1_pd(-0.0);
+  const __m256d half =
+      _mm256_andnot_pd(sign, _mm256_sub_pd(x, _mm256_set1_pd(0.5)));
+  const __m256d flip =
+      _mm256_cmp_pd(half, _mm256_set1_pd(0.25), _CMP_LT_OQ);
+  const __m256d quarter = _mm256_blendv_pd(
+      _mm256_sub_pd(_mm256_set1_pd(0.5), half), half, flip);
+  const __m256d angle =
+      _mm256_mul_pd(_mm256_set1_pd(fast_math::kTwoPi), quarter);
+  const __m256d angle2 = _mm256_mul_pd(angle, angle);
+
+  __m256d series =
+      _mm256_set1_pd(fast_math::kCosSeries[fast_math::kCosSeriesLength - 1]);
+  for (int i = fast_math::kCosSeriesLength - 2; i >= 0; --i) {
+    series = _mm256_sub_pd(_mm256_set1_pd(fast_math::kCosSeries[i]),
+                           _mm256_mul_pd(series, angle2));
+  }
+  return _mm256_blendv_pd(series, _mm256_xor_pd(series, sign), flip);
+}
+
+}  // namespace
+
+__attribute__((target("avx2")))
+void DrawAvx2(const uint64_t *seeds, const uint32_t *ticks,
+              const uint32_t *indices, uint32_t purpose, int count,
+              double *normals) {
+  const __m256i low_mask = _mm256_set1_epi64x(0xFFFFFFFFll);
+  const __m256i multiplier0 = _mm256_set1_epi64x(0xD2511F53);
+  const __m256i multiplier1 = _mm256_set1_epi64x(0xCD9E8D57);
+  const __m256i weyl0 = _mm256_set1_epi64x(0x9E3779B9);
+  const __m256i weyl1 = _mm256_set1_epi64x(0xBB67AE85);
+
+  const int vector_end = count - count % 4;
+  for (int i = 0; i < vector_end; i += 4) {
+    const __m256i seed =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(seeds + i));
+    __m256i k0 = _mm256_and_si256(seed, low_mask);
+    __m256i k1 = _mm256_srli_epi64(seed, 32);
+    __m256i c0 = _mm256_cvtepu32_epi64(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(ticks + i)));
+    __m256i c1 = _mm256_cvtepu32_epi64(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(indices + i)));
+    __m256i c2 = _mm256_set1_epi64x(purpose);
+    __m256i c3 = _mm256_setzero_si256();
+
+    // Philox4x32-10, the same as Random::Philox().
+    for (int round = 0; round < 10; ++round) {
+      const __m256i product0 = _mm256_mul_epu32(c0, multiplier0);
+      const __m256i product1 = _mm256_mul_epu32(c2, multiplier1);
+      const __m256i hi0 = _mm256_srli_epi64(product0, 32);
+      const __m256i hi1 = _mm256_srli_epi64(product1, 32);
+      c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), k0);
+      c1 = _mm256_and_si256(product1, low_mask);
+      c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), k1);
+      c3 = _mm256_and_si256(product0, low_mask);
+      // The high halves are zero, so the carries stay out of them.
+      k0 = _mm256_and_si256(_mm256_add_epi32(k0, weyl0), low_mask);
+      k1 = _mm256_and_si256(_mm256_add_epi32(k1, weyl1), low_mask);
+    }
+
+    const __m256d u1 = _mm256_sub_pd(_mm256_set1_pd(1.0), ToUniform(c0, c1));
+    const __m256d u2 = ToUniform(c2, c3);
+    const __m256d radius = _mm256_sqrt_pd(
+        _mm256_mul_pd(_mm256_set1_pd(-2.0), Log(u1)));
+    _mm256_storeu_pd(normals + i, _mm256_mul_pd(radius, CosTwoPi(u2)));
+  }
+
+  DrawScalar(seeds + vector_end, ticks + vector_end, indices + vector_end,
+             purpose, count - vector_end, normals + vector_end);
+}
+
+bool HasAvx2() { return __builtin_cpu_supports("avx2"); }
+
+#else
+
+// We're not on x86, so the vectorized version just falls back on the scalar
+// one. Nobody should be calling it anyway.
+void DrawAvx2(const uint64_t *seeds, const uint32_t *ticks,
+              const uint32_t *indices, uint32_t purpose, int count,
+              double *normals) {
+  DrawScalar(seeds, ticks, indices, purpose, count, normals);
+}
+
+bool HasAvx2() { return false; }
+
+#endif
+
+}  // namespace normal_kernel
+
+NormalKernel GetNormalKernel() {
+  // Function-local statics are initialized exactly once, even if there are
+  // multiple threads.
+  static const NormalKernel kernel = []() -> NormalKernel {
+    if (normal_kernel::HasAvx2()) {
+      return normal_kernel::DrawAvx2;
+    }
+    return normal_kernel::DrawScalar;
+  }();
+
+  return kernel;
+}
+
+}  // namespace metabolism
+}  // namespace automata
@@ -0,0 +1,55 @@
+#ifndef ECOSYSTEM_AUTOMATA_METABOLISM_NORMAL_KERNEL_H_
+#define ECOSYSTEM_AUTOMATA_METABOLISM_NORMAL_KERNEL_H_
+
+#include <stdint.h>
+
+// Defines the inner loop for drawing normally distributed numbers for a lot of
+// things at once, such as leaf areas for every plant. There are several
+// implementations, and the fastest one that the CPU we are running on supports
+// gets picked at runtime. They all give exactly the same answers.
+
+namespace automata {
+namespace metabolism {
+
+// Signature shared by every implementation of the normal kernel. Each number
+// is drawn from its own counter-based stream, the same way that the first
+// Random::Normal() draw from Random(seeds[i], ticks[i], indices[i], purpose)
+// would be, except that the log and cos in Box-Muller are approximated. (See
+// fast_math.h.)
+// seeds: The seed for each stream.
+// ticks: The tick for each stream.
+// indices: The index for each stream.
+// purpose: The Random::Purpose that every stream is for.
+// count: The number of streams in the above arrays.
+// normals: Array of size count that gets filled with numbers from a standard
+// normal distribution.
+typedef void (*NormalKernel)(const uint64_t *seeds, const uint32_t *ticks,
+                             const uint32_t *indices, uint32_t purpose,
+                             int count, double *normals);
+
+namespace normal_kernel {
+
+// Plain C++ implementation that runs anywhere.
+void DrawScalar(const uint64_t *seeds, const uint32_t *ticks,
+                const uint32_t *indices, uint32_t purpose, int count,
+                double *normals);
+// Implementation that does four streams at a time with AVX2. Only call this if
+// HasAvx2() returns true.
+void DrawAvx2(const uint64_t *seeds, const uint32_t *ticks,
+              const uint32_t *indices, uint32_t purpose, int count,
+              double *normals);
+
+// Returns: Whether this build and the CPU we are running on support the AVX2
+// implementation.
+bool HasAvx2();
+
+}  // namespace normal_kernel
+
+// Returns: The fastest normal kernel implementation that can run on this CPU.
+// It gets picked the first time this is called.
+NormalKernel GetNormalKernel();
+
+}  // namespace metabolism
+}  // namespace automata
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef ECOSYSTEM_AUTOMATA_METABOLISM_PLANT_CONSTANTS_H_
+#define ECOSYSTEM_AUTOMATA_METABOLISM_PLANT_CONSTANTS_H_
+
+// Physical constants for plant growth. Individual plants in MetabolismPool and
+// plant fields in BiomassField both use these, so they grow the same way.
+
+namespace automata {
+namespace metabolism {
+
+// Average sunlight intensity on earth's surface. (W/m^2) This number comes
+// from here: http://en.wikipedia.org/wiki/Sunlight
+constexpr double kSolarEnergy = 1120;
+// Gibbs free energy per mol of CO2 for photosynthesis.
+// (Joules)
+constexpr double kPhotosynthesisDeltaG = 114.0 * 4184;
+// Gibbs free energy for mol of glucose for respiration.
+constexpr double kRespirationDeltaG = -2880000;
+// Molecular mass of glucose. (g/mol)
+constexpr double kGlucoseMolecularMass = 180.16;
+
+}  // namespace metabolism
+}  // namespace automata
+
+#endif  // ECOSYSTEM_AUTOMATA_METABOLISM_PLANT_CONSTANTS_H_
@@ -1,7 +1,7 @@
 #ifndef ECOSYSTEM_AUTOMATA_PLANT_METABOLISM_H_
 #define ECOSYSTEM_AUTOMATA_PLANT_METABOLISM_H_
 
-#include <random>
+#include <stdint.h>
 
 #include "automata/metabolism/metabolism.h"
 
@@ -22,27 +22,18 @@ class PlantMetabolism : public Metabolism {
   // cellulose: Percent of dry biomass that is cellulose.
   // hemicellulose: Percent of dry biomass that is hemicellulose.
   // lignin: Percent of dry biomass that is lignin.
+  // seed: The seed for the simulation, which the random leaf areas are derived
+  // from.
+  // index: The index of the plant, which gives it its own random numbers.
+  // pool: The pool to keep our state in, or nullptr to get one to ourselves.
   PlantMetabolism(double mass, double efficiency, double area_mean,
                   double area_stddev, double cellulose, double hemicellulose,
-                  double lignin);
+                  double lignin, uint64_t seed = 0, uint32_t index = 0,
+                  MetabolismPool *pool = nullptr);
   virtual ~PlantMetabolism() = default;
 
   virtual void Update(int time);
   virtual void UseEnergy(double amount);
-
- private:
-  // Efficiency of photosynthesis.
-  const double efficiency_;
-
-  // Normal distribution for picking leaf area.
-  ::std::normal_distribution<double> leaf_area_curve_;
-  // Number generator for normal distributions.
-  ::std::default_random_engine generator_;
-
-  // Percent of dry biomass that is composed of these compounds.
-  const double cellulose_;
-  const double hemicellulose_;
-  const double lignin_;
 };
 
 }  // automata
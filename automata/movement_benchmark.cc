@@ -0,0 +1,149 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "automata/grid.h"
+#include "automata/organism.h"
+#include "automata/random.h"
+
+// Measures how many conflicts happen per tick, and how long each tick takes,
+// with pending-aware movement at a few different strengths. Conflicts are all
+// resolved with Organism::DefaultConflictHandler(), so predators never actually
+// eat anything. Movement factors are declared per species pair and moves are
+// evaluated in one batch, the same way that the Python code does it. The
+// results go to stderr.
+
+namespace automata {
+namespace {
+
+// The size of the grid.
+constexpr int kGridSize = 64;
+// How many of each kind of organism we have.
+constexpr int kPredators = 100;
+constexpr int kPrey = 400;
+// How many ticks to run for.
+constexpr int kTicks = 100;
+// How far away organisms can see each other.
+constexpr int kVision = 10;
+// The species identifiers that we use.
+constexpr int kPredatorSpecies = 0;
+constexpr int kPreySpecies = 1;
+
+// What we measured in a single run.
+struct Results {
+  double conflicts_per_tick;
+  // Conflicts that DefaultConflictHandler() couldn't resolve, which means that
+  // one of the organisms had to be removed.
+  double unresolved_per_tick;
+  double milliseconds_per_tick;
+};
+
+// Makes sure that something the benchmark depends on worked. Benchmarks are
+// normally built with NDEBUG, so this can't be an assert.
+// ok: Whether it worked.
+// message: What to print if it didn't.
+void Check(bool ok, const char *message) {
+  if (!ok) {
+    fprintf(stderr, "%s\n", message);
+    exit(1);
+  }
+}
+
+// Runs the simulation once.
+// pending_weight: The pending weight for every organism.
+// Returns: What we measured.
+Results RunBenchmark(double pending_weight) {
+  Grid grid(kGridSize, kGridSize);
+  grid.set_seed(1);
+
+  // Shuffle all the cells, so we can scatter things around without putting two
+  // of them in the same place.
+  ::std::vector<int> cells(kGridSize * kGridSize);
+  for (uint32_t i = 0; i < cells.size(); ++i) {
+    cells[i] = i;
+  }
+  Random random(1, 0, 0, Random::kMovement);
+  for (int i = cells.size() - 1; i > 0; --i) {
+    ::std::swap(cells[i], cells[random.Next() % (i + 1)]);
+  }
+
+  ::std::vector< ::std::unique_ptr<Organism> > organisms;
+  for (int i = 0; i < kPredators + kPrey; ++i) {
+    organisms.emplace_back(new Organism(&grid, i));
+    Organism *organism = organisms.back().get();
+    Check(organism->Initialize(cells[i] / kGridSize, cells[i] % kGridSize),
+          "Failed to place organism.");
+    organism->set_vision(kVision);
+    organism->set_species(i < kPredators ? kPredatorSpecies : kPreySpecies);
+    organism->set_pending_weight(pending_weight);
+  }
+  for (int i = 0; i < kPredators; ++i) {
+    organisms[i]->AddPrey(kPreySpecies);
+  }
+  // Predators chase their prey, and prey flee their predators.
+  grid.species_factors()->Set(kPredatorSpecies, kPreySpecies, 100, -1);
+  grid.species_factors()->Set(kPreySpecies, kPredatorSpecies, -100, -1);
+  Check(grid.Update(), "Initial grid update failed.");
+
+  uint64_t conflicts = 0;
+  uint64_t unresolved = 0;
+  const auto start = ::std::chrono::steady_clock::now();
+  for (int tick = 0; tick < kTicks; ++tick) {
+    ::std::vector<Organism *> alive;
+    for (auto &organism : organisms) {
+      if (organism->IsAlive()) {
+        alive.push_back(organism.get());
+      }
+    }
+    Check(Organism::PrepareMoves(alive), "Failed to prepare moves.");
+
+    for (auto &organism : organisms) {
+      if (!organism->IsAlive() || organism->UpdatePosition()) {
+        continue;
+      }
+      ++conflicts;
+      organism->DefaultConflictHandler();
+    }
+
+    // Anything that's still conflicted couldn't find anywhere to go, so take
+    // it out of the simulation.
+    ::std::vector<GridObject *> objects1, objects2;
+    grid.GetConflicted(&objects1, &objects2);
+    for (GridObject *object : objects2) {
+      ++unresolved;
+      Organism::FromObject(object)->Die();
+      object->RemoveFromGrid();
+    }
+
+    Check(grid.Update(), "Grid update failed.");
+  }
+  const auto end = ::std::chrono::steady_clock::now();
+
+  Results results;
+  results.conflicts_per_tick = static_cast<double>(conflicts) / kTicks;
+  results.unresolved_per_tick = static_cast<double>(unresolved) / kTicks;
+  results.milliseconds_per_tick =
+      ::std::chrono::duration<double, ::std::milli>(end - start).count() /
+      kTicks;
+  return results;
+}
+
+}  // namespace
+}  // namespace automata
+
+int main() {
+  for (double pending_weight : {1.0, 0.5, 0.0}) {
+    const automata::Results results = automata::RunBenchmark(pending_weight);
+    fprintf(stderr,
+            "Pending weight %.1f: %.2f conflicts/tick, %.2f unresolved/tick, "
+            "%.3f ms/tick\n",
+            pending_weight, results.conflicts_per_tick,
+            results.unresolved_per_tick, results.milliseconds_per_tick);
+  }
+
+  return 0;
+}
@@ -0,0 +1,168 @@
+#ifndef ECOSYSTEM_AUTOMATA_MOVEMENT_KERNEL_H_
+#define ECOSYSTEM_AUTOMATA_MOVEMENT_KERNEL_H_
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "automata/distance_table.h"
+#include "automata/factor_kernel.h"
+
+// Movement kernels decide how much a movement factor counts for at a particular
+// distance. Each kernel is a small class with an inline Weight() method, and
+// the code that uses them is templated on the kernel type, so that each one
+// gets its own fully inlined version of the inner loop.
+
+namespace automata {
+
+// Describes which kernel something uses and how it is configured. This is what
+// gets passed around at runtime. It gets turned into one of the kernel classes
+// below right before we actually use it.
+struct KernelSpec {
+  enum Type {
+    // 1 / r^5, and 10 at a distance of zero. This is the default.
+    kInversePower = 0,
+    // e^(-r / scale).
+    kExponential = 1,
+    // 1 within scale, 0 outside it.
+    kCutoff = 2,
+    // Falls off linearly from 1 at the factor to 0 at scale.
+    kLinear = 3,
+  };
+
+  KernelSpec() = default;
+  KernelSpec(Type type, double scale) : type(type), scale(scale) {}
+
+  // Which kernel to use.
+  Type type = kInversePower;
+  // The length scale of the kernel, in cells. Not used by kInversePower.
+  double scale = 0;
+};
+
+namespace movement_kernel {
+
+// A kernel whose weights are looked up in a table. This is what we use for
+// anything that would otherwise need powers or exponentials. Distances that the
+// table doesn't cover get calculated directly.
+class TableKernel {
+ public:
+  // table: The table to look weights up in.
+  explicit TableKernel(const DistanceTable *table) : table_(table) {}
+
+  double Weight(int distance_squared) const {
+    return table_->Evaluate(distance_squared);
+  }
+  const DistanceTable *table() const { return table_; }
+
+ private:
+  const DistanceTable *table_;
+};
+
+// A kernel that gives everything within a radius the same weight, and ignores
+// everything outside it. This is about as cheap as it gets.
+class CutoffKernel {
+ public:
+  // radius: The radius, in cells.
+  explicit CutoffKernel(double radius)
+      : radius_squared_(static_cast<int>(radius * radius)) {}
+
+  double Weight(int distance_squared) const {
+    return distance_squared <= radius_squared_ ? 1.0 : 0.0;
+  }
+
+ private:
+  int radius_squared_;
+};
+
+// A kernel that falls off linearly with distance.
+class LinearKernel {
+ public:
+  // radius: The distance in cells at which the weight reaches zero.
+  explicit LinearKernel(double radius) : inverse_radius_(1.0 / radius) {}
+
+  double Weight(int distance_squared) const {
+    const double weight = 1.0 - sqrt(distance_squared) * inverse_radius_;
+    return weight > 0 ? weight : 0;
+  }
+
+ private:
+  double inverse_radius_;
+};
+
+// Adds the contribution of every factor to the weight of every location. See
+// FactorKernel for the meaning of the arguments.
+template <class Kernel>
+inline void Accumulate(const Kernel &kernel, const int *factor_xs,
+                       const int *factor_ys, const double *strengths,
+                       int num_factors, const int *xs, const int *ys,
+                       int num_locations, double *weights) {
+  for (int f = 0; f < num_factors; ++f) {
+    for (int i = 0; i < num_locations; ++i) {
+      const int dx = xs[i] - factor_xs[f];
+      const int dy = ys[i] - factor_ys[f];
+      weights[i] += strengths[f] * kernel.Weight(dx * dx + dy * dy);
+    }
+  }
+}
+
+// Works out the biggest squared distance between any factor and any location.
+// See FactorKernel for the meaning of the arguments.
+// Returns: The biggest squared distance.
+inline int64_t MaxDistanceSquared(const int *factor_xs, const int *factor_ys,
+                                  int num_factors, const int *xs,
+                                  const int *ys, int num_locations) {
+  if (!num_factors || !num_locations) {
+    return 0;
+  }
+  // The farthest location from any factor is a corner of the box around all
+  // the locations.
+  int min_x = xs[0], max_x = xs[0], min_y = ys[0], max_y = ys[0];
+  for (int i = 1; i < num_locations; ++i) {
+    min_x = xs[i] < min_x ? xs[i] : min_x;
+    max_x = xs[i] > max_x ? xs[i] : max_x;
+    min_y = ys[i] < min_y ? ys[i] : min_y;
+    max_y = ys[i] > max_y ? ys[i] : max_y;
+  }
+  int64_t max_distance_squared = 0;
+  for (int f = 0; f < num_factors; ++f) {
+    const int64_t dx = ::std::max(abs(factor_xs[f] - min_x),
+                                  abs(factor_xs[f] - max_x));
+    const int64_t dy = ::std::max(abs(factor_ys[f] - min_y),
+                                  abs(factor_ys[f] - max_y));
+    max_distance_squared = ::std::max(max_distance_squared, dx * dx + dy * dy);
+  }
+  return max_distance_squared;
+}
+
+// Tables are what the vectorized factor kernels are built for.
+template <>
+inline void Accumulate<TableKernel>(const TableKernel &kernel,
+                                    const int *factor_xs, const int *factor_ys,
+                                    const double *strengths, int num_factors,
+                                    const int *xs, const int *ys,
+                                    int num_locations, double *weights) {
+  const DistanceTable *table = kernel.table();
+  if (!table->Covers(MaxDistanceSquared(factor_xs, factor_ys, num_factors, xs,
+                                        ys, num_locations))) {
+    // The vectorized kernels can only look things up in the table, so this has
+    // to be done the slow way.
+    for (int f = 0; f < num_factors; ++f) {
+      for (int i = 0; i < num_locations; ++i) {
+        const int dx = xs[i] - factor_xs[f];
+        const int dy = ys[i] - factor_ys[f];
+        weights[i] += strengths[f] * kernel.Weight(dx * dx + dy * dy);
+      }
+    }
+    return;
+  }
+
+  GetFactorKernel()(factor_xs, factor_ys, strengths, num_factors, xs, ys,
+                    num_locations, table->data(), table->size(), weights);
+}
+
+}  // namespace movement_kernel
+}  // namespace automata
+
+#endif
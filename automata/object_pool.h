@@ -0,0 +1,94 @@
+#ifndef ECOSYSTEM_AUTOMATA_OBJECT_POOL_H_
+#define ECOSYSTEM_AUTOMATA_OBJECT_POOL_H_
+
+#include <assert.h>
+
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "automata/macros.h"
+
+namespace automata {
+
+// Hands out storage for objects from big contiguous slabs, so that objects that
+// are created around the same time end up next to each other in memory.
+// Storage that is given back gets reused for the next object, so once the pool
+// has grown to the largest number of objects alive at once, creating and
+// destroying objects doesn't allocate anything. Both are constant time.
+template <class T>
+class ObjectPool {
+ public:
+  // slab_size: How many objects each slab has room for.
+  explicit ObjectPool(int slab_size = 256) : slab_size_(slab_size) {}
+  // Everything that was spawned has to be despawned before this.
+  ~ObjectPool() {
+    assert(!live_ && "Destroying a pool that still has live objects.");
+  }
+
+  // Creates a new object.
+  // args: The arguments to pass to the object's constructor.
+  // Returns: The new object.
+  template <class... Args>
+  T *Spawn(Args &&... args) {
+    if (!free_) {
+      AddSlab();
+    }
+    Block *block = free_;
+    free_ = block->next;
+    ++live_;
+    return new (&block->storage) T(::std::forward<Args>(args)...);
+  }
+  // Destroys an object that came from Spawn(), and keeps its storage for
+  // later.
+  // object: The object.
+  void Despawn(T *object) {
+    object->~T();
+    // The object is at the start of its block.
+    Block *block = reinterpret_cast<Block *>(object);
+    block->next = free_;
+    free_ = block;
+    --live_;
+  }
+
+  // Returns: How many objects are alive.
+  int live() const { return live_; }
+  // Returns: How many objects there is room for without allocating.
+  int capacity() const { return slabs_.size() * slab_size_; }
+
+ private:
+  DISSALOW_COPY_AND_ASSIGN(ObjectPool);
+
+  // Room for one object. When the object isn't alive, the room is used to
+  // link the block into the free list instead.
+  union Block {
+    typename ::std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    Block *next;
+  };
+
+  // Allocates another slab, and adds all of it to the free list.
+  void AddSlab() {
+    slabs_.emplace_back(new Block[slab_size_]);
+    Block *slab = slabs_.back().get();
+    // Link them backwards, so they get handed out in order.
+    for (int i = slab_size_ - 1; i >= 0; --i) {
+      slab[i].next = free_;
+      free_ = &slab[i];
+    }
+  }
+
+  // How many objects each slab has room for.
+  int slab_size_;
+  // All the storage we have.
+  ::std::vector< ::std::unique_ptr<Block[]> > slabs_;
+  // The first block that isn't in use.
+  Block *free_ = nullptr;
+  // How many objects are alive.
+  int live_ = 0;
+};
+
+}  //  automata
+
+#endif
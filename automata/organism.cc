@@ -1,10 +1,8 @@
 #include <assert.h>
+#include <math.h>
 #include <stdint.h>
-#include <stdio.h> // TEMP
-#include <stdlib.h>
-#include <time.h>
 
-#include <list>
+#include <algorithm>
 #include <vector>
 
 #include "automata/organism.h"
@@ -12,25 +10,98 @@
 namespace automata {
 
 Organism::Organism(Grid *grid, int index)
-    : GridObject(grid, index) {
-  srand(time(NULL));
+    : GridObject(grid, index, kOrganism),
+      movement_random_(0, 0, index, Random::kMovement) {}
+
+Organism::~Organism() { ReleaseReferences(); }
+
+bool Organism::PrepareMoves(const ::std::vector<Organism *> &organisms) {
+  if (organisms.empty()) {
+    return true;
+  }
+  Grid *grid = organisms[0]->grid_;
+
+  ::std::vector<MoveRequest *> requests;
+  for (Organism *organism : organisms) {
+    assert(organism->grid_ == grid && "Organisms are on different grids.");
+    if (!organism->IsAlive() || organism->movement_mode_ == kSampled) {
+      continue;
+    }
+
+    const int x = organism->x_;
+    const int y = organism->y_;
+    const FactorSet &factors =
+        organism->GetVisibleFactors(x, y);
+    if (organism->IsMovementCacheCurrent(x, y)) {
+      // We can probably reuse the last distribution, which is even cheaper.
+      continue;
+    }
+
+    MoveRequest *request = &organism->pending_move_;
+    request->x = x;
+    request->y = y;
+    request->factors = &factors;
+    request->levels = organism->speed_;
+    request->vision = organism->vision_;
+    request->kernel = organism->kernel_;
+    request->group = organism->species_;
+    organism->pending_move_tick_ = grid->tick();
+    organism->StampMovement(&organism->pending_move_build_,
+                            &organism->pending_move_positions_);
+    requests.push_back(request);
+  }
+
+  return grid->EvaluateMoves(requests);
 }
 
 bool Organism::UpdatePosition(int use_x /*= -1*/, int use_y /*= -1*/) {
-  int x, y;
   if (use_x < 0 || use_y < 0) {
     use_x = x_;
     use_y = y_;
   }
+  return MoveFrom(use_x, use_y, nullptr);
+}
+
+bool Organism::MoveFrom(int use_x, int use_y, const ExclusionMask *exclude) {
+  int x, y;
+  const FactorSet &factors = GetVisibleFactors(use_x, use_y);
   // This only returns false if x and y are out of range, so if it is, we have a
   // pretty serious problem.
-  printf("%d: Have %zu factors.\n", index_, factors_.size());
-  assert(grid_->MoveObject(use_x, use_y, factors_, &x, &y, speed_, vision_) &&
-         "MoveObject() failed unexpectedly.");
-
-  if (x_ == x && y_ == y) {
-    printf("Still staying in the same place.\n");
+  bool moved = true;
+  if (movement_mode_ == kSampled) {
+    moved = grid_->MoveObjectSampled(use_x, use_y, factors, GetMovementRandom(),
+                                     &x, &y, speed_, vision_,
+                                     movement_samples_, kernel_, this,
+                                     exclude);
+  } else if (IsMovementCacheCurrent(use_x, use_y)) {
+    // Nothing that we can see has moved, so only the availability of the
+    // locations could have changed, like when we retry after a conflict.
+    grid_->MoveFromCache(&movement_cache_, GetMovementRandom(), &x, &y, this,
+                         exclude);
+  } else if (pending_move_tick_ == grid_->tick() &&
+             pending_move_.x == use_x && pending_move_.y == use_y) {
+    // This move was already evaluated in a batch.
+    pending_move_tick_ = -1;
+    grid_->FinishMove(&pending_move_, GetMovementRandom(), &x, &y,
+                      &movement_cache_, this, exclude);
+    movement_cache_current_ = true;
+    movement_cache_build_ = pending_move_build_;
+    movement_cache_positions_.swap(pending_move_positions_);
+  } else {
+    // We already know that the cache is out of date, so don't make the grid
+    // look through the factors to find that out again.
+    movement_cache_.x = -1;
+    moved = grid_->MoveObject(use_x, use_y, factors, GetMovementRandom(), &x,
+                              &y, speed_, vision_, kernel_, &movement_cache_,
+                              this, exclude);
+    movement_cache_current_ = true;
+    StampMovement(&movement_cache_build_, &movement_cache_positions_);
+  }
+  assert(moved && "Moving failed unexpectedly.");
+  if (!moved) {
+    return false;
   }
+
   if (!SetPosition(x, y)) {
     return false;
   }
@@ -38,97 +109,228 @@ bool Organism::UpdatePosition(int use_x /*= -1*/, int use_y /*= -1*/) {
   return true;
 }
 
-void Organism::BlacklistOccupied(int x, int y, bool blacklisting, int levels) {
-  ::std::vector<::std::vector<GridObject *>> in_neighborhood;
-  // Once again, this should only fail if we're out of grid bounds.
-  printf("Getting neighborhood.\n");
-  assert(grid_->GetNeighborhood(x, y, &in_neighborhood,
-              levels, true) && "GetNeighborhood() failed unexpectedly.");
-  printf("Starting for loop.\n");
-  for (auto level : in_neighborhood) {
-    for (auto *object : level) {
-      int blacklist_x, blacklist_y;
-      object->get_position(&blacklist_x, &blacklist_y);
-      printf("Blacklisting: (%d, %d).\n", blacklist_x, blacklist_y);
-      grid_->SetBlacklisted(blacklist_x, blacklist_y, blacklisting);
+const FactorSet &Organism::GetVisibleFactors(int x, int y) {
+  if (skin_ >= 0 && cache_valid_ &&
+      cache_species_version_ == grid_->species_version()) {
+    // Since the cache was built, we could have gotten this much closer to any
+    // factor, and any factor could have gotten this much closer to us.
+    const double own_motion = hypot(x - cache_x_, y - cache_y_);
+    double factor_motion = 0;
+    for (uint32_t i = 0; i < cache_sources_.size(); ++i) {
+      factor_motion = ::std::max(
+          factor_motion,
+          grid_->motion_bound(cache_sources_[i]) - cache_motion_bounds_[i]);
     }
+    if (own_motion + factor_motion <= skin_) {
+      // Nothing outside the cache could have become visible.
+      return visible_factors_;
+    }
+  }
+
+  // If caching is disabled, we still have to build the set, but we don't need
+  // any extra room in it.
+  const int skin = ::std::max(skin_, 0);
+  factors_.FindVisible(x, y, vision_, skin, &visible_indices_);
+  visible_factors_.Select(factors_, visible_indices_);
+  // Any of our own factors could come into view, not just the ones that are
+  // visible now.
+  cache_sources_.clear();
+  for (int i = 0; i < factors_.size(); ++i) {
+    if (factors_.source(i)) {
+      AddCacheSource(factors_.source(i)->get_species());
+    }
+  }
+
+  // Add a factor for every member of every species that we react to, as long
+  // as it's close enough that we could see it.
+  for (const SpeciesFactor &factor :
+       grid_->species_factors()->Get(species_)) {
+    AddCacheSource(factor.source);
+    int radius = vision_ > 0 ? vision_ + skin : -1;
+    if (factor.visibility > 0 &&
+        (radius < 0 || factor.visibility + skin < radius)) {
+      radius = factor.visibility + skin;
+    }
+    grid_->FindSpecies(factor.source, x, y, radius, &member_slots_);
+    for (int slot : member_slots_) {
+      GridObject *member = grid_->GetSlotObject(slot);
+      if (member != this) {
+        visible_factors_.AddFromSource(member, factor.strength,
+                                       factor.visibility);
+      }
+    }
+  }
+
+  ++visible_builds_;
+  cache_x_ = x;
+  cache_y_ = y;
+  cache_motion_bounds_.clear();
+  for (int source : cache_sources_) {
+    cache_motion_bounds_.push_back(grid_->motion_bound(source));
   }
+  cache_species_version_ = grid_->species_version();
+  cache_valid_ = skin_ >= 0;
+
+  return visible_factors_;
+}
+
+bool Organism::IsMovementCacheCurrent(int x, int y) const {
+  if (!movement_cache_current_ || movement_cache_.x != x ||
+      movement_cache_.y != y || movement_cache_build_ != visible_builds_) {
+    return false;
+  }
+
+  // visible_factors_ hasn't been rebuilt, so it has the same factors, following
+  // the same objects, and nothing that isn't in it could have come into view.
+  // All that's left is to check that none of them have moved. Members of the
+  // species that we follow that are too far away to be in it can do whatever
+  // they want.
+  for (int i = 0; i < visible_factors_.size(); ++i) {
+    int factor_x, factor_y;
+    visible_factors_.GetPosition(i, &factor_x, &factor_y);
+    if (factor_x != movement_cache_positions_[2 * i] ||
+        factor_y != movement_cache_positions_[2 * i + 1]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Organism::StampMovement(uint32_t *build,
+                             ::std::vector<int> *positions) const {
+  *build = visible_builds_;
+  positions->clear();
+  for (int i = 0; i < visible_factors_.size(); ++i) {
+    int factor_x, factor_y;
+    visible_factors_.GetPosition(i, &factor_x, &factor_y);
+    positions->push_back(factor_x);
+    positions->push_back(factor_y);
+  }
+}
+
+void Organism::AddCacheSource(int species) {
+  if (::std::find(cache_sources_.begin(), cache_sources_.end(), species) ==
+      cache_sources_.end()) {
+    cache_sources_.push_back(species);
+  }
+}
+
+double Organism::PendingWeight(const GridObject *occupant) const {
+  if (::std::find(prey_.begin(), prey_.end(), occupant->get_species()) !=
+      prey_.end()) {
+    // We want to end up in the same place as our prey.
+    return 1.0;
+  }
+  return pending_weight_;
+}
+
+Random *Organism::GetMovementRandom() {
+  if (movement_random_tick_ != grid_->tick()) {
+    // Start a new stream for this tick.
+    movement_random_ = Random(grid_->seed(), grid_->tick(), index_,
+                              Random::kMovement);
+    movement_random_tick_ = grid_->tick();
+  }
+
+  return &movement_random_;
 }
 
 bool Organism::DefaultConflictHandler() {
   // Get the other organism that we are conflicted with.
-  printf("Checking conflict.\n");
-  Organism *organism = dynamic_cast<Organism *>(grid_->GetConflict(x_, y_));
+  Organism *organism = FromObject(GetConflict());
   if (!organism) {
     // There's no conflict to resolve.
     return false;
   }
-  if (organism == this) {
-    // We are running this on the conflicting object instead of the pending one.
-    organism = dynamic_cast<Organism *>(grid_->GetPending(x_, y_));
-  }
-
-  // In this case, we'll pick one of the organisms to move again at random.
-  int random = rand() % 2;
 
-  Organism *to_move;
-  if (random) {
-    to_move = this;
-  } else {
-    to_move = organism;
+  // In this case, we'll pick one of the organisms to move again at random. The
+  // stream is keyed on both organisms, so we flip the same coin regardless of
+  // which one of them this gets called on.
+  Organism *low = this;
+  Organism *high = organism;
+  if (high->get_index() < low->get_index()) {
+    ::std::swap(low, high);
   }
-
-  int baked_x, baked_y;
-  printf("Getting baked position.\n");
-  to_move->GetBakedPosition(&baked_x, &baked_y);
-  bool blacklisted_old = false;
-  printf("Checking pending.\n");
-  if (grid_->GetPending(baked_x, baked_y)) {
-    // We need to blacklist where we came from too.
-    grid_->SetBlacklisted(baked_x, baked_y, true);
-    blacklisted_old = true;
-  }
-
-  // Blacklist anything in the neighborhood that contains something we could
-  // conflict with.
-  printf("Blacklisting occupied.\n");
-  printf("baked: (%d, %d)\n", baked_x, baked_y);
-  BlacklistOccupied(baked_x, baked_y, true, to_move->get_speed());
+  Random random(grid_->seed(), grid_->tick(), low->get_index(),
+                Random::kConflict, high->get_index());
+  Organism *to_move = (random.Next() & 1) ? low : high;
 
   // Move based on where we were before, so we can't move farther than we should
   // be allowed to in one cycle.
-  printf("Updating position.\n");
-  if (!to_move->UpdatePosition(baked_x, baked_y)) {
-    // This means that our area is so densely populated that we
-    // literally can't move anywhere.
+  return to_move->Relocate();
+}
+
+bool Organism::Relocate() {
+  int baked_x, baked_y;
+  if (!GetBakedPosition(&baked_x, &baked_y)) {
+    // We've never been anywhere, so there's nowhere to move from.
     return false;
   }
 
-  printf("Unblacklisting old.\n");
-  if (blacklisted_old) {
-    grid_->SetBlacklisted(baked_x, baked_y, false);
-  }
-  // Unblacklist stuff.
-  printf("Unblacklisting all.\n");
-  BlacklistOccupied(baked_x, baked_y, false, to_move->get_speed());
+  // Stay away from anywhere that something is already moving to, including
+  // where we came from. The mask only applies to this move, so nothing on the
+  // grid has to be changed and then changed back.
+  ExclusionMask exclude(baked_x, baked_y, speed_);
+  grid_->ExcludePending(&exclude);
 
-  return true;
+  // If this fails, our area is so densely populated that we literally can't
+  // move anywhere.
+  return MoveFrom(baked_x, baked_y, &exclude);
 }
 
 void Organism::Die() {
   alive_ = false;
+  ReleaseReferences();
+}
+
+void Organism::CleanupOrganism(Organism &organism) {
+  // Remove any movement factors related to this organism.
+  if (factors_.RemoveSource(&organism)) {
+    // We don't have to hear about it anymore.
+    organism.RemoveReferrer(this);
+  }
+
+  // The cache might be holding references to it too.
+  visible_factors_.Clear();
+  cache_valid_ = false;
 }
 
-void Organism::CleanupOrganism(const Organism &organism) {
-  // Check to see if we have any movement factors related to this organism.
-  auto itr = factors_.begin();
-  for (; itr != factors_.end(); ++itr) {
-    if (&organism == itr->GetOrganism()) {
-      // This one has to go.
-      // Post-decrement so that it still points to something valid.
-      factors_.erase(itr--);
+void Organism::ReleaseReferences() {
+  // Everything that follows us has to let go. They don't need to tell us about
+  // it, since we're forgetting about all of them anyway.
+  for (Organism *referrer : referrers_) {
+    referrer->factors_.RemoveSource(this);
+    referrer->visible_factors_.Clear();
+    referrer->cache_valid_ = false;
+  }
+  referrers_.clear();
+
+  // Everything we follow has to stop expecting to hear from us. Factors only
+  // ever follow organisms. (See AddFactorFromOrganism().)
+  for (int i = 0; i < factors_.size(); ++i) {
+    if (factors_.source(i)) {
+      static_cast<Organism *>(factors_.source(i))->RemoveReferrer(this);
     }
   }
+  factors_.Clear();
+  visible_factors_.Clear();
+  cache_valid_ = false;
+}
+
+void Organism::AddReferrer(Organism *referrer) {
+  if (::std::find(referrers_.begin(), referrers_.end(), referrer) ==
+      referrers_.end()) {
+    referrers_.push_back(referrer);
+  }
+}
+
+void Organism::RemoveReferrer(const Organism *referrer) {
+  auto itr = ::std::find(referrers_.begin(), referrers_.end(), referrer);
+  if (itr != referrers_.end()) {
+    // Order doesn't matter here, so swap and pop.
+    *itr = referrers_.back();
+    referrers_.pop_back();
+  }
 }
 
 }  //  automata
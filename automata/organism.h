@@ -2,14 +2,15 @@
 #define ECOSYSTEM_AUTOMATA_ORGANISM_H_
 
 #include <stdint.h>
-#include <stdio.h>  // TEMP
 
-#include <list>
+#include <vector>
 
+#include "automata/factor_set.h"
 #include "automata/grid.h"
 #include "automata/grid_object.h"
 #include "automata/macros.h"
-#include "automata/movement_factor.h"
+#include "automata/movement_kernel.h"
+#include "automata/random.h"
 
 namespace automata {
 
@@ -17,19 +18,105 @@ namespace automata {
 // like grid indices and movement factors.
 class Organism : public GridObject {
  public:
+  // Ways that an organism can decide where to move.
+  enum MovementMode {
+    // Evaluate every location in the neighborhood. (See Grid::MoveObject().)
+    kExhaustive = 0,
+    // Evaluate a few locations picked at random, which is much cheaper for
+    // fast organisms. (See Grid::MoveObjectSampled().)
+    kSampled = 1,
+  };
+
   // grid:  The grid that this organism will exist in.
   // index: The organism's index in the Python code.
   Organism(Grid *grid, int index);
+  // Makes sure that nothing is left holding factors that follow us.
+  virtual ~Organism();
+  // Converts a GridObject into an Organism, using its kind tag instead of RTTI.
+  // object: The object to convert. It can be nullptr.
+  // Returns: The object as an Organism, or nullptr if it isn't one.
+  static Organism *FromObject(GridObject *object) {
+    if (!object || object->kind() != kOrganism) {
+      return nullptr;
+    }
+    return static_cast<Organism *>(object);
+  }
   // Set organism's vision.
   // vision: Organism's new vision.
-  void set_vision(int vision) { vision_ = vision; }
+  void set_vision(int vision) {
+    vision_ = vision;
+    cache_valid_ = false;
+    movement_cache_current_ = false;
+  }
   // Returns: Organism's vision.
   int get_vision() const { return vision_; }
   // Set organism's speed.
   // speed: Organism's new speed.
-  void set_speed(int speed) { speed_ = speed; }
+  void set_speed(int speed) {
+    speed_ = speed;
+    movement_cache_current_ = false;
+  }
   // Returns: Organism's speed.
   int get_speed() const { return speed_; }
+  // Set the organism's visibility skin. This is the extra distance beyond the
+  // organism's vision that we include when caching the factors that are
+  // visible to it. A bigger skin means that the cache has to be rebuilt less
+  // often, but that more factors have to be checked every time we move. A
+  // negative value disables the cache entirely.
+  // skin: The organism's new skin, in cells.
+  void set_skin(int skin) {
+    skin_ = skin;
+    cache_valid_ = false;
+  }
+  // Returns: The organism's visibility skin.
+  int get_skin() const { return skin_; }
+  // Sets how the organism decides where to move.
+  // mode: The new movement mode.
+  // samples: How many locations to propose for each move in kSampled mode.
+  void set_movement_mode(MovementMode mode, int samples = 16) {
+    movement_mode_ = mode;
+    movement_samples_ = samples;
+  }
+  // Returns: The organism's movement mode.
+  MovementMode get_movement_mode() const { return movement_mode_; }
+  // Sets how the weights of the organism's movement factors fall off with
+  // distance.
+  // type: The type of kernel to use.
+  // scale: The length scale of the kernel, in cells. See KernelSpec.
+  void set_kernel(KernelSpec::Type type, double scale = 0) {
+    kernel_ = KernelSpec(type, scale);
+    movement_cache_current_ = false;
+  }
+  // Returns: The organism's movement kernel.
+  const KernelSpec &get_kernel() const { return kernel_; }
+  // Adds a species that this organism eats. It never minds moving to cells
+  // that members of that species are moving to.
+  // species: The species identifier of the prey.
+  void AddPrey(int species) { prey_.push_back(species); }
+  // Sets how willing the organism is to move to cells that something other
+  // than its prey is already moving to.
+  // weight: A multiplier for the probability of moving to those cells. 1
+  // treats them like any other cell, 0 avoids them completely, and anything in
+  // between makes them less likely.
+  void set_pending_weight(double weight) { pending_weight_ = weight; }
+  // Returns: The organism's pending weight.
+  double get_pending_weight() const { return pending_weight_; }
+  // See GridObject::PendingWeight(). Cells that our prey is moving to always
+  // get a weight of 1, and everything else gets our pending weight.
+  virtual double PendingWeight(const GridObject *occupant) const;
+  // See GridObject::Relocate(). Moves again from where we are baked, avoiding
+  // anywhere that something else is already moving to.
+  virtual bool Relocate();
+  // Evaluates the next move for a whole batch of organisms at once, which is a
+  // lot faster than having each of them do it separately. (See
+  // Grid::EvaluateMoves().) The next call to UpdatePosition() on each organism
+  // this tick uses the evaluated move instead of starting from scratch.
+  // Organisms in kSampled mode, ones that are dead, and ones whose cached
+  // distribution is still good are skipped.
+  // organisms: The organisms to evaluate moves for. They all have to be on the
+  // same grid.
+  // Returns: true if the moves were evaluated successfully.
+  static bool PrepareMoves(const ::std::vector<Organism *> &organisms);
   // Calculates if the organism should move, and where it should move.
   // use_x: Allows user to specify a custom position to calculate movement from.
   // use_y: See use_x.
@@ -42,8 +129,8 @@ class Organism : public GridObject {
   // visibility: How far away the factor can be perceived by this organism, in
   // cells. A negative value means there is no limit.
   inline void AddFactor(int x, int y, int strength, int visibility = -1) {
-    MovementFactor factor(x, y, strength, visibility);
-    factors_.push_back(factor);
+    factors_.Add(x, y, strength, visibility);
+    cache_valid_ = false;
   }
   // Creates a movement factor from an organism, and adds it as a factor to this
   // organism.
@@ -53,17 +140,28 @@ class Organism : public GridObject {
   // cells. A negative value means there is no limit.
   inline void AddFactorFromOrganism(Organism *organism, int strength,
                                     int visibility = -1) {
-    MovementFactor factor(organism, strength, visibility);
-    factors_.push_back(factor);
-    printf("%d: We now have %zu factors.\n", index_, factors_.size());
+    factors_.AddFromSource(organism, strength, visibility);
+    organism->AddReferrer(this);
+    cache_valid_ = false;
   }
-  const ::std::list<MovementFactor> &factors() const { return factors_; }
+  const FactorSet &factors() const { return factors_; }
+  // Gets a set of factors that contains at least every factor that is visible
+  // from a particular location. This includes our own factors, as well as one
+  // for every member of another species that our species feels a factor from.
+  // (See Grid::species_factors().) The set is cached, and only gets rebuilt
+  // when we or any of our factors could have moved farther than our skin since
+  // the last time it was built, or when new species members show up. Only
+  // motion in the species that our factors come from counts.
+  // x: The x coordinate of the location.
+  // y: The y coordinate of the location.
+  // Returns: The set of possibly visible factors.
+  const FactorSet &GetVisibleFactors(int x, int y);
   // Cleans up any references this organism contains to a specified other
   // organism. For now, it only removes movement factors. This is generally
   // called because that organism is being destructed, and all those references
   // are about to become dead pointers.
   // organism: The organism we want to remove references to.
-  void CleanupOrganism(const Organism &organism);
+  void CleanupOrganism(Organism &organism);
   // A default handler for conflicts on the grid between this organism and
   // another. It resolves the conflict by forcing a random one of them to
   // move again. This method can be called on either organism involved in a
@@ -71,7 +169,13 @@ class Organism : public GridObject {
   // Returns: false if it fails to update the position of the organism it is
   // moving, or if it finds that this organism is not conflicted.
   bool DefaultConflictHandler();
-  // Specifies that this particular organism has died and is now defunct.
+  // Removes every reference that other organisms hold to this one, and every
+  // reference that this one holds to others. Only the organisms that actually
+  // hold factors that follow this one get touched.
+  void ReleaseReferences();
+  // Specifies that this particular organism has died and is now defunct. This
+  // also releases all of its references, so nothing needs to clean up after
+  // it.
   void Die();
   // Returns: Whether or not the organism is alive.
   inline bool IsAlive() const {
@@ -81,24 +185,109 @@ class Organism : public GridObject {
  private:
   DISSALOW_COPY_AND_ASSIGN(Organism);
 
-  // (Un)blacklists every space in an organism's neighborhood that contains
-  // something that would generate a conflict if the organism tried to move
-  // there. Conflict handlers will run at the end of a cycle when blacklisting
-  // flags are about to get cleared anyway, so it's okay to mess with them.
-  // x: The x coordinate of the center of the neighborhood.
-  // y: The y coordinate of the center of the neighborhood.
-  // blacklist: True if we're blacklisting, false if we're unblacklisting.
-  // levels: How many levels to use when calculating the neighborhood.
-  void BlacklistOccupied(int x, int y, bool blacklisting, int levels);
+  // Decides where to move from a particular location, and moves there.
+  // use_x: The x coordinate of the location.
+  // use_y: The y coordinate of the location.
+  // exclude: Cells that we aren't allowed to move to. Can be nullptr.
+  // Returns: true if the movement calculations were successful.
+  bool MoveFrom(int use_x, int use_y, const ExclusionMask *exclude);
+  // Records that another organism holds factors that follow this one.
+  // referrer: The other organism.
+  void AddReferrer(Organism *referrer);
+  // Records that another organism no longer holds factors that follow this
+  // one.
+  // referrer: The other organism.
+  void RemoveReferrer(const Organism *referrer);
+  // Checks whether movement_cache_ can be used for a move. It only has to
+  // check where the factors in visible_factors_ are, not work out which of them
+  // are visible or how much they weigh, so it's a lot cheaper than
+  // Grid::IsCacheCurrent().
+  // x: The x coordinate of the location that we're moving from.
+  // y: The y coordinate of the location that we're moving from.
+  // Returns: true if nothing that went into movement_cache_ has changed.
+  bool IsMovementCacheCurrent(int x, int y) const;
+  // Records what a distribution is being worked out from right now, so that
+  // IsMovementCacheCurrent() can tell later whether it's still good.
+  // build: Set to the current value of visible_builds_.
+  // positions: Filled with the position of every factor in visible_factors_,
+  // as x, y pairs.
+  void StampMovement(uint32_t *build, ::std::vector<int> *positions) const;
+  // Adds a species to cache_sources_, if it isn't there already.
+  // species: The species, or -1 for objects that don't have one.
+  void AddCacheSource(int species);
+  // Returns: The random number stream that we use for movement in the current
+  // tick. Every draw we make during a tick continues the same stream, so moving
+  // more than once in a tick doesn't repeat numbers.
+  Random *GetMovementRandom();
 
   // The set of movement factors on this grid that could possibly affect this
   // organism.
-  ::std::list<MovementFactor> factors_;
+  FactorSet factors_;
+  // The organisms that have factors in their factors_ that follow us.
+  ::std::vector<Organism *> referrers_;
   // Maximum distance in cells that the organism can perceive things. Negative
   // means that there is no limit.
   int vision_ = -1;
   // Maximum distance in cells that the organism can move at one time.
   uint32_t speed_ = 1;
+
+  // Cached set of the factors that are within our vision plus our skin.
+  FactorSet visible_factors_;
+  // The indices in factors_ of the ones that went into visible_factors_. This
+  // is only kept around so that rebuilding the cache doesn't allocate.
+  ::std::vector<int> visible_indices_;
+  // Whether visible_factors_ can be used at all.
+  bool cache_valid_ = false;
+  // The location that visible_factors_ was built around.
+  int cache_x_ = -1;
+  int cache_y_ = -1;
+  // The species that anything in visible_factors_ could follow, including ones
+  // that were too far away to make it in, and the grid's motion bound for each
+  // of them at the time it was built. (See Grid::motion_bound().)
+  ::std::vector<int> cache_sources_;
+  ::std::vector<double> cache_motion_bounds_;
+  // The grid's species version at the time visible_factors_ was built.
+  uint32_t cache_species_version_ = 0;
+  // How many times visible_factors_ has been built.
+  uint32_t visible_builds_ = 0;
+  // The slots of species members that we found while building
+  // visible_factors_. This is only kept around so that we don't allocate.
+  ::std::vector<int> member_slots_;
+  // Extra distance in cells that we include in visible_factors_.
+  int skin_ = 2;
+
+  // How we decide where to move.
+  MovementMode movement_mode_ = kExhaustive;
+  // How many locations we propose in kSampled mode.
+  int movement_samples_ = 16;
+  // How our factors get weighted.
+  KernelSpec kernel_;
+  // The distribution from our last move, which we can reuse if nothing
+  // changes.
+  MovementCache movement_cache_;
+  // Whether movement_cache_ has been filled in since our movement settings
+  // last changed.
+  bool movement_cache_current_ = false;
+  // What movement_cache_ was worked out from. (See StampMovement().)
+  uint32_t movement_cache_build_ = 0;
+  ::std::vector<int> movement_cache_positions_;
+  // The species that we eat.
+  ::std::vector<int> prey_;
+  // How willing we are to move to cells that something other than our prey is
+  // already moving to.
+  double pending_weight_ = 1.0;
+  // A move that was evaluated for us by PrepareMoves().
+  MoveRequest pending_move_;
+  // The tick that pending_move_ is for, or -1 if we don't have one.
+  int64_t pending_move_tick_ = -1;
+  // What pending_move_ was worked out from. (See StampMovement().)
+  uint32_t pending_move_build_ = 0;
+  ::std::vector<int> pending_move_positions_;
+
+  // Random number stream for movement.
+  Random movement_random_;
+  // The tick that movement_random_ was created for.
+  int64_t movement_random_tick_ = -1;
   // Whether the organism is alive.
   bool alive_ = true;
 };
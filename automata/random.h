@@ -0,0 +1,133 @@
+#ifndef ECOSYSTEM_AUTOMATA_RANDOM_H_
+#define ECOSYSTEM_AUTOMATA_RANDOM_H_
+
+#include <math.h>
+#include <stdint.h>
+
+// Counter-based random number generation. Instead of having one generator with
+// shared state that everything draws from in whatever order things happen to
+// get updated, every random number is a pure function of the run seed and a
+// counter that says exactly what the number is for. That way, runs with the
+// same seed always turn out the same, no matter what order things get updated
+// in or how many threads are doing the updating.
+
+// This is all inline so that both the automata and metabolism libraries can use
+// it without depending on each other.
+
+namespace automata {
+
+// A stream of random numbers, generated with the Philox4x32-10 algorithm from
+// Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3". Each stream is
+// identified by (seed, tick, index, purpose), and streams with different
+// identifiers are independent.
+class Random {
+ public:
+  // Things we draw random numbers for. Every purpose gets its own stream, so
+  // adding draws for one thing never changes the numbers we get for another.
+  enum Purpose {
+    kMovement = 0,
+    kConflict = 1,
+    kLeafArea = 2,
+  };
+
+  // seed: The seed for the whole run.
+  // tick: Which iteration of the simulation we are on.
+  // index: The index of the object that we are drawing numbers for.
+  // purpose: What the numbers are going to be used for.
+  // substream: Optional extra identifier, for when one object needs more than
+  // one stream for the same purpose in the same tick. Only the lower 24 bits
+  // are used.
+  Random(uint64_t seed, uint32_t tick, uint32_t index, Purpose purpose,
+         uint32_t substream = 0) {
+    key_[0] = static_cast<uint32_t>(seed);
+    key_[1] = static_cast<uint32_t>(seed >> 32);
+    counter_[0] = tick;
+    counter_[1] = index;
+    counter_[2] = static_cast<uint32_t>(purpose) | (substream << 8);
+    counter_[3] = 0;
+  }
+
+  // Returns: The next 32 random bits from the stream.
+  uint32_t Next() {
+    if (used_ == 4) {
+      Philox(counter_, key_, buffer_);
+      ++counter_[3];
+      used_ = 0;
+    }
+    return buffer_[used_++];
+  }
+  // Returns: A random number uniformly distributed in [0, 1).
+  double Uniform() {
+    const uint32_t high = Next();
+    return ToUniform(high, Next());
+  }
+  // Returns: A random number from a normal distribution.
+  // mean: The mean of the distribution.
+  // stddev: The standard deviation of the distribution.
+  double Normal(double mean, double stddev) {
+    // Box-Muller. We throw away the second number instead of caching it, which
+    // keeps the stream position a simple function of the number of draws.
+    const double u1 = 1.0 - Uniform();
+    const double u2 = Uniform();
+    return mean + stddev * sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+  }
+
+  // Turns two random words into a number uniformly distributed in [0, 1), the
+  // same way that Uniform() does. This is for code that generates whole
+  // blocks with Philox() itself.
+  // high: The first word.
+  // low: The second word.
+  // Returns: The uniform number.
+  static double ToUniform(uint32_t high, uint32_t low) {
+    // Use 53 bits, so we get every double in the range with equal probability.
+    return (static_cast<uint64_t>(high >> 5) * 67108864.0 + (low >> 6)) *
+           (1.0 / 9007199254740992.0);
+  }
+
+  // The raw Philox4x32-10 bijection.
+  // counter: The four word counter to encrypt.
+  // key: The two word key to encrypt it with.
+  // output: Filled with the four resulting words.
+  static void Philox(const uint32_t counter[4], const uint32_t key[2],
+                     uint32_t output[4]) {
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2],
+             c3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int round = 0; round < 10; ++round) {
+      const uint64_t product0 = static_cast<uint64_t>(kMultiplier0) * c0;
+      const uint64_t product1 = static_cast<uint64_t>(kMultiplier1) * c2;
+      const uint32_t hi0 = product0 >> 32, lo0 = product0;
+      const uint32_t hi1 = product1 >> 32, lo1 = product1;
+      c0 = hi1 ^ c1 ^ k0;
+      c1 = lo1;
+      c2 = hi0 ^ c3 ^ k1;
+      c3 = lo0;
+      k0 += kWeyl0;
+      k1 += kWeyl1;
+    }
+    output[0] = c0;
+    output[1] = c1;
+    output[2] = c2;
+    output[3] = c3;
+  }
+
+ private:
+  // Constants for Philox4x32.
+  static constexpr uint32_t kMultiplier0 = 0xD2511F53;
+  static constexpr uint32_t kMultiplier1 = 0xCD9E8D57;
+  static constexpr uint32_t kWeyl0 = 0x9E3779B9;
+  static constexpr uint32_t kWeyl1 = 0xBB67AE85;
+
+  // The key, which is the seed.
+  uint32_t key_[2];
+  // The counter, which identifies the stream and our position in it.
+  uint32_t counter_[4];
+  // The output of the last block we generated.
+  uint32_t buffer_[4];
+  // How many words from buffer_ we have used.
+  int used_ = 4;
+};
+
+}  // namespace automata
+
+#endif
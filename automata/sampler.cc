@@ -0,0 +1,147 @@
+#include <assert.h>
+
+#include <algorithm>
+
+#include "automata/sampler.h"
+
+namespace automata {
+
+void DiscreteSampler::Reset(const double *weights, int size) {
+  assert(size > 0 && "Cannot sample from an empty distribution.");
+
+  weights_.assign(weights, weights + size);
+  total_ = 0;
+  for (double weight : weights_) {
+    total_ += weight;
+  }
+
+  cumulative_.clear();
+  keep_.clear();
+  alias_.clear();
+  draws_ = 0;
+}
+
+int DiscreteSampler::Sample(double random, Method *method /*= nullptr*/) {
+  ++draws_;
+
+  Method used;
+  int index;
+  if (size() <= kMaxLinearSize) {
+    // Anything fancy would cost more than it saves.
+    used = kLinear;
+    index = SampleLinear(random);
+  } else if (draws_ == 1) {
+    // We might never get sampled again, so only do the O(n) setup that pays
+    // off for a single draw.
+    BuildCumulative();
+    used = kBinarySearch;
+    index = SampleBinarySearch(random);
+  } else {
+    // We're getting reused, so it's worth building the alias table.
+    if (alias_.empty()) {
+      BuildAlias();
+    }
+    used = kAlias;
+    index = SampleAlias(random);
+  }
+
+  if (method) {
+    *method = used;
+  }
+  return index;
+}
+
+void DiscreteSampler::BuildCumulative() {
+  cumulative_.resize(weights_.size());
+  double running_total = 0;
+  for (uint32_t i = 0; i < weights_.size(); ++i) {
+    running_total += weights_[i];
+    cumulative_[i] = running_total;
+  }
+}
+
+void DiscreteSampler::BuildAlias() {
+  // Vose's method. Scale everything so the average weight is one, and then
+  // pair up entries that are below average with ones that are above it.
+  const int n = size();
+  keep_.resize(n);
+  alias_.resize(n);
+
+  ::std::vector<double> scaled(n);
+  ::std::vector<int> small, large;
+  small.reserve(n);
+  large.reserve(n);
+  for (int i = 0; i < n; ++i) {
+    scaled[i] = weights_[i] * n / total_;
+    if (scaled[i] < 1.0) {
+      small.push_back(i);
+    } else {
+      large.push_back(i);
+    }
+  }
+
+  while (!small.empty() && !large.empty()) {
+    const int less = small.back();
+    small.pop_back();
+    const int more = large.back();
+    large.pop_back();
+
+    keep_[less] = scaled[less];
+    alias_[less] = more;
+
+    // The large entry gives up whatever it used to fill the small one.
+    scaled[more] = (scaled[more] + scaled[less]) - 1.0;
+    if (scaled[more] < 1.0) {
+      small.push_back(more);
+    } else {
+      large.push_back(more);
+    }
+  }
+
+  // Whatever is left over is one, give or take floating point error.
+  for (int i : large) {
+    keep_[i] = 1.0;
+    alias_[i] = i;
+  }
+  for (int i : small) {
+    keep_[i] = 1.0;
+    alias_[i] = i;
+  }
+}
+
+int DiscreteSampler::SampleLinear(double random) const {
+  // Count up until we're above it.
+  const double target = random * total_;
+  double running_total = 0;
+  for (uint32_t i = 0; i < weights_.size(); ++i) {
+    running_total += weights_[i];
+    if (running_total > target) {
+      return i;
+    }
+  }
+
+  // Floating point weirdness could get us here...
+  return weights_.size() - 1;
+}
+
+int DiscreteSampler::SampleBinarySearch(double random) const {
+  const double target = random * total_;
+  const auto itr =
+      ::std::upper_bound(cumulative_.begin(), cumulative_.end(), target);
+  if (itr == cumulative_.end()) {
+    // Same floating point weirdness as above.
+    return weights_.size() - 1;
+  }
+  return itr - cumulative_.begin();
+}
+
+int DiscreteSampler::SampleAlias(double random) const {
+  // Use the integer part to pick a column, and the fractional part to pick
+  // within it.
+  const double scaled = random * size();
+  const int column = ::std::min(static_cast<int>(scaled), size() - 1);
+  const double fraction = scaled - column;
+  return fraction < keep_[column] ? column : alias_[column];
+}
+
+}  // namespace automata
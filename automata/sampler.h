@@ -0,0 +1,73 @@
+#ifndef ECOSYSTEM_AUTOMATA_SAMPLER_H_
+#define ECOSYSTEM_AUTOMATA_SAMPLER_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+namespace automata {
+
+// Picks indices at random from a discrete distribution. How it does that
+// depends on how big the distribution is and how many times it gets sampled:
+// Small distributions just get scanned. Bigger ones get a table of cumulative
+// probabilities that can be binary searched. If the same distribution gets
+// sampled more than once, we build a Vose alias table the second time, which
+// makes every draw after that constant time.
+class DiscreteSampler {
+ public:
+  // The ways we can draw from the distribution.
+  enum Method {
+    kLinear = 0,
+    kBinarySearch = 1,
+    kAlias = 2,
+  };
+
+  // Distributions with at most this many entries just get scanned.
+  static constexpr int kMaxLinearSize = 32;
+
+  // Makes an empty sampler. Reset() must be called before it can be used.
+  DiscreteSampler() = default;
+
+  // Sets the distribution that we are sampling from. This invalidates anything
+  // that was built for the previous distribution.
+  // weights: The weight of each index. These don't have to sum to one, but
+  // they can't be negative, and at least one has to be positive.
+  // size: The number of weights.
+  void Reset(const double *weights, int size);
+  // Draws an index from the distribution.
+  // random: A random number in [0, 1).
+  // method: Set to the method that was used to draw the index. Can be nullptr.
+  // Returns: The index that got picked.
+  int Sample(double random, Method *method = nullptr);
+
+  // Returns: The number of entries in the distribution.
+  int size() const { return weights_.size(); }
+
+ private:
+  // Builds the table of cumulative weights.
+  void BuildCumulative();
+  // Builds the alias table.
+  void BuildAlias();
+
+  // Draws using each of the methods.
+  int SampleLinear(double random) const;
+  int SampleBinarySearch(double random) const;
+  int SampleAlias(double random) const;
+
+  // The distribution we're sampling from.
+  ::std::vector<double> weights_;
+  // The sum of weights_.
+  double total_ = 0;
+  // Running totals of weights_, if we've built them.
+  ::std::vector<double> cumulative_;
+  // For each index, the probability that we keep it when it gets picked in the
+  // alias method, and the index we use instead if we don't.
+  ::std::vector<double> keep_;
+  ::std::vector<int> alias_;
+  // How many times we've sampled since the last Reset().
+  int draws_ = 0;
+};
+
+}  // namespace automata
+
+#endif
@@ -0,0 +1,50 @@
+#include <assert.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "automata/species_factors.h"
+
+namespace automata {
+
+void SpeciesFactors::Set(int observer, int source, int strength,
+                         int visibility) {
+  assert(observer >= 0 && source >= 0 && "Invalid species.");
+
+  if (observer >= static_cast<int>(factors_.size())) {
+    factors_.resize(observer + 1);
+  }
+
+  ::std::vector<SpeciesFactor> &factors = factors_[observer];
+  for (SpeciesFactor &factor : factors) {
+    if (factor.source == source) {
+      // We already have one, so just change it.
+      factor.strength = strength;
+      factor.visibility = visibility;
+      return;
+    }
+  }
+  factors.push_back({source, strength, visibility});
+}
+
+void SpeciesFactors::Remove(int observer, int source) {
+  if (observer < 0 || observer >= static_cast<int>(factors_.size())) {
+    return;
+  }
+
+  ::std::vector<SpeciesFactor> &factors = factors_[observer];
+  factors.erase(::std::remove_if(factors.begin(), factors.end(),
+                                 [source](const SpeciesFactor &factor) {
+                                   return factor.source == source;
+                                 }),
+                factors.end());
+}
+
+const ::std::vector<SpeciesFactor> &SpeciesFactors::Get(int observer) const {
+  if (observer < 0 || observer >= static_cast<int>(factors_.size())) {
+    return none_;
+  }
+  return factors_[observer];
+}
+
+}  //  automata
@@ -0,0 +1,58 @@
+#ifndef ECOSYSTEM_AUTOMATA_SPECIES_FACTORS_H_
+#define ECOSYSTEM_AUTOMATA_SPECIES_FACTORS_H_
+
+#include <vector>
+
+#include "automata/macros.h"
+
+namespace automata {
+
+// A movement factor that every member of one species feels from every member
+// of another one.
+struct SpeciesFactor {
+  // The species that the factor comes from.
+  int source;
+  // The factor's strength. Positive means attractive, negative means
+  // repulsive.
+  int strength;
+  // How far away the factor can be perceived from, in cells. A negative value
+  // means there is no limit.
+  int visibility;
+};
+
+// A table of the movement factors that members of each species feel from
+// members of other species. Organisms look these up when they move, so we only
+// need one entry for each pair of species, instead of one factor for every pair
+// of organisms.
+class SpeciesFactors {
+ public:
+  SpeciesFactors() = default;
+
+  // Sets the factor that members of one species feel from members of another
+  // one, replacing any that was set before.
+  // observer: The species that feels the factor.
+  // source: The species that the factor comes from.
+  // strength: The factor's strength.
+  // visibility: How far away the factor can be perceived from.
+  void Set(int observer, int source, int strength, int visibility);
+  // Removes the factor that members of one species feel from members of
+  // another one, if there is one.
+  // observer: The species that feels the factor.
+  // source: The species that the factor comes from.
+  void Remove(int observer, int source);
+  // observer: The species that feels the factors.
+  // Returns: Every factor that members of the species feel.
+  const ::std::vector<SpeciesFactor> &Get(int observer) const;
+
+ private:
+  DISSALOW_COPY_AND_ASSIGN(SpeciesFactors);
+
+  // The factors that each species feels, indexed by species.
+  ::std::vector< ::std::vector<SpeciesFactor> > factors_;
+  // What we return for species that don't feel any factors.
+  ::std::vector<SpeciesFactor> none_;
+};
+
+}  //  automata
+
+#endif
@@ -1,25 +1,56 @@
 %module automata
+%include stdint.i
 %include typemaps.i
 %include std_vector.i
 
 %{
+#include "../conflict_policy.h"
 #include "../grid.h"
 #include "../grid_object.h"
+#include "../object_pool.h"
 #include "../organism.h"
+#include "../species_factors.h"
 #include "../metabolism/plant_metabolism.h"
 #include "../metabolism/animal_metabolism.h"
+#include "../metabolism/biomass_field.h"
+#include "../metabolism/metabolism_pool.h"
 using namespace ::automata;
 using namespace ::automata::metabolism;
+
+// Organisms that Python creates all come out of the same pool. It never gets
+// destroyed, so it doesn't matter what order Python cleans things up in when
+// it exits.
+static ObjectPool<Organism> *GetOrganismPool() {
+  static ObjectPool<Organism> *pool = new ObjectPool<Organism>();
+  return pool;
+}
+
+// Metabolisms that Python creates all live in the same pool, so that they can
+// all be updated at once. Like the organism pool, it never gets destroyed.
+static MetabolismPool *GetMetabolismPool() {
+  static MetabolismPool *pool = new MetabolismPool();
+  return pool;
+}
 %}
 
 %include metabolism.i
 
 class GridObject {
  public:
+  enum Kind {
+    kObject = 0,
+    kOrganism = 1,
+  };
+
   GridObject(Grid *grid, int index);
   bool Initialize(int x, int y);
   void set_index(int index);
   int get_index() const;
+  void set_species(int species);
+  int get_species() const;
+  Kind kind() const;
+  int slot() const;
+  uint32_t handle() const;
   bool SetPosition(int x, int y);
   void get_position(int *OUTPUT, int *OUTPUT) const;
   bool RemoveFromGrid();
@@ -30,9 +61,28 @@ namespace std {
   %template(GridObjectVector) vector<GridObject *>;
 }
 
+struct KernelSpec {
+  enum Type {
+    kInversePower = 0,
+    kExponential = 1,
+    kCutoff = 2,
+    kLinear = 3,
+  };
+
+  KernelSpec();
+  KernelSpec(Type type, double scale);
+
+  Type type;
+  double scale;
+};
+
 class Organism : public GridObject {
  public:
-  Organism(Grid *grid, int index);
+  enum MovementMode {
+    kExhaustive = 0,
+    kSampled = 1,
+  };
+
   bool Initialize(int x, int y);
   void set_index(int index);
   int get_index() const;
@@ -40,17 +90,97 @@ class Organism : public GridObject {
   int get_vision() const;
   void set_speed(int speed);
   int get_speed() const;
+  void set_skin(int skin);
+  int get_skin() const;
+  void set_movement_mode(MovementMode mode, int samples = 16);
+  MovementMode get_movement_mode() const;
+  void set_kernel(KernelSpec::Type type, double scale = 0);
+  const KernelSpec &get_kernel() const;
+  void AddPrey(int species);
+  void set_pending_weight(double weight);
+  double get_pending_weight() const;
   bool SetPosition(int x, int y);
   void get_position(int *OUTPUT, int *OUTPUT) const;
+  static bool PrepareMoves(const ::std::vector<Organism *> &organisms);
   bool UpdatePosition(int use_x = -1, int use_y = -1);
   void AddFactor(int x, int y, int strength, int visibility = -1);
   void AddFactorFromOrganism(Organism *organism, int strength,
       int visibility = -1);
   bool DefaultConflictHandler();
+  void ReleaseReferences();
   void Die();
   bool IsAlive() const;
   GridObject *GetConflict();
-  void CleanupOrganism(const Organism &organism);
+  void CleanupOrganism(Organism &organism);
+};
+
+%extend Organism {
+  Organism(Grid *grid, int index) {
+    return GetOrganismPool()->Spawn(grid, index);
+  }
+  ~Organism() {
+    GetOrganismPool()->Despawn($self);
+  }
+}
+
+namespace std {
+  %template(OrganismVector) vector<Organism *>;
+}
+
+struct GridStats {
+  uint64_t linear_samples;
+  uint64_t binary_search_samples;
+  uint64_t alias_samples;
+  uint64_t proposals;
+  uint64_t accepted_proposals;
+  uint64_t cache_hits;
+  uint64_t cache_renormalizations;
+  uint64_t cache_misses;
+};
+
+class ConflictPolicy {
+ public:
+  enum Action {
+    kRandomLoser = 0,
+    kEat = 1,
+    kSwap = 2,
+    kRetreat = 3,
+    kCustom = 4,
+  };
+
+  ConflictPolicy();
+  void Set(int species1, int species2, Action action);
+  Action Get(int species1, int species2) const;
+  void set_default_action(Action action);
+  Action get_default_action() const;
+};
+
+struct ConflictRound {
+  int conflicts;
+  int eaten;
+  int swapped;
+  int retreated;
+  int relocated;
+  int custom;
+  int failed;
+};
+
+namespace std {
+  %template(ConflictRoundVector) vector<ConflictRound>;
+}
+
+struct ConflictResults {
+  ::std::vector<ConflictRound> rounds;
+  ::std::vector<GridObject *> eaters;
+  ::std::vector<GridObject *> eaten;
+  ::std::vector<GridObject *> custom1;
+  ::std::vector<GridObject *> custom2;
+};
+
+class SpeciesFactors {
+ public:
+  void Set(int observer, int source, int strength, int visibility);
+  void Remove(int observer, int source);
 };
 
 class Grid {
@@ -60,15 +190,23 @@ class Grid {
   void GetConflicted(::std::vector<GridObject *> *OUTPUT,
       ::std::vector<GridObject *> *OUTPUT);
   bool Update();
+  bool ResolveConflicts(const ConflictPolicy &policy, ConflictResults *results,
+                        int max_rounds = 8);
+  void set_seed(uint64_t seed);
+  uint64_t seed() const;
+  uint32_t tick() const;
+  const GridStats &stats() const;
+  void ResetStats();
   double scale() const;
   void set_scale(double scale);
+  SpeciesFactors *species_factors();
+  GridObject *ResolveHandle(uint32_t handle) const;
 };
 
+MetabolismPool *GetMetabolismPool();
+
 class PlantMetabolism : public Metabolism {
  public:
-  PlantMetabolism(double mass, double efficiency, double area_mean,
-                  double area_stddev, double cellulose, double hemicellulose,
-                  double lignin);
   ~PlantMetabolism();
   void Update(int time);
   void UseEnergy(double amount);
@@ -76,10 +214,18 @@ class PlantMetabolism : public Metabolism {
   double energy() const;
 };
 
+%extend PlantMetabolism {
+  PlantMetabolism(double mass, double efficiency, double area_mean,
+                  double area_stddev, double cellulose, double hemicellulose,
+                  double lignin, uint64_t seed = 0, uint32_t index = 0) {
+    return new PlantMetabolism(mass, efficiency, area_mean, area_stddev,
+                               cellulose, hemicellulose, lignin, seed, index,
+                               GetMetabolismPool());
+  }
+}
+
 class AnimalMetabolism : public Metabolism {
  public:
-  AnimalMetabolism(double mass, double fat_mass, double body_temp,
-                  double scale, double drag_coefficient);
   ~AnimalMetabolism();
   void Update(int time);
   void UseEnergy(double amount);
@@ -89,3 +235,27 @@ class AnimalMetabolism : public Metabolism {
   void Consume(Metabolism *metabolism);
   void Move(double distance, int time);
 };
+
+class BiomassField {
+ public:
+  BiomassField(int x_size, int y_size, double mass, double max_mass,
+               double efficiency, double area_mean, double cellulose,
+               double hemicellulose, double lignin);
+
+  void Update(int time);
+  double Graze(int x, int y, double fraction);
+
+  double mass(int x, int y) const;
+  double energy(int x, int y) const;
+  double total_mass() const;
+  int x_size() const;
+  int y_size() const;
+};
+
+%extend AnimalMetabolism {
+  AnimalMetabolism(double mass, double fat_mass, double body_temp,
+                   double scale, double drag_coefficient) {
+    return new AnimalMetabolism(mass, fat_mass, body_temp, scale,
+                                drag_coefficient, GetMetabolismPool());
+  }
+}
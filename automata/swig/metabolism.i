@@ -5,9 +5,16 @@
 using namespace ::automata::metabolism;
 %}
 
+class MetabolismPool {
+ public:
+  MetabolismPool();
+  void UpdateAll(int time);
+  int num_animals() const;
+  int num_plants() const;
+};
+
 class Metabolism {
  public:
-  Metabolism(double mass);
   virtual ~Metabolism();
 
   virtual void Update(int time) = 0;
@@ -15,4 +22,6 @@ class Metabolism {
 
   double mass() const { return mass_; }
   double energy() const { return energy_; }
+  void set_active(bool active);
+  bool is_active() const;
 };
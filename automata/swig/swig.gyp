@@ -21,14 +21,37 @@
             'libautomata_files': [
               # We include the .h files so the swig library gets rebuilt when
               # they get updated.
+              '<(DEPTH)/automata/conflict_policy.cc',
+              '<(DEPTH)/automata/conflict_policy.h',
+              '<(DEPTH)/automata/distance_table.cc',
+              '<(DEPTH)/automata/distance_table.h',
+              '<(DEPTH)/automata/factor_kernel.cc',
+              '<(DEPTH)/automata/factor_kernel.h',
+              '<(DEPTH)/automata/factor_set.cc',
+              '<(DEPTH)/automata/factor_set.h',
               '<(DEPTH)/automata/grid.cc',
               '<(DEPTH)/automata/grid.h',
               '<(DEPTH)/automata/grid_object.cc',
               '<(DEPTH)/automata/grid_object.h',
-              '<(DEPTH)/automata/movement_factor.cc',
-              '<(DEPTH)/automata/movement_factor.h',
+              '<(DEPTH)/automata/movement_kernel.h',
+              '<(DEPTH)/automata/object_pool.h',
               '<(DEPTH)/automata/organism.cc',
               '<(DEPTH)/automata/organism.h',
+              '<(DEPTH)/automata/random.h',
+              '<(DEPTH)/automata/sampler.cc',
+              '<(DEPTH)/automata/sampler.h',
+              '<(DEPTH)/automata/species_factors.cc',
+              '<(DEPTH)/automata/species_factors.h',
+              '<(DEPTH)/automata/metabolism/biomass_field.cc',
+              '<(DEPTH)/automata/metabolism/biomass_field.h',
+              '<(DEPTH)/automata/metabolism/fast_math.h',
+              '<(DEPTH)/automata/metabolism/metabolism.cc',
+              '<(DEPTH)/automata/metabolism/metabolism.h',
+              '<(DEPTH)/automata/metabolism/metabolism_pool.cc',
+              '<(DEPTH)/automata/metabolism/metabolism_pool.h',
+              '<(DEPTH)/automata/metabolism/normal_kernel.cc',
+              '<(DEPTH)/automata/metabolism/normal_kernel.h',
+              '<(DEPTH)/automata/metabolism/plant_constants.h',
               '<(DEPTH)/automata/metabolism/plant_metabolism.cc',
               '<(DEPTH)/automata/metabolism/plant_metabolism.h',
               '<(DEPTH)/automata/metabolism/animal_metabolism.cc',
@@ -6,8 +6,11 @@
       'dependencies': [
         '<(DEPTH)/automata/swig/swig.gyp:*',
         '<(DEPTH)/automata/automata.gyp:automata_test',
+        '<(DEPTH)/automata/automata.gyp:movement_benchmark',
         '<(DEPTH)/automata/metabolism/metabolism.gyp:plant_metabolism_test',
         '<(DEPTH)/automata/metabolism/metabolism.gyp:animal_metabolism_test',
+        '<(DEPTH)/automata/metabolism/metabolism.gyp:metabolism_pool_test',
+        '<(DEPTH)/automata/metabolism/metabolism.gyp:biomass_field_test',
       ],
     },
   ],
@@ -93,6 +93,12 @@ class GridObject(C_GridObject):
   def get_index(self):
     return self._object.get_index()
 
+  """ Returns: A handle that refers to this object in the C++ code. It stops
+  referring to anything once the object is destroyed, even if something else
+  takes its place. """
+  def get_handle(self):
+    return self._object.handle()
+
   """ Sets the current position of this object.
   position: The object's position in the form (x, y). """
   def set_position(self, position):
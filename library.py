@@ -10,7 +10,9 @@ except ImportError:
   logger.warning("Falling back on Python yaml parser.")
   from yaml import Loader
 
-from organism import Organism
+from organism import AttributeHelper, Organism
+from swig_modules.automata import BiomassField
+from update_handler import plant_parameters
 
 
 class LibraryError(Exception):
@@ -136,12 +138,10 @@ class Library:
   def __init__(self, library_location):
     self.__library = library_location
 
-  """ Loads an organism from the library.
-  name: The organism's scientific name.
-  grid: The grid to place this organism on.
-  position: Where on the grid to place this organism, in the form (x, y).
-  Returns: An organism object containing this organism. """
-  def load_organism(self, name, grid, position):
+  """ Loads the attributes of a species from the library.
+  name: The species' scientific name.
+  Returns: The attributes, with the defaults filled in. """
+  def __load_attributes(self, name):
     logger.debug("Loading '%s' from '%s'." % (name, self.__library))
 
     name = name.lower()
@@ -158,18 +158,61 @@ class Library:
     defaults_file.close()
 
     # Incorporate the defaults into our original data.
-    merged = _merge_trees(data, defaults)
-
-    organism = Organism(grid, position)
-    organism.set_attributes(merged)
+    return _merge_trees(data, defaults)
 
+  """ Makes sure that something being added to a grid has the same scale as
+  everything else on it.
+  species: The attributes of the species being added.
+  grid: The grid it is being added to. """
+  def __check_scale(self, species, grid):
     if grid.scale() < 0:
-      # This is the first organism we added.
-      logger.info("Setting grid scale to %f." % (organism.Scale))
-      grid.set_scale(organism.Scale)
-    elif organism.Scale != grid.scale():
+      # This is the first thing we added.
+      logger.info("Setting grid scale to %f." % (species.Scale))
+      grid.set_scale(species.Scale)
+    elif species.Scale != grid.scale():
       logger.log_and_raise(LibraryError,
           "Mismatch between object scale %f and grid scale %f." % \
-          (organism.Scale, grid.scale()))
+          (species.Scale, grid.scale()))
+
+  """ Loads an organism from the library.
+  name: The organism's scientific name.
+  grid: The grid to place this organism on.
+  position: Where on the grid to place this organism, in the form (x, y).
+  Returns: An organism object containing this organism. """
+  def load_organism(self, name, grid, position):
+    merged = self.__load_attributes(name)
+
+    organism = Organism(grid, position)
+    organism.set_attributes(merged)
+    self.__check_scale(organism, grid)
 
     return organism
+
+  """ Loads a plant species from the library as a field that covers the whole
+  grid, instead of as individual organisms. Animals that eat it graze on it as
+  they move around.
+  name: The plant's scientific name.
+  grid: The grid that the field covers.
+  size: The size of the grid, in the form (x, y).
+  Returns: The BiomassField that simulates it. """
+  def load_field(self, name, grid, size):
+    plant = AttributeHelper(self.__load_attributes(name))
+    if plant.Taxonomy.Kingdom != "Plantae":
+      logger.log_and_raise(LibraryError,
+          "Only plants can be fields, not '%s'." % (name))
+    self.__check_scale(plant, grid)
+
+    # Every cell is like one plant with an average leaf area.
+    efficiency, area_mean, _ = plant_parameters(plant, "field '%s'" % (name))
+    args = [size[0], size[1], plant.Metabolism.Plant.SeedlingMass,
+            plant.Metabolism.Plant.MaxCellMass, efficiency, area_mean,
+            plant.Metabolism.Plant.Cellulose,
+            plant.Metabolism.Plant.Hemicellulose,
+            plant.Metabolism.Plant.Lignin]
+    logger.debug("Constructing BiomassField with args: %s" % (args))
+    field = BiomassField(*args)
+
+    Organism.add_field(grid,
+                       "%s %s" % (plant.Taxonomy.Genus, plant.Taxonomy.Species),
+                       field)
+    return field
@@ -6,6 +6,7 @@ Logger.set_path("simulation.log")
 
 import logging
 logger = logging.getLogger(__name__)
+import random
 import select
 import sys
 
@@ -39,8 +40,14 @@ def main():
     logger.fatal("Invalid config, needs GridXSize and GridYSize")
   if "IterationTime" not in config:
     logger.fatal("Invalid config, needs IterationTime.")
+  if "Seed" in config:
+    seed = config["Seed"]
+  else:
+    # Pick one, but make sure we can reproduce this run later.
+    seed = random.getrandbits(32)
+    logger.info("No seed specified, using %d." % (seed))
   simulation = Simulation(config["GridXSize"], config["GridYSize"],
-                          config["IterationTime"])
+                          config["IterationTime"], seed)
 
   # Add them to the simulation.
   for organism in config["Organisms"]:
@@ -48,6 +55,10 @@ def main():
       library = Library(organism["Library"])
       simulation.add_organism(organism["Library"], organism["Name"])
 
+  # Plants that cover the whole grid, if there are any.
+  for field in config.get("Fields", []):
+    simulation.add_field(field["Library"], field["Name"])
+
   # Start it running.
   logger.info("Delegating to simulation process.")
   simulation.start()
@@ -6,7 +6,9 @@ class OrganismError(Exception):
 
 
 import logging
+import weakref
 
+from swig_modules.automata import ConflictPolicy, ConflictResults, KernelSpec
 from swig_modules.automata import Organism as C_Organism
 from update_handler import UpdateHandler
 import grid_object
@@ -41,12 +43,43 @@ class AttributeHelper:
     return self._attributes
 
 
+""" Everything that the organisms on one grid share about their species. Each
+grid gets its own, so that separate simulations don't see each other's
+species. """
+class _GridState:
+  def __init__(self):
+    # Decides how conflicts between members of different species get resolved.
+    self.conflict_policy = ConflictPolicy()
+    # The same as conflict_policy, except that custom conflicts get the
+    # default action. This is what we use if the custom handlers never settle
+    # down.
+    self.fallback_policy = ConflictPolicy()
+    # Maps species identifiers to the identifiers of the species that eat
+    # them.
+    self.predators = {}
+    # Maps species identifiers to how members of that species react to the
+    # things that eat them, as (strength, visibility).
+    self.predator_factors = {}
+    # Maps species identifiers to the BiomassFields of species that are
+    # simulated as a plant layer instead of as individual organisms.
+    self.fields = {}
+
+
 """ The Python representation of an organism. """
 class Organism(grid_object.GridObject, AttributeHelper):
   """ index: The index into the grid_objects array of the simulation this
   organism is part of.
   grid: The grid that this organism is part of.
   position: The position of the object on the grid, in the form (x, y). """
+  # Maps scientific names to the species identifiers that the C++ code uses.
+  _species_ids = {}
+  # Maps grids to the _GridState for the organisms on them. This doesn't keep
+  # the grids alive.
+  _grid_states = weakref.WeakKeyDictionary()
+  # How many times we let the custom handlers run before giving up on them.
+  # This is the same limit that the C++ code uses for its own rounds.
+  _MAX_CUSTOM_ROUNDS = 8
+
   def __init__(self, grid, position):
     # Data read from a configuration file that describes this organism.
     self._attributes = {}
@@ -58,6 +91,8 @@ class Organism(grid_object.GridObject, AttributeHelper):
     # Metabolism handler for this organism. A handler will initialize it,
     # because it is unique depending on the organism.
     self.metabolism = None
+    # The species identifiers of everything that we eat.
+    self.__prey_ids = []
 
     # Underlying C++ organism. This object is shared with the Python GridObject
     # superclass, which makes sense seeing that the C++ version of Organism
@@ -88,6 +123,17 @@ class Organism(grid_object.GridObject, AttributeHelper):
 
     return True
 
+  """ Finishes updating this organism once every conflict has been resolved.
+  Should be run every iteration, after update() and resolve_conflicts().
+  iteration_time: Simulation time since the last iteration. """
+  def settle(self, iteration_time):
+    if not self.is_alive():
+      # It got eaten, or died some other way.
+      return
+
+    for handler in self.__handlers:
+      handler.settle_organism(self, iteration_time)
+
   """ Sets the organism's attributes. Also does some initialization that can
   only be done after the attributes are set.
   attributes: The attribute data to set. """
@@ -100,23 +146,217 @@ class Organism(grid_object.GridObject, AttributeHelper):
     # Figure out which handlers apply to us.
     UpdateHandler.set_handlers_static_filtering(self)
 
-    # As soon as an organism comes online, we need to create movement factors
-    # representing it and add them for every organism that will be affected by
-    # this one. It doesn't matter if we add movement factors to plants, because
-    # their positions never get updated anyway.
-    for organism in self.grid_objects:
-      if isinstance(organism, Organism):
-        if (hasattr(self, "Prey") and organism.scientific_name() in self.Prey):
-          # Add a movement factor that causes them to flee us.
-          organism.add_factor_from_organism(self, True)
-          # Add a movement factor that causes us to be attracted to them.
-          self.add_factor_from_organism(organism, False)
-        elif (hasattr(organism, "Prey") and \
-              self.scientific_name() in organism.Prey):
-          # Add a movement factor that causes them to be attracted to us.
-          organism.add_factor_from_organism(self, False)
-          # Add a movement factor that causes us to flee them.
-          self.add_factor_from_organism(organism, True)
+    # Tell the C++ code what we are and what we eat, so that movement can tell
+    # our prey apart from everything else.
+    species = -1
+    prey_ids = []
+    if hasattr(self, "Taxonomy"):
+      species = Organism._get_species_id(self.scientific_name())
+      self._object.set_species(species)
+    if hasattr(self, "Prey"):
+      # A single prey species can be given without putting it in a list.
+      prey_names = self.Prey
+      if isinstance(prey_names, str):
+        prey_names = [prey_names]
+      for prey in prey_names:
+        prey_id = Organism._get_species_id(prey)
+        prey_ids.append(prey_id)
+        self.__prey_ids.append(prey_id)
+        self._object.AddPrey(prey_id)
+        if species >= 0:
+          self.__set_conflict_action(species, prey_id, ConflictPolicy.kEat)
+    if species >= 0 and hasattr(self, "Conflicts"):
+      # Any special ways of resolving conflicts with other species.
+      actions = {"RandomLoser": ConflictPolicy.kRandomLoser,
+                 "Swap": ConflictPolicy.kSwap,
+                 "Retreat": ConflictPolicy.kRetreat,
+                 "Custom": ConflictPolicy.kCustom}
+      for name, action in self.Conflicts.get_all_attributes().items():
+        if action not in actions:
+          logger.log_and_raise(OrganismError,
+              "Invalid conflict action: '%s'" % (action))
+        self.__set_conflict_action(species, Organism._get_species_id(name),
+                                   actions[action])
+
+    # Movement factors get declared once for each pair of species, and the C++
+    # code finds the members of those species when it needs them.
+    if species >= 0:
+      self.__set_species_factors(species, prey_ids)
+
+  """ Sets how conflicts between two species get resolved.
+  species1: The first species identifier. For kEat, this is the one that does
+  the eating.
+  species2: The second species identifier.
+  action: The ConflictPolicy action to use. """
+  def __set_conflict_action(self, species1, species2, action):
+    state = Organism._get_grid_state(self.__grid)
+    state.conflict_policy.Set(species1, species2, action)
+    if action == ConflictPolicy.kCustom:
+      action = state.fallback_policy.get_default_action()
+    state.fallback_policy.Set(species1, species2, action)
+
+  """ Declares the movement factors that members of our species feel from the
+  species that they eat, and from the species that eat them.
+  species: Our species identifier.
+  prey_ids: The species identifiers of everything that we eat. """
+  def __set_species_factors(self, species, prey_ids):
+    species_factors = self.__grid.species_factors()
+    state = Organism._get_grid_state(self.__grid)
+
+    # Flee anything that eats us.
+    predator_factor = self.__get_factor("Predator")
+    if predator_factor:
+      state.predator_factors[species] = predator_factor
+      for predator in state.predators.get(species, []):
+        species_factors.Set(species, predator, *predator_factor)
+
+    # Chase anything that we eat, and make it flee us.
+    prey_factor = self.__get_factor("Prey")
+    for prey in prey_ids:
+      predators = state.predators.setdefault(prey, [])
+      if species not in predators:
+        predators.append(species)
+      if prey_factor:
+        species_factors.Set(species, prey, *prey_factor)
+      if prey in state.predator_factors:
+        species_factors.Set(prey, species, *state.predator_factors[prey])
+
+  """ Gets the strength and visibility of one of our movement factors.
+  kind: Either "Predator" for how we react to things that eat us, or "Prey" for
+  how we react to things that we eat.
+  Returns: The strength and visibility, or None if we don't specify them. """
+  def __get_factor(self, kind):
+    try:
+      animal = self.Metabolism.Animal
+      return (getattr(animal, kind + "FactorStrength"),
+              getattr(animal, kind + "FactorVisibility"))
+    except AttributeError:
+      return None
+
+  """ Gets the species identifier for a scientific name, making a new one if it
+  hasn't been seen before.
+  name: The scientific name of the species.
+  Returns: The species identifier. """
+  @staticmethod
+  def _get_species_id(name):
+    if name not in Organism._species_ids:
+      Organism._species_ids[name] = len(Organism._species_ids)
+    return Organism._species_ids[name]
+
+  """ Gets the species information that the organisms on a grid share, making
+  it if it doesn't exist yet.
+  grid: The grid.
+  Returns: The _GridState for the grid. """
+  @staticmethod
+  def _get_grid_state(grid):
+    if grid not in Organism._grid_states:
+      Organism._grid_states[grid] = _GridState()
+    return Organism._grid_states[grid]
+
+  """ Adds a plant species that is simulated as a field.
+  grid: The grid that the field covers.
+  name: The scientific name of the species.
+  field: The BiomassField that simulates it. """
+  @staticmethod
+  def add_field(grid, name, field):
+    state = Organism._get_grid_state(grid)
+    state.fields[Organism._get_species_id(name)] = field
+
+  """ Grows every plant field on a grid.
+  grid: The grid whose fields to grow.
+  iteration_time: Simulation time since the last iteration. """
+  @staticmethod
+  def update_fields(grid, iteration_time):
+    for field in Organism._get_grid_state(grid).fields.values():
+      field.Update(iteration_time)
+
+  """ Eats from every field of something that we eat, in the cell that we are
+  in. This should only be called once conflicts are resolved, so that we don't
+  eat from cells that we never get to. """
+  def graze(self):
+    x_pos, y_pos = self.get_position()
+    fields = Organism._get_grid_state(self.__grid).fields
+    for prey in self.__prey_ids:
+      if prey not in fields:
+        continue
+      energy = fields[prey].Graze(x_pos, y_pos,
+          self.Metabolism.Animal.GrazeFraction)
+      logger.debug("Organism %d grazed %f J." % (self.get_index(), energy))
+      # Giving it a negative loss is actually a gain.
+      self.metabolism.UseEnergy(-energy)
+
+  """ Evaluates the next move for all the animals in a list of organisms in one
+  batch, which is much faster than letting them each do it separately.
+  organisms: The organisms to prepare moves for. Anything that isn't an animal
+  gets skipped. """
+  @staticmethod
+  def prepare_moves(organisms):
+    animals = [organism._object for organism in organisms \
+               if isinstance(organism, Organism) and \
+                  hasattr(organism, "Taxonomy") and \
+                  organism.Taxonomy.Kingdom == "Animalia"]
+    if not C_Organism.PrepareMoves(animals):
+      logger.log_and_raise(OrganismError, "Failed to prepare moves.")
+
+  """ Resolves every conflict on the grid. Predation and everything else that
+  the species library specifies gets done in C++, and only conflicts between
+  species that are marked "Custom" get handled here.
+  grid: The grid to resolve conflicts on. """
+  @staticmethod
+  def resolve_conflicts(grid):
+    state = Organism._get_grid_state(grid)
+    for _ in range(Organism._MAX_CUSTOM_ROUNDS):
+      results = Organism.__apply_conflict_policy(grid, state.conflict_policy)
+      if not len(results.custom2):
+        return
+
+      # We are going to be in the conflicted slot, which is what
+      # handle_conflict() expects.
+      for conflicted in results.custom2:
+        conflicted = grid_object.GridObject.get_by_index(
+            conflicted.get_index())
+        conflicted.handle_conflict()
+      # That could have caused more conflicts, so go around again.
+
+    # The custom handlers keep making new conflicts, so settle whatever is left
+    # the way that everything else gets settled.
+    logger.warning("Custom conflicts still left after %d rounds, using the "
+                   "default policy." % (Organism._MAX_CUSTOM_ROUNDS))
+    Organism.__apply_conflict_policy(grid, state.fallback_policy)
+
+  """ Resolves every conflict on the grid that a policy doesn't mark as custom.
+  grid: The grid to resolve conflicts on.
+  policy: The ConflictPolicy to use.
+  Returns: The ConflictResults, which list any custom conflicts left over. """
+  @staticmethod
+  def __apply_conflict_policy(grid, policy):
+    results = ConflictResults()
+    resolved = grid.ResolveConflicts(policy, results)
+    for i, stats in enumerate(results.rounds):
+      logger.debug("Conflict round %d: %d conflicts, %d eaten, %d swapped, "
+                   "%d retreated, %d relocated, %d custom, %d failed." % \
+                   (i, stats.conflicts, stats.eaten, stats.swapped,
+                    stats.retreated, stats.relocated, stats.custom,
+                    stats.failed))
+
+    # The grid already took the eaten organisms off the grid, but their energy
+    # still has to go somewhere.
+    for eater, eaten in zip(results.eaters, results.eaten):
+      eater = grid_object.GridObject.get_by_index(eater.get_index())
+      eaten = grid_object.GridObject.get_by_index(eaten.get_index())
+      logger.info("Organism %d is consuming organism %d." % \
+                  (eater.get_index(), eaten.get_index()))
+      eater.metabolism.Consume(eaten.metabolism)
+      eaten.die()
+
+    if not resolved:
+      logger.log_and_raise(OrganismError, "Failed to resolve conflicts.")
+    return results
+
+  """ Returns: The seed that the simulation this organism is part of uses for
+  random numbers. """
+  def get_seed(self):
+    return self.__grid.seed()
 
   """ Returns whether or not the organism is alive. """
   def is_alive(self):
@@ -127,11 +367,11 @@ class Organism(grid_object.GridObject, AttributeHelper):
   def add_handler(self, handler):
     self.__handlers.append(handler)
 
-  """ Updates the position of the organism. """
+  """ Updates the position of the organism.
+  Returns: False if the organism ended up conflicted with something, True
+  otherwise. """
   def update_position(self):
-    if not self._object.UpdatePosition():
-      logger.log_and_raise(OrganismError,
-          "Updating organism %d position failed." % (self.get_index()))
+    return self._object.UpdatePosition()
 
   """ Resolves a conflict in the best way possible. """
   def handle_conflict(self):
@@ -211,46 +451,16 @@ class Organism(grid_object.GridObject, AttributeHelper):
   """ Causes the organism to die. """
   def die(self):
     logger.info("Organism %d is dying." % (self.get_index()))
+    # This also removes any lingering references to ourselves hanging around in
+    # the C++ code.
     self._object.Die()
+    # Dead things don't metabolize.
+    if self.metabolism:
+      self.metabolism.set_active(False)
 
     # Delete ourselves from the grid_objects array and from the grid.
     self.delete()
 
-    # Remove any lingering references to ourselves hanging around in the C++
-    # code.
-    for organism in grid_object.GridObject.grid_objects:
-      if not isinstance(organism, Organism):
-        continue
-      organism.cleanup_organism(self)
-
-  """ Adds a movement factor from a specific organism.
-  organism: The organism to use for the factor.
-  prey: True if we are the prey of that organism. Otherwise, we are the
-  predator. """
-  def add_factor_from_organism(self, organism, prey):
-    logger.debug("%d: Adding factor for %d. Prey: %s" % (self.get_index(),
-                                                         organism.get_index(),
-                                                         prey))
-
-    if prey:
-      strength = self.Metabolism.Animal.PredatorFactorStrength
-      visibility = self.Metabolism.Animal.PredatorFactorVisibility
-    else:
-      strength = self.Metabolism.Animal.PreyFactorStrength
-      visibility = self.Metabolism.Animal.PreyFactorVisibility
-
-    # Actually add the factor.
-    self._object.AddFactorFromOrganism(organism._object, strength,
-                                         visibility)
-
-  """ Removes all references to another organism from this organism.
-  organism: The organism to remove references to. """
-  def cleanup_organism(self, organism):
-    logger.debug("%d: Cleaning up %d." % (self.get_index(),
-                                          organism.get_index()))
-
-    self._object.CleanupOrganism(organism._object)
-
   """ Sets how far away the organism can percieve movement factors.
   vision: The new value for the organism's vision. """
   def set_vision(self, vision):
@@ -260,3 +470,45 @@ class Organism(grid_object.GridObject, AttributeHelper):
   movement factors. """
   def get_vision(self):
     return self._object.get_vision()
+
+  """ Sets how the organism decides where to move.
+  mode: Either "Exhaustive" or "Sampled".
+  samples: How many cells to look at for each move in "Sampled" mode. """
+  def set_movement_mode(self, mode, samples):
+    if mode == "Exhaustive":
+      self._object.set_movement_mode(C_Organism.kExhaustive, samples)
+    elif mode == "Sampled":
+      self._object.set_movement_mode(C_Organism.kSampled, samples)
+    else:
+      logger.log_and_raise(OrganismError,
+          "Invalid movement mode: '%s'" % (mode))
+
+  """ Sets how the weights of the organism's movement factors fall off with
+  distance.
+  kernel: One of "InversePower", "Exponential", "Cutoff", or "Linear".
+  scale: The length scale of the kernel, in cells. Ignored for
+  "InversePower". """
+  def set_kernel(self, kernel, scale):
+    kernels = {"InversePower": KernelSpec.kInversePower,
+               "Exponential": KernelSpec.kExponential,
+               "Cutoff": KernelSpec.kCutoff,
+               "Linear": KernelSpec.kLinear}
+    if kernel not in kernels:
+      logger.log_and_raise(OrganismError,
+          "Invalid movement kernel: '%s'" % (kernel))
+    if kernel != "InversePower" and scale <= 0:
+      logger.log_and_raise(OrganismError,
+          "Movement kernel '%s' needs a positive scale." % (kernel))
+
+    self._object.set_kernel(kernels[kernel], scale)
+
+  """ Sets how willing the organism is to move to cells that something other
+  than its prey is already moving to.
+  weight: A multiplier for the probability of moving to those cells, between 0
+  and 1. """
+  def set_pending_weight(self, weight):
+    if weight < 0 or weight > 1:
+      logger.log_and_raise(OrganismError,
+          "Pending weight must be between 0 and 1, got %f." % (weight))
+
+    self._object.set_pending_weight(weight)
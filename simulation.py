@@ -11,6 +11,7 @@ import logging
 import random
 
 from library import Library
+from organism import Organism
 from phased_loop import PhasedLoop
 from swig_modules import automata
 import visualization
@@ -23,17 +24,22 @@ logger = logging.getLogger(__name__)
 class Simulation:
   """ x_size: The horizontal size of this simulation's grid.
   y_size: The vertical size of this simulation's grid.
-  iteration_time: How much time each iteration encompasses. """
-  def __init__(self, x_size, y_size, iteration_time):
+  iteration_time: How much time each iteration encompasses.
+  seed: The seed for all the random numbers in the simulation. """
+  def __init__(self, x_size, y_size, iteration_time, seed = 0):
     self.__x_size = x_size
     self.__y_size = y_size
     self.__iteration_time = iteration_time
+    self.__seed = seed
 
     # A list of organisms to get loaded as soon as we fork.
     self.__to_load = []
+    # A list of plant fields to get loaded as soon as we fork.
+    self.__fields_to_load = []
 
     # Generate random sets of non-repeating numbers that we will use for placing
     # grid objects.
+    random.seed(seed)
     self.__random_x = list(range(0, x_size))
     self.__random_y = list(range(0, y_size))
     random.shuffle(self.__random_x)
@@ -48,6 +54,7 @@ class Simulation:
   def __run_simulation_process(self):
     # The grid for this simulation.
     self.__grid = automata.Grid(self.__x_size, self.__y_size)
+    self.__grid.set_seed(self.__seed)
     # The visualization of the grid for this simulation.
     self.__grid_vis = visualization.GridVisualization(
         self.__x_size, self.__y_size)
@@ -61,6 +68,12 @@ class Simulation:
     # TODO(danielp): Make this rate user-settable.
     simulation_limiter = PhasedLoop(1)
 
+    # Load all the fields that we needed to load.
+    for library_name, name in self.__fields_to_load:
+      library = Library(library_name)
+      library.load_field(name, self.__grid, (self.__x_size, self.__y_size))
+      logger.info("Adding field of '%s'." % (name))
+
     # Load all the organisms that we needed to load.
     for organism in self.__to_load:
       library_name = organism[0]
@@ -97,6 +110,13 @@ class Simulation:
 
   """ Completely update the grid a single time. """
   def __run_iteration(self):
+    # Figure out where everything wants to move all at once.
+    Organism.prepare_moves(self.__grid_objects)
+    # Update the metabolism of everything at once, which is much faster than
+    # letting each organism do its own.
+    automata.GetMetabolismPool().UpdateAll(self.__iteration_time)
+    Organism.update_fields(self.__grid, self.__iteration_time)
+
     # Update the status of all objects.
     to_delete = []
     for grid_object in self.__grid_objects:
@@ -107,6 +127,12 @@ class Simulation:
     for organism in to_delete:
       self.__grid_objects.remove(organism)
 
+    # Resolve everything that ended up conflicted.
+    Organism.resolve_conflicts(self.__grid)
+    # Now that everything is where it's going to end up, finish updating it.
+    for organism in self.__grid_objects:
+      organism.settle(self.__iteration_time)
+
     # Update the grid.
     if not self.__grid.Update():
       logger.log_and_raise(SimulationError, "Grid Update() failed unexpectedly.")
@@ -137,3 +163,10 @@ class Simulation:
     y_pos = self.__random_y.pop()
 
     self.__to_load.append((library, name, x_pos, y_pos))
+
+  """ Adds a plant species to the simulation as a field that covers the whole
+  grid, instead of as individual organisms.
+  library: The library to load it from.
+  name: The name of the species. """
+  def add_field(self, library, name):
+    self.__fields_to_load.append((library, name))
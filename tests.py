@@ -117,6 +117,38 @@ class TestOrganism(unittest.TestCase):
     # grid.
     self.assertTrue(self.__grid.Update())
 
+  """ Does resolving every conflict at once handle predation correctly? """
+  def test_resolve_conflicts(self):
+    predator = organism.Organism(self.__grid, (1, 1))
+    self.assertTrue(self.__grid.Update())
+
+    prey_attributes = {"Taxonomy": {"Genus": "Prey", "Species": "Species"},
+        "Metabolism": {"Animal": {"PredatorFactorStrength": -1,
+        "PredatorFactorVisibility": -1}}}
+    predator_attributes = {"Prey": "Prey Species",
+        "Taxonomy": {"Genus": "Predator", "Species": "Species"}, "Metabolism":
+        {"Animal": {"PreyFactorStrength": 1,
+        "PreyFactorVisibility": -1}}}
+    self.__organism.set_attributes(prey_attributes)
+    predator.set_attributes(predator_attributes)
+
+    predator.metabolism = AnimalMetabolism(0.5, 0.1, 310.15, 0.5, 0.37)
+    self.__organism.metabolism = AnimalMetabolism(0.5, 0.1, 310.15,
+                                                  0.5, 0.37)
+    original_energy = predator.metabolism.energy()
+
+    # Make them conflict.
+    self.__organism.set_position((0, 0))
+    with self.assertRaises(grid_object.GridObjectError):
+      predator.set_position((0, 0))
+
+    organism.Organism.resolve_conflicts(self.__grid)
+
+    # The predator should have eaten the prey.
+    self.assertFalse(self.__organism.is_alive())
+    self.assertEqual(original_energy * 2, predator.metabolism.energy())
+    self.assertTrue(self.__grid.Update())
+
 
 """ Tests the library class. """
 class TestLibrary(unittest.TestCase):
@@ -173,6 +205,11 @@ class TestLibrary(unittest.TestCase):
     self.assertEqual(organism.CommonName, "Test Species")
     self.assertEqual(organism.Taxonomy.Domain, "TestDomain")
 
+  """ Do we refuse to make fields out of things that aren't plants? """
+  def test_load_field(self):
+    with self.assertRaises(library.LibraryError):
+      self.__library.load_field("test species", self.__grid, (10, 10))
+
   """ Do the flatten_tree and expand_tree functions work properly? """
   def test_flatten_tree(self):
     expected_paths = [["key1", 1], ["key2", "key3", 3],
@@ -289,6 +326,9 @@ class TestUpdateHandler(unittest.TestCase):
       # Kind of a dumb way to detect if the handler ran, but it works.
       raise RuntimeError("Ran handler.")
 
+    def settle(self, organism, *args):
+      raise RuntimeError("Settled handler.")
+
   def setUp(self):
     # Reset the list of saved grid objects so that we end up with the right
     # indices.
@@ -336,5 +376,15 @@ class TestUpdateHandler(unittest.TestCase):
     with self.assertRaises(RuntimeError):
       self.__organism2.update(0)
 
+  """ Does settling run the handlers, and skip organisms that are dead? """
+  def test_settle(self):
+    # The dynamic filter applies here too.
+    self.__organism1.settle(0)
+    with self.assertRaisesRegex(RuntimeError, "Settled handler."):
+      self.__organism2.settle(0)
+
+    self.__organism2.die()
+    self.__organism2.settle(0)
+
 if __name__ == "__main__":
   unittest.main()
@@ -10,7 +10,6 @@ import inspect
 import logging
 import sys
 
-from organism import OrganismError
 from swig_modules.automata import AnimalMetabolism, PlantMetabolism
 import user_handlers
 
@@ -18,6 +17,38 @@ import user_handlers
 logger = logging.getLogger(__name__)
 
 
+""" Works out the photosynthesis parameters of a plant species.
+plant: The attributes of the plant.
+description: What to call the plant in log messages.
+Returns: The efficiency of photosynthesis, and the mean and standard deviation
+of the leaf area. """
+def plant_parameters(plant, description):
+  # Figure out efficiency.
+  if plant.Metabolism.Photosynthesis.Pathway == "C3":
+    efficiency = plant.Metabolism.Photosynthesis.C3Efficiency
+  elif plant.Metabolism.Photosynthesis.Pathway == "C4":
+    efficiency = plant.Metabolism.Photosynthesis.C4Efficiency
+  else:
+    raise ValueError("Invalid photosynthesis pathway: '%s'" % \
+                      (plant.Metabolism.Photosynthesis.Pathway))
+
+  # Figure out the amount of leaf area.
+  try:
+    area_mean = plant.Metabolism.Plant.MeanLeafArea
+  except AttributeError:
+    logger.warning("Using default leaf area mean for %s." % (description))
+    # Calculate a plausible leaf area based on the scale.
+    area_mean = 0.5 * (plant.Scale ** 2)
+  try:
+    area_stddev = plant.Metabolism.Plant.LeafAreaStddev
+  except AttributeError:
+    logger.warning("Using default leaf area stddev for %s." % (description))
+    # Calculate a plausible leaf standard deviation based on the area.
+    area_stddev = area_mean * 0.3
+
+  return (efficiency, area_mean, area_stddev)
+
+
 """ Defines a common superclass for all update handlers. An update handler is
 something that gets run every iteration of the simulation on a filtered subset
 of the organisms being updated. This framework is designed so that users
@@ -93,6 +124,16 @@ class UpdateHandler:
   def run(self, organism, iteration_time):
     raise NotImplementedError("'run' must be implemented by subclass.")
 
+  """ Runs the part of the handler that needs to know where the organism
+  actually ended up. This gets run after every conflict in the iteration has
+  been resolved, so the organism's position is final, and it doesn't get run at
+  all if the organism was eaten. By default, it does nothing.
+  organism: The organism to run the handler on.
+  iteration_time: How much simulation time passed since the last time we ran the
+                  handler. """
+  def settle(self, organism, iteration_time):
+    pass
+
   """ Determines whether a paticular organism meets the static filtering
   criteria for this handler.
   organism: The organism to check.
@@ -122,6 +163,13 @@ class UpdateHandler:
     if self.dynamic_filter(organism):
       self.run(organism, iteration_time)
 
+  """ Checks the dynamic filters, and if the organism passes, it calls settle.
+  organism: The organism to run the handler on.
+  iteration_time: Simulation time since when we last ran this. """
+  def settle_organism(self, organism, iteration_time):
+    if self.dynamic_filter(organism):
+      self.settle(organism, iteration_time)
+
 
 """ Handler for animals. """
 class AnimalHandler(UpdateHandler):
@@ -150,26 +198,39 @@ class AnimalHandler(UpdateHandler):
                  (organism.Vision))
     organism.set_vision(organism.Vision)
 
+    # Set up how the organism decides where to move.
+    logger.debug("Using movement mode %s." % (organism.Movement.Mode))
+    organism.set_movement_mode(organism.Movement.Mode,
+                               organism.Movement.Samples)
+    logger.debug("Using movement kernel %s with scale %f." % \
+                 (organism.Movement.Kernel, organism.Movement.KernelScale))
+    organism.set_kernel(organism.Movement.Kernel,
+                        organism.Movement.KernelScale)
+    logger.debug("Using pending weight %f." % \
+                 (organism.Movement.PendingWeight))
+    organism.set_pending_weight(organism.Movement.PendingWeight)
+
   def run(self, organism, iteration_time):
-    old_position = organism.get_position()
+    # Remember where we started, so that we know how far we went once we've
+    # settled.
+    organism.start_position = organism.get_position()
     logger.debug("Old position of %d: %s" % \
-        (organism.get_index(), old_position))
+        (organism.get_index(), organism.start_position))
 
-    # Update animal position.
-    try:
-      print("Updating position.")
-      organism.update_position()
-      print("Updated position.")
-    except OrganismError:
-      # Check to see if we have a conflict we can resolve.
-      organism.handle_conflict()
+    # Update animal position. If we end up conflicted with something, it gets
+    # resolved along with every other conflict once everything has moved, so we
+    # don't know where we'll end up until settle().
+    if not organism.update_position():
+      logger.debug("Organism %d is conflicted." % (organism.get_index()))
 
+  def settle(self, organism, iteration_time):
+    old_position = organism.start_position
     new_position = organism.get_position()
     logger.debug("New position of %d: %s" % \
         (organism.get_index(), new_position))
 
-    # Update the metabolism simulator for this time step.
-    organism.metabolism.Update(iteration_time)
+    # The metabolism simulator was already updated for this time step, along
+    # with everyone else's.
     logger.debug("Animal mass: %f, Animal energy: %f" % \
                 (organism.metabolism.mass(), organism.metabolism.energy()))
 
@@ -178,6 +239,9 @@ class AnimalHandler(UpdateHandler):
                      (new_position[1] - old_position[1]) ** 2) ** (0.5)
     organism.metabolism.Move(move_distance, iteration_time)
 
+    # Eat from any plant fields in the cell that we actually ended up in.
+    organism.graze()
+
     # Organism should die if it runs out of energy.
     if organism.metabolism.energy() <= 0:
       logger.info("Killing organism due to lack of energy.")
@@ -196,39 +260,17 @@ class PlantHandler(UpdateHandler):
     logger.debug("Initializing metabolism simulation for organism %d." %
                   (organism.get_index()))
 
-    # Figure out efficiency.
-    if organism.Metabolism.Photosynthesis.Pathway == "C3":
-      efficiency = organism.Metabolism.Photosynthesis.C3Efficiency
-    elif organism.Metabolism.Photosynthesis.Pathway == "C4":
-      efficiency = organism.Metabolism.Photosynthesis.C4Efficiency
-    else:
-      raise ValueError("Invalid photosynthesis pathway: '%s'" % \
-                        (organism.Metabolism.Photosynthesis.Pathway))
-
+    efficiency, area_mean, area_stddev = plant_parameters(organism,
+        "plant '%d'" % (organism.get_index()))
     mass = organism.Metabolism.Plant.SeedlingMass
 
-    # Figure out the amount of leaf area.
-    try:
-      area_mean = organism.Metabolism.Plant.MeanLeafArea
-    except AttributeError:
-      logger.warning("Using default leaf area mean for plant '%d'." % \
-                      (organism.get_index()))
-      # Calculate a plausible leaf area based on the scale.
-      area_mean = 0.5 * (organism.Scale ** 2)
-    try:
-      area_stddev = organism.Metabolism.Plant.LeafAreaStddev
-    except AttributeError:
-      logger.warning("Using default leaf area stddev for plant '%d'." % \
-                      (organism.get_index()))
-      # Calculate a plausible leaf standard deviation based on the area.
-      area_stddev = area_mean * 0.3
-
     cellulose = organism.Metabolism.Plant.Cellulose
     hemicellulose = organism.Metabolism.Plant.Hemicellulose
     lignin = organism.Metabolism.Plant.Lignin
 
+    # Give each plant its own stream of random numbers.
     args = [mass, efficiency, area_mean, area_stddev, cellulose,
-            hemicellulose, lignin]
+            hemicellulose, lignin, organism.get_seed(), organism.get_index()]
     logger.debug("Constructing PlantMetabolism with args: %s" % (args))
     organism.metabolism = PlantMetabolism(*args)
 
@@ -238,13 +280,16 @@ class PlantHandler(UpdateHandler):
     logger.debug("Plant position: %s" % (str(organism.get_position())))
     organism.set_position(organism.get_position())
 
-    # Update the metabolism simulator for this time step.
-    organism.metabolism.Update(iteration_time)
-    logger.debug("Plant mass: %f, energy: %f" % \
-        (organism.metabolism.mass(), organism.metabolism.energy()))
+    # The metabolism simulator was already updated for this time step, along
+    # with everyone else's. Looking at the energy works out what the plant has
+    # grown without using up any of its random numbers, so this doesn't change
+    # how the simulation turns out.
+    energy = organism.metabolism.energy()
+    logger.debug("Plant energy: %f" % (energy))
 
-    # Organism should die if it runs out of energy.
-    if organism.metabolism.energy() <= 0:
+    # Organism should die if it runs out of energy. Leaf areas can come out
+    # negative, so a plant can starve even though it never uses energy itself.
+    if energy <= 0:
       logger.info("Killing organism due to lack of energy.")
       organism.die()
 